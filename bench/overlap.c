@@ -0,0 +1,277 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Overlap removal benchmark (make bench)
+ *
+ * Times remove_overlapping_elements() against the pairwise pass it
+ * replaced, on random elements at 500, 2k and 10k elements, and checks on
+ * randomized thresholds and hint sizes that both keep the same elements
+ * in the same order. Exits with 1 on the first mismatch.
+ */
+
+#include "../src/platform.h"
+#include "../src/common/image_loader.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void remove_overlapping_elements(struct ui_detection_result *result);
+
+/* Equivalence check: threshold/hint size combinations and their sizes */
+#define CHECK_COMBINATIONS 400
+#define CHECK_ELEMENTS 300
+
+/* Timed runs per size (the best one is reported) */
+#define BENCH_RUNS 5
+
+/* Config and platform stubs for ui_utils.c */
+struct platform *platform = NULL;
+
+static int overlap_threshold = 30;
+static int hint_size = 20;
+static char area_threshold[32] = "0.7";
+
+const char *config_get(const char *key)
+{
+	if (!strcmp(key, "ui_overlap_area_threshold"))
+		return area_threshold;
+	return NULL;
+}
+
+int config_get_int(const char *key)
+{
+	if (!strcmp(key, "ui_overlap_threshold"))
+		return overlap_threshold;
+	if (!strcmp(key, "hint_size"))
+		return hint_size;
+	return 0;
+}
+
+struct cursor_image *load_cursor_image(const char *filename)
+{
+	return NULL;
+}
+
+void draw_cursor_image(screen_t scr, struct cursor_image *img, int x, int y)
+{
+}
+
+/* The O(n²) pass remove_overlapping_elements() used before the grid */
+
+static double reference_overlap_ratio(const struct ui_element *a, const struct ui_element *b)
+{
+	int left = (a->x > b->x) ? a->x : b->x;
+	int top = (a->y > b->y) ? a->y : b->y;
+	int right = ((a->x + a->w) < (b->x + b->w)) ? (a->x + a->w) : (b->x + b->w);
+	int bottom = ((a->y + a->h) < (b->y + b->h)) ? (a->y + a->h) : (b->y + b->h);
+
+	if (left >= right || top >= bottom)
+		return 0.0;
+
+	int overlap_area = (right - left) * (bottom - top);
+	int area_a = a->w * a->h;
+	int area_b = b->w * b->h;
+	int smaller_area = (area_a < area_b) ? area_a : area_b;
+
+	if (smaller_area <= 0)
+		return 0.0;
+
+	return (double)overlap_area / smaller_area;
+}
+
+static void reference_remove_overlapping(struct ui_detection_result *result)
+{
+	double threshold = atof(area_threshold);
+	int hw = hint_size > 0 ? hint_size : 20;
+	int hh = hw;
+	char *keep = malloc(result->count);
+	size_t n = 0;
+
+	memset(keep, 1, result->count);
+
+	for (size_t i = 0; i < result->count; i++) {
+		if (!keep[i])
+			continue;
+
+		for (size_t j = i + 1; j < result->count; j++) {
+			struct ui_element *a = &result->elements[i];
+			struct ui_element *b = &result->elements[j];
+
+			if (!keep[j])
+				continue;
+
+			int dx = b->x - a->x;
+			int dy = b->y - a->y;
+			int collide = sqrt(dx * dx + dy * dy) < overlap_threshold;
+
+			if (!collide) {
+				struct ui_element hint_a = { .x = a->x, .y = a->y, .w = hw, .h = hh };
+				struct ui_element hint_b = { .x = b->x, .y = b->y, .w = hw, .h = hh };
+
+				collide = reference_overlap_ratio(&hint_a, &hint_b) > threshold;
+			}
+
+			if (collide) {
+				if (a->w * a->h < b->w * b->h)
+					keep[i] = 0;
+				else
+					keep[j] = 0;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < result->count; i++) {
+		if (keep[i])
+			result->elements[n++] = result->elements[i];
+	}
+	result->count = n;
+
+	free(keep);
+}
+
+/**
+ * Fill a result with count random elements on a screen of the given size
+ */
+static void random_result(struct ui_detection_result *result, size_t count, int screen_w,
+			  int screen_h)
+{
+	memset(result, 0, sizeof(*result));
+	result->elements = calloc(count, sizeof(struct ui_element));
+	result->count = count;
+
+	for (size_t i = 0; i < count; i++) {
+		struct ui_element *e = &result->elements[i];
+
+		e->x = rand() % screen_w;
+		e->y = rand() % screen_h;
+		e->w = 5 + rand() % 200;
+		e->h = 5 + rand() % 60;
+	}
+}
+
+static struct ui_detection_result copy_result(const struct ui_detection_result *src)
+{
+	struct ui_detection_result copy = *src;
+
+	copy.elements = malloc(src->count * sizeof(struct ui_element));
+	memcpy(copy.elements, src->elements, src->count * sizeof(struct ui_element));
+	return copy;
+}
+
+static int same_elements(const struct ui_detection_result *a, const struct ui_detection_result *b)
+{
+	if (a->count != b->count)
+		return 0;
+
+	for (size_t i = 0; i < a->count; i++) {
+		const struct ui_element *ea = &a->elements[i];
+		const struct ui_element *eb = &b->elements[i];
+
+		if (ea->x != eb->x || ea->y != eb->y || ea->w != eb->w || ea->h != eb->h)
+			return 0;
+	}
+
+	return 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Best time in ms of remove(input) over BENCH_RUNS runs
+ */
+static double time_removal(void (*remove)(struct ui_detection_result *),
+			   const struct ui_detection_result *input)
+{
+	double best = -1;
+
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		struct ui_detection_result result = copy_result(input);
+		double start = now_ms();
+
+		remove(&result);
+
+		double elapsed = now_ms() - start;
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+		free(result.elements);
+	}
+
+	return best;
+}
+
+static int check_equivalence(void)
+{
+	for (int i = 0; i < CHECK_COMBINATIONS; i++) {
+		struct ui_detection_result input, grid, reference;
+
+		overlap_threshold = rand() % 80 - 5;
+		hint_size = rand() % 50 - 5;
+		snprintf(area_threshold, sizeof area_threshold, "%.2f",
+			 (rand() % 130 - 10) / 100.0);
+
+		/* Small screens force dense clusters */
+		random_result(&input, 1 + rand() % CHECK_ELEMENTS, 100 + rand() % 1900,
+			      100 + rand() % 1000);
+		grid = copy_result(&input);
+		reference = copy_result(&input);
+
+		remove_overlapping_elements(&grid);
+		reference_remove_overlapping(&reference);
+
+		int same = same_elements(&grid, &reference);
+		if (!same)
+			fprintf(stderr, "Mismatch: %zu elements, ui_overlap_threshold %d, "
+				"hint_size %d, ui_overlap_area_threshold %s: %zu kept, %zu expected\n",
+				input.count, overlap_threshold, hint_size, area_threshold,
+				grid.count, reference.count);
+
+		free(input.elements);
+		free(grid.elements);
+		free(reference.elements);
+
+		if (!same)
+			return 0;
+	}
+
+	printf("%d threshold/hint size combinations: identical results\n", CHECK_COMBINATIONS);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t sizes[] = { 500, 2000, 10000 };
+
+	srand(argc > 1 ? (unsigned int)atoi(argv[1]) : 1);
+
+	if (!check_equivalence())
+		return 1;
+
+	/* Defaults of ui_overlap_threshold, ui_overlap_area_threshold and hint_size */
+	overlap_threshold = 30;
+	hint_size = 20;
+	snprintf(area_threshold, sizeof area_threshold, "0.7");
+
+	for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		struct ui_detection_result input;
+
+		random_result(&input, sizes[i], 2560, 1440);
+
+		double pairwise = time_removal(reference_remove_overlapping, &input);
+		double grid = time_removal(remove_overlapping_elements, &input);
+
+		printf("%6zu elements: pairwise %8.2f ms, grid %6.2f ms (%.0fx)\n",
+		       sizes[i], pairwise, grid, grid > 0 ? pairwise / grid : 0);
+
+		free(input.elements);
+	}
+
+	return 0;
+}
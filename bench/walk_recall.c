@@ -0,0 +1,397 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Walk recall benchmark (make bench)
+ *
+ * Replays AT-SPI trees in the format ui_atspi_dump_tree writes through
+ * the depth-first walker that was replaced and the best-first walker, and
+ * reports the recall of each at a few ui_max_elements budgets: the share
+ * of the interactive candidates (buttons, links, entries, ...) a full walk
+ * finds that the walk collected before the budget ran out.
+ *
+ * Visibility, clipping and candidate rules follow atspi-detector.c; the
+ * scores come from atspi-walk.h. The trees in bench/trees are written in
+ * that format by hand after the layout of an editor and a browser window;
+ * trees recorded with ui_atspi_dump_tree can be passed on the command
+ * line.
+ */
+
+#include "../src/platform/linux/atspi-walk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DEPTH 25           /* ui_max_depth */
+#define MIN_VISIBLE_AREA 100   /* ui_min_visible_area */
+
+struct rect {
+	int x, y, w, h;
+};
+
+struct node {
+	char role[32];
+	struct rect r;
+	int hidden;
+	int depth;
+	int first_child;       /* -1 if none */
+	int next_sibling;
+	int target;            /* Interactive candidate a full walk collects */
+};
+
+struct tree {
+	struct node *nodes;
+	int count;
+};
+
+/* Role tables of atspi-detector.c, by the names atspi_role_get_name() uses */
+
+static const char *excluded_roles[] = {
+	"panel", "section", "html container", "frame", "menu bar", "tool bar", "list",
+	"page tab list", "description list", "scroll pane", "table", "grouping",
+};
+
+static const char *interactive_roles[] = {
+	"push button", "toggle button", "check box", "radio button", "link", "menu item",
+	"check menu item", "radio menu item", "page tab", "entry", "password text",
+	"combo box", "spin button", "slider",
+};
+
+static const char *container_roles[] = {
+	"tool bar", "menu bar", "menu", "page tab list",
+};
+
+static const char *leaf_roles[] = {
+	"push button", "toggle button", "check box", "radio button", "menu item",
+	"check menu item", "radio menu item", "entry", "password text", "slider",
+	"scroll bar", "progress bar", "separator", "icon", "image",
+};
+
+static int in_set(const char *role, const char **set, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (!strcmp(role, set[i]))
+			return 1;
+	}
+	return 0;
+}
+
+#define IN(role, set) in_set(role, set, sizeof set / sizeof set[0])
+
+static int role_interactivity(const char *role)
+{
+	if (IN(role, interactive_roles))
+		return 2;
+	if (IN(role, container_roles))
+		return 1;
+	return 0;
+}
+
+static int clips_children(const char *role)
+{
+	return !strcmp(role, "scroll pane") || !strcmp(role, "viewport");
+}
+
+static int intersect_rect(const struct rect *a, const struct rect *b, struct rect *out)
+{
+	int x = a->x > b->x ? a->x : b->x;
+	int y = a->y > b->y ? a->y : b->y;
+	int x2 = a->x + a->w < b->x + b->w ? a->x + a->w : b->x + b->w;
+	int y2 = a->y + a->h < b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	if (x2 <= x || y2 <= y)
+		return 0;
+
+	out->x = x;
+	out->y = y;
+	out->w = x2 - x;
+	out->h = y2 - y;
+	return 1;
+}
+
+/* check_is_actually_visible() */
+static int is_visible(const struct rect *clip, const struct rect *r)
+{
+	struct rect common;
+
+	if (r->w <= 0 || r->h <= 0)
+		return 0;
+	if (!clip)
+		return 1;
+	if (!intersect_rect(clip, r, &common))
+		return 0;
+
+	int visible = common.w * common.h;
+	return visible >= r->w * r->h / 2 || visible >= MIN_VISIBLE_AREA;
+}
+
+/* collect_element_info() */
+static int is_candidate(const struct node *n)
+{
+	return !IN(n->role, excluded_roles) && n->r.x > 0 && n->r.y > 0;
+}
+
+/**
+ * Read a tree dump, one node per line, indented two spaces per level
+ */
+static int load_tree(const char *path, struct tree *tree)
+{
+	FILE *fh = fopen(path, "r");
+	char line[1024];
+	int last_at_depth[MAX_DEPTH + 64];
+	int capacity = 0;
+
+	if (!fh) {
+		perror(path);
+		return 0;
+	}
+
+	tree->nodes = NULL;
+	tree->count = 0;
+
+	while (fgets(line, sizeof line, fh)) {
+		int indent = 0;
+		while (line[indent] == ' ')
+			indent++;
+
+		char *open = strchr(line, '[');
+		char *close = open ? strchr(open, ']') : NULL;
+		char *extents = close ? strstr(close, "' x=") : NULL;
+		int depth = indent / 2;
+
+		if (!extents || depth >= (int)(sizeof last_at_depth / sizeof last_at_depth[0]) ||
+		    depth > (tree->count ? tree->nodes[tree->count - 1].depth + 1 : 0))
+			continue;
+
+		if (tree->count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			tree->nodes = realloc(tree->nodes, capacity * sizeof(struct node));
+		}
+
+		struct node *n = &tree->nodes[tree->count];
+		memset(n, 0, sizeof(*n));
+		snprintf(n->role, sizeof n->role, "%.*s", (int)(close - open - 1), open + 1);
+		if (sscanf(extents, "' x=%d y=%d w=%d h=%d", &n->r.x, &n->r.y, &n->r.w,
+			   &n->r.h) != 4)
+			continue;
+		n->hidden = strstr(extents, " hidden") != NULL;
+		n->depth = depth;
+		n->first_child = -1;
+		n->next_sibling = -1;
+
+		/* Link to the previous sibling, or to the parent */
+		if (depth > 0 && tree->nodes[tree->count - 1].depth < depth)
+			tree->nodes[last_at_depth[depth - 1]].first_child = tree->count;
+		else if (depth > 0 || tree->count > 0)
+			tree->nodes[last_at_depth[depth]].next_sibling = tree->count;
+		last_at_depth[depth] = tree->count;
+
+		tree->count++;
+	}
+
+	fclose(fh);
+	return tree->count > 0;
+}
+
+/*
+ * Depth-first walker (before best-first): collect, then recurse into
+ * every child in order until the budget is used up
+ */
+static void walk_depth_first(struct tree *tree, int index, const struct rect *clip,
+			     int budget, int *collected, int *targets)
+{
+	struct node *n = &tree->nodes[index];
+	struct rect child_clip;
+
+	if (n->depth > MAX_DEPTH || *collected >= budget || n->hidden ||
+	    !is_visible(clip, &n->r))
+		return;
+
+	if (is_candidate(n)) {
+		(*collected)++;
+		*targets += n->target;
+	}
+
+	if (clip && clips_children(n->role)) {
+		if (!intersect_rect(clip, &n->r, &child_clip))
+			return;
+		clip = &child_clip;
+	}
+
+	for (int c = n->first_child; c >= 0 && *collected < budget; c = tree->nodes[c].next_sibling)
+		walk_depth_first(tree, c, clip, budget, collected, targets);
+}
+
+struct entry {
+	int node;
+	int score;
+	int order;
+	struct rect clip;
+};
+
+static int entry_before(const struct entry *a, const struct entry *b)
+{
+	return a->score > b->score || (a->score == b->score && a->order < b->order);
+}
+
+/* Binary heap, highest score first, as in dump_node_content() */
+struct queue {
+	struct entry *heap;
+	int len;
+	int capacity;
+	int next_order;
+};
+
+static void queue_offer(struct queue *q, struct tree *tree, int index, const struct rect *clip)
+{
+	struct node *n = &tree->nodes[index];
+	struct rect visible;
+
+	if (n->depth > MAX_DEPTH || n->hidden || !is_visible(clip, &n->r))
+		return;
+
+	if (!intersect_rect(clip, &n->r, &visible))
+		visible.w = visible.h = 0;
+
+	if (q->len == q->capacity) {
+		q->capacity = q->capacity ? q->capacity * 2 : 256;
+		q->heap = realloc(q->heap, q->capacity * sizeof(struct entry));
+	}
+
+	struct entry e = {
+		.node = index,
+		.score = atspi_walk_score(role_interactivity(n->role), n->depth,
+					  (unsigned long)visible.w * (unsigned long)visible.h),
+		.order = q->next_order++,
+		.clip = *clip,
+	};
+
+	int i = q->len++;
+	while (i > 0 && entry_before(&e, &q->heap[(i - 1) / 2])) {
+		q->heap[i] = q->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	q->heap[i] = e;
+}
+
+static struct entry queue_pop(struct queue *q)
+{
+	struct entry top = q->heap[0];
+	struct entry last = q->heap[--q->len];
+	int i = 0;
+
+	for (;;) {
+		int best = i;
+		int l = 2 * i + 1, r = 2 * i + 2;
+		const struct entry *best_entry = &last;
+
+		if (l < q->len && entry_before(&q->heap[l], best_entry)) {
+			best = l;
+			best_entry = &q->heap[l];
+		}
+		if (r < q->len && entry_before(&q->heap[r], best_entry))
+			best = r;
+		if (best == i)
+			break;
+
+		q->heap[i] = q->heap[best];
+		i = best;
+	}
+	q->heap[i] = last;
+
+	return top;
+}
+
+static void walk_best_first(struct tree *tree, const struct rect *clip, int budget,
+			    int *collected, int *targets)
+{
+	struct queue q = { 0 };
+
+	queue_offer(&q, tree, 0, clip);
+
+	while (q.len > 0 && *collected < budget) {
+		struct entry e = queue_pop(&q);
+		struct node *n = &tree->nodes[e.node];
+		struct rect child_clip = e.clip;
+
+		if (is_candidate(n)) {
+			(*collected)++;
+			*targets += n->target;
+		}
+
+		if (IN(n->role, leaf_roles))
+			continue;
+		if (clips_children(n->role) && !intersect_rect(&e.clip, &n->r, &child_clip))
+			continue;
+
+		for (int c = n->first_child; c >= 0; c = tree->nodes[c].next_sibling)
+			queue_offer(&q, tree, c, &child_clip);
+	}
+
+	free(q.heap);
+}
+
+/**
+ * Mark the interactive candidates the unbounded depth-first walk collects
+ */
+static int mark_targets(struct tree *tree, int index, const struct rect *clip)
+{
+	struct node *n = &tree->nodes[index];
+	struct rect child_clip;
+	int count = 0;
+
+	if (n->depth > MAX_DEPTH || n->hidden || !is_visible(clip, &n->r))
+		return 0;
+
+	if (is_candidate(n) && role_interactivity(n->role) == 2) {
+		n->target = 1;
+		count++;
+	}
+
+	if (clips_children(n->role)) {
+		if (!intersect_rect(clip, &n->r, &child_clip))
+			return count;
+		clip = &child_clip;
+	}
+
+	for (int c = n->first_child; c >= 0; c = tree->nodes[c].next_sibling)
+		count += mark_targets(tree, c, clip);
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	const char *defaults[] = { "bench/trees/editor.tree", "bench/trees/browser.tree" };
+	const int budgets[] = { 25, 50, 100, 200 };
+	const char **paths = argc > 1 ? (const char **)argv + 1 : defaults;
+	int count = argc > 1 ? argc - 1 : (int)(sizeof defaults / sizeof defaults[0]);
+
+	for (int t = 0; t < count; t++) {
+		struct tree tree;
+
+		if (!load_tree(paths[t], &tree))
+			return 1;
+
+		/* The window is the root clip, as in collect_window() */
+		struct rect window = tree.nodes[0].r;
+		int total = mark_targets(&tree, 0, &window);
+
+		printf("%s: %d nodes, %d interactive candidates\n", paths[t], tree.count, total);
+		for (size_t b = 0; b < sizeof budgets / sizeof budgets[0]; b++) {
+			int df_collected = 0, df_targets = 0;
+			int bf_collected = 0, bf_targets = 0;
+
+			walk_depth_first(&tree, 0, &window, budgets[b], &df_collected, &df_targets);
+			walk_best_first(&tree, &window, budgets[b], &bf_collected, &bf_targets);
+
+			printf("  budget %4d: depth-first %3d%% (%d/%d), best-first %3d%% (%d/%d)\n",
+			       budgets[b],
+			       total ? df_targets * 100 / total : 0, df_targets, total,
+			       total ? bf_targets * 100 / total : 0, bf_targets, total);
+		}
+
+		free(tree.nodes);
+	}
+
+	return 0;
+}
@@ -4,100 +4,596 @@
  * Common Detector Orchestrator Implementation
  *
  * Implements Strategy + Chain of Responsibility pattern for UI detection.
+ * The "race" policies run the strategies concurrently instead, each in
+ * its own thread with its own cancellation token and time budget.
  */
 
 #include "detector_orchestrator.h"
+#include "detector_profile.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct ui_detection_result* detector_orchestrator_run(
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/* Import config functions */
+extern const char *config_get(const char *key);
+extern int config_get_int(const char *key);
+
+/* How often a race checks budgets and the caller's token (ms) */
+#define RACE_POLL_INTERVAL 5
+
+#define MAX_STRATEGIES 8
+
+typedef enum {
+	POLICY_SEQUENTIAL,
+	POLICY_RACE,
+	POLICY_RACE_THEN_MERGE,
+} orchestrator_policy_t;
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION race_lock_t;
+typedef CONDITION_VARIABLE race_cond_t;
+typedef HANDLE race_thread_t;
+
+static int64_t now_ms(void)
+{
+	return (int64_t)GetTickCount64();
+}
+#else
+typedef pthread_mutex_t race_lock_t;
+typedef pthread_cond_t race_cond_t;
+typedef pthread_t race_thread_t;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+struct race;
+
+/* One strategy running in a race */
+struct strategy_run {
+	detector_strategy_t *strategy;
+	struct race *race;
+	race_thread_t thread;
+	int started;                   /* Thread was created */
+
+	struct ui_cancel_token cancel;
+	struct detector_limits limits;
+	int64_t budget_ms;             /* 0 = unbounded */
+	int64_t start_time;
+	int64_t end_time;
+
+	/* Protected by race->lock */
+	int done;
+	int examined;                  /* Outcome already logged */
+	struct ui_detection_result *result;
+};
+
+struct race {
+	race_lock_t lock;
+	race_cond_t cond;             /* Signaled when a strategy finishes */
+	struct strategy_run runs[MAX_STRATEGIES];
+	size_t count;
+};
+
+static orchestrator_policy_t get_policy(void)
+{
+	const char *policy = config_get("ui_detector_policy");
+
+	if (policy && !strcmp(policy, "race"))
+		return POLICY_RACE;
+	if (policy && !strcmp(policy, "race-then-merge"))
+		return POLICY_RACE_THEN_MERGE;
+
+	return POLICY_SEQUENTIAL;
+}
+
+static void free_strategy_result(detector_strategy_t *strategy,
+				 struct ui_detection_result *result)
+{
+	if (!result) {
+		return;
+	}
+
+	if (strategy->free_result) {
+		strategy->free_result(result);
+	} else {
+		free_detection_result(result);
+	}
+}
+
+static struct ui_detection_result *error_result(const char *msg)
+{
+	struct ui_detection_result *result = calloc(1, sizeof(*result));
+	if (result) {
+		result->error = -1;
+		snprintf(result->error_msg, sizeof(result->error_msg), "%s", msg);
+	}
+	return result;
+}
+
+/**
+ * Check whether a strategy succeeded with enough elements
+ */
+static int result_acceptable(detector_strategy_t *strategy,
+			     struct ui_detection_result *result)
+{
+	if (!result || result->error != 0) {
+		return 0;
+	}
+
+	return strategy->min_elements <= 0 ||
+	       result->count >= (size_t)strategy->min_elements;
+}
+
+/**
+ * Log the outcome and timing of one strategy
+ */
+static void log_outcome(const char *platform_name, detector_strategy_t *strategy,
+			struct ui_detection_result *result, int64_t elapsed_ms)
+{
+	if (!result) {
+		fprintf(stderr, "%s: %s detection returned NULL (%lld ms)\n",
+			platform_name, strategy->name, (long long)elapsed_ms);
+	} else if (result->error != 0) {
+		fprintf(stderr, "%s: %s detection failed (error: %d, %s, %lld ms)\n",
+			platform_name, strategy->name, result->error, result->error_msg,
+			(long long)elapsed_ms);
+	} else if (!result_acceptable(strategy, result)) {
+		fprintf(stderr, "%s: %s found only %zu elements (minimum: %d, %lld ms)\n",
+			platform_name, strategy->name, result->count, strategy->min_elements,
+			(long long)elapsed_ms);
+	} else {
+		fprintf(stderr, "%s: %s found %zu elements in %lld ms%s\n",
+			platform_name, strategy->name, result->count, (long long)elapsed_ms,
+			result->partial ? " (partial, stopped at timeout)" : "");
+	}
+}
+
+/**
+ * Log the outcome of one strategy and add it to the profile of app
+ */
+static void note_outcome(const char *platform_name, const char *app,
+			 detector_strategy_t *strategy, const struct detector_limits *limits,
+			 struct ui_detection_result *result, int64_t elapsed_ms)
+{
+	log_outcome(platform_name, strategy, result, elapsed_ms);
+
+	if (app)
+		detector_profile_record(app, strategy, limits, result,
+					result_acceptable(strategy, result), elapsed_ms);
+}
+
+static int strategy_available(detector_strategy_t *strategy, const char *platform_name)
+{
+	if (!strategy->is_available) {
+		fprintf(stderr, "%s: %s not available (no availability check)\n",
+			platform_name, strategy->name);
+		return 0;
+	}
+
+	if (!strategy->is_available()) {
+		fprintf(stderr, "%s: %s not available\n", platform_name, strategy->name);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Try each strategy in order until one succeeds
+ */
+static struct ui_detection_result *run_sequential(
 	detector_strategy_t *strategies,
 	size_t count,
-	const char *platform_name)
+	const char *platform_name,
+	const char *app,
+	const struct detector_limits *limits,
+	const struct ui_cancel_token *cancel)
 {
-	if (!strategies || count == 0) {
-		struct ui_detection_result *err = calloc(1, sizeof(*err));
-		if (err) {
-			err->error = -1;
-			snprintf(err->error_msg, sizeof(err->error_msg), "No detection strategies available");
+	for (size_t i = 0; i < count; i++) {
+		detector_strategy_t *strategy = &strategies[i];
+
+		if (ui_cancel_requested(cancel))
+			break;
+
+		if (!strategy_available(strategy, platform_name)) {
+			continue;
 		}
-		return err;
+
+		fprintf(stderr, "%s: Trying %s detection\n", platform_name, strategy->name);
+
+		/* Run detection */
+		int64_t start = now_ms();
+		struct ui_detection_result *result = strategy->detect(limits, cancel);
+		int64_t elapsed = now_ms() - start;
+
+		/* Whatever was found is of no use any more */
+		if (ui_cancel_requested(cancel)) {
+			free_strategy_result(strategy, result);
+			break;
+		}
+
+		note_outcome(platform_name, app, strategy, limits, result, elapsed);
+
+		if (result_acceptable(strategy, result)) {
+			/* Apply common overlap removal if detection succeeded */
+			remove_overlapping_elements(result);
+			return result;
+		}
+
+		/* Free result and try next strategy */
+		free_strategy_result(strategy, result);
 	}
 
-	/* Try each detector strategy in order */
-	for (size_t i = 0; i < count; i++) {
-		detector_strategy_t *strategy = &strategies[i];
+	return NULL;
+}
 
-		/* Check if detector is available */
-		if (!strategy->is_available) {
-			fprintf(stderr, "%s: %s not available (no availability check)\n",
-				platform_name, strategy->name);
+static void race_lock(struct race *race)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&race->lock);
+#else
+	pthread_mutex_lock(&race->lock);
+#endif
+}
+
+static void race_unlock(struct race *race)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&race->lock);
+#else
+	pthread_mutex_unlock(&race->lock);
+#endif
+}
+
+/**
+ * Wait until a strategy finishes or timeout_ms passes (lock held)
+ */
+static void race_wait(struct race *race, int timeout_ms)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(&race->cond, &race->lock, (DWORD)timeout_ms);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)timeout_ms * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+	pthread_cond_timedwait(&race->cond, &race->lock, &ts);
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI race_worker(LPVOID param)
+#else
+static void *race_worker(void *param)
+#endif
+{
+	struct strategy_run *run = param;
+	struct ui_detection_result *result = run->strategy->detect(&run->limits, &run->cancel);
+
+	race_lock(run->race);
+	run->result = result;
+	run->end_time = now_ms();
+	run->done = 1;
+#ifdef _WIN32
+	WakeAllConditionVariable(&run->race->cond);
+#else
+	pthread_cond_broadcast(&run->race->cond);
+#endif
+	race_unlock(run->race);
+
+	return 0;
+}
+
+static int race_start(struct strategy_run *run)
+{
+	run->start_time = now_ms();
+
+#ifdef _WIN32
+	run->thread = CreateThread(NULL, 0, race_worker, run, 0, NULL);
+	run->started = run->thread != NULL;
+#else
+	run->started = pthread_create(&run->thread, NULL, race_worker, run) == 0;
+#endif
+
+	return run->started;
+}
+
+static void race_join(struct strategy_run *run)
+{
+	if (!run->started) {
+		return;
+	}
+
+#ifdef _WIN32
+	WaitForSingleObject(run->thread, INFINITE);
+	CloseHandle(run->thread);
+#else
+	pthread_join(run->thread, NULL);
+#endif
+	run->started = 0;
+}
+
+/**
+ * Combine the acceptable results of a race into one malloc'ed result
+ *
+ * The merged result outlives the results it is made of, so the names
+ * they deferred are looked up first; merged elements never defer.
+ */
+static struct ui_detection_result *merge_results(struct race *race,
+						 const struct ui_cancel_token *cancel)
+{
+	size_t total = 0;
+	size_t sources = 0;
+
+	for (size_t i = 0; i < race->count; i++) {
+		struct strategy_run *run = &race->runs[i];
+		if (result_acceptable(run->strategy, run->result)) {
+			total += run->result->count;
+			sources++;
+		}
+	}
+
+	if (sources == 0) {
+		return NULL;
+	}
+
+	struct ui_detection_result *merged = calloc(1, sizeof(*merged));
+	if (!merged) {
+		return NULL;
+	}
+
+	merged->elements = calloc(total ? total : 1, sizeof(struct ui_element));
+	if (!merged->elements) {
+		free(merged);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < race->count; i++) {
+		struct strategy_run *run = &race->runs[i];
+		if (!result_acceptable(run->strategy, run->result)) {
 			continue;
 		}
 
-		if (!strategy->is_available()) {
-			fprintf(stderr, "%s: %s not available\n", platform_name, strategy->name);
+		if (run->result->deferred_names && run->strategy->resolve_names)
+			run->strategy->resolve_names(run->result, cancel);
+
+		for (size_t j = 0; j < run->result->count; j++) {
+			struct ui_element *src = &run->result->elements[j];
+			struct ui_element *dest = &merged->elements[merged->count++];
+
+			*dest = *src;
+			dest->name = src->name ? strdup(src->name) : NULL;
+			dest->role = src->role ? strdup(src->role) : NULL;
+			dest->source = NULL;
+		}
+
+		merged->partial |= run->result->partial;
+	}
+
+	return merged;
+}
+
+/**
+ * Run all available strategies at once
+ *
+ * In race mode the first acceptable result wins and the other strategies
+ * are cancelled; in race-then-merge mode every strategy runs to completion
+ * (or its budget) and the acceptable results are merged.
+ */
+static struct ui_detection_result *run_race(
+	detector_strategy_t *strategies,
+	size_t count,
+	const char *platform_name,
+	const char *app,
+	const struct detector_limits *limits,
+	const struct ui_cancel_token *cancel,
+	orchestrator_policy_t policy)
+{
+	struct race *race = calloc(1, sizeof(*race));
+	if (!race) {
+		return NULL;
+	}
+
+#ifdef _WIN32
+	InitializeCriticalSection(&race->lock);
+	InitializeConditionVariable(&race->cond);
+#else
+	pthread_mutex_init(&race->lock, NULL);
+	pthread_cond_init(&race->cond, NULL);
+#endif
+
+	int default_budget = config_get_int("ui_strategy_budget");
+	if (default_budget <= 0)
+		default_budget = config_get_int("ui_detection_timeout");
+
+	for (size_t i = 0; i < count && race->count < MAX_STRATEGIES; i++) {
+		detector_strategy_t *strategy = &strategies[i];
+
+		if (!strategy_available(strategy, platform_name)) {
 			continue;
 		}
 
-		fprintf(stderr, "%s: Trying %s detection\n", platform_name, strategy->name);
+		struct strategy_run *run = &race->runs[race->count];
+		run->strategy = strategy;
+		run->race = race;
+		run->limits = *limits;
+		run->budget_ms = strategy->budget_ms > 0 ? strategy->budget_ms : default_budget;
 
-		/* Run detection */
-		struct ui_detection_result *result = strategy->detect();
-		if (!result) {
-			fprintf(stderr, "%s: %s detection returned NULL\n", platform_name, strategy->name);
+		fprintf(stderr, "%s: Starting %s detection (budget: %lld ms)\n",
+			platform_name, strategy->name, (long long)run->budget_ms);
+
+		if (!race_start(run)) {
+			fprintf(stderr, "%s: Failed to start %s detection\n",
+				platform_name, strategy->name);
 			continue;
 		}
+		race->count++;
+	}
 
-		/* Check for success */
-		if (result->error == 0) {
-			size_t count_found = result->count;
+	struct strategy_run *winner = NULL;
 
-			/* Check minimum elements threshold */
-			if (strategy->min_elements > 0 && count_found < (size_t)strategy->min_elements) {
-				fprintf(stderr, "%s: %s found only %zu elements (minimum: %d), trying next...\n",
-					platform_name, strategy->name, count_found, strategy->min_elements);
+	race_lock(race);
+	for (;;) {
+		size_t running = 0;
+		int64_t now = now_ms();
 
-				/* Free result and try next strategy */
-				if (strategy->free_result) {
-					strategy->free_result(result);
-				} else {
-					free(result);
+		for (size_t i = 0; i < race->count; i++) {
+			struct strategy_run *run = &race->runs[i];
+
+			if (!run->done) {
+				running++;
+
+				/* Propagate the caller's cancellation and enforce budgets */
+				if (ui_cancel_requested(cancel)) {
+					run->cancel.cancelled = 1;
+				} else if (!run->cancel.cancelled && run->budget_ms > 0 &&
+				           now - run->start_time > run->budget_ms) {
+					fprintf(stderr, "%s: %s over budget, cancelling\n",
+						platform_name, run->strategy->name);
+					run->cancel.cancelled = 1;
 				}
 				continue;
 			}
 
-			fprintf(stderr, "%s: %s found %zu elements\n",
-				platform_name, strategy->name, count_found);
+			if (run->examined) {
+				continue;
+			}
+			run->examined = 1;
 
-			/* Apply common overlap removal if detection succeeded */
-			remove_overlapping_elements(result);
+			note_outcome(platform_name, app, run->strategy, &run->limits,
+				     run->result, run->end_time - run->start_time);
 
-			return result;
+			if (policy == POLICY_RACE && !winner &&
+			    result_acceptable(run->strategy, run->result)) {
+				winner = run;
+			}
 		}
 
-		/* Detection failed */
-		fprintf(stderr, "%s: %s detection failed (error: %d, %s)\n",
-			platform_name, strategy->name, result->error, result->error_msg);
-
-		/* Free result and try next strategy */
-		if (strategy->free_result) {
-			strategy->free_result(result);
-		} else {
-			free(result);
+		if (winner || running == 0) {
+			break;
 		}
+
+		race_wait(race, RACE_POLL_INTERVAL);
 	}
 
-	/* All detectors failed */
-	struct ui_detection_result *error_result = calloc(1, sizeof(*error_result));
-	if (error_result) {
-		error_result->error = -1;
-		snprintf(error_result->error_msg, sizeof(error_result->error_msg),
-			"All detection strategies failed");
+	/* Stop the strategies that lost */
+	for (size_t i = 0; i < race->count; i++) {
+		race->runs[i].cancel.cancelled = 1;
+	}
+	race_unlock(race);
+
+	for (size_t i = 0; i < race->count; i++) {
+		race_join(&race->runs[i]);
+	}
+
+	struct ui_detection_result *result = NULL;
+
+	if (ui_cancel_requested(cancel)) {
+		result = NULL;
+	} else if (winner) {
+		fprintf(stderr, "%s: %s won the race\n", platform_name, winner->strategy->name);
+		result = winner->result;
+		winner->result = NULL;
+	} else if (policy == POLICY_RACE_THEN_MERGE) {
+		result = merge_results(race, cancel);
+	}
+
+	for (size_t i = 0; i < race->count; i++) {
+		free_strategy_result(race->runs[i].strategy, race->runs[i].result);
 	}
 
-	return error_result;
+#ifdef _WIN32
+	DeleteCriticalSection(&race->lock);
+#else
+	pthread_cond_destroy(&race->cond);
+	pthread_mutex_destroy(&race->lock);
+#endif
+	free(race);
+
+	if (result) {
+		remove_overlapping_elements(result);
+	}
+
+	return result;
+}
+
+static void configured_limits(struct detector_limits *limits)
+{
+	limits->max_depth = config_get_int("ui_max_depth");
+	limits->max_elements = config_get_int("ui_max_elements");
+}
+
+void detector_orchestrator_limits(const char *app, struct detector_limits *limits)
+{
+	configured_limits(limits);
+
+	if (app && config_get_int("ui_detector_profiles")) {
+		detector_profile_limits(app, limits);
+	}
+}
+
+struct ui_detection_result* detector_orchestrator_run(
+	detector_strategy_t *strategies,
+	size_t count,
+	const char *platform_name,
+	const char *app,
+	const struct ui_cancel_token *cancel)
+{
+	if (!strategies || count == 0) {
+		return error_result("No detection strategies available");
+	}
+
+	orchestrator_policy_t policy = get_policy();
+	int64_t start = now_ms();
+	struct ui_detection_result *result;
+	struct detector_limits limits;
+
+	if (app && !config_get_int("ui_detector_profiles")) {
+		app = NULL;
+	}
+
+	configured_limits(&limits);
+	if (app) {
+		detector_profile_plan(app, strategies, count, &limits);
+	}
+
+	if (policy == POLICY_SEQUENTIAL || count == 1) {
+		result = run_sequential(strategies, count, platform_name, app, &limits, cancel);
+	} else {
+		result = run_race(strategies, count, platform_name, app, &limits, cancel,
+				  policy);
+	}
+
+	fprintf(stderr, "%s: Detection took %lld ms (policy: %s)\n",
+		platform_name, (long long)(now_ms() - start),
+		policy == POLICY_RACE ? "race" :
+		policy == POLICY_RACE_THEN_MERGE ? "race-then-merge" : "sequential");
+
+	if (result) {
+		return result;
+	}
+
+	if (ui_cancel_requested(cancel)) {
+		fprintf(stderr, "%s: Detection cancelled\n", platform_name);
+		return ui_cancelled_result();
+	}
+
+	/* All detectors failed */
+	return error_result("All detection strategies failed");
 }
 
 void detector_orchestrator_free(
@@ -113,17 +609,6 @@ void detector_orchestrator_free(
 		free_fn(result);
 	} else {
 		/* Fallback generic free */
-		if (result->elements) {
-			for (size_t i = 0; i < result->count; i++) {
-				if (result->elements[i].name) {
-					free(result->elements[i].name);
-				}
-				if (result->elements[i].role) {
-					free(result->elements[i].role);
-				}
-			}
-			free(result->elements);
-		}
-		free(result);
+		free_detection_result(result);
 	}
 }
@@ -16,12 +16,26 @@
 
 #include "../platform.h"
 
+/**
+ * Traversal limits of one detection
+ *
+ * Start out as ui_max_depth and ui_max_elements; the detection profile of
+ * the application may raise them.
+ */
+struct detector_limits {
+	int max_depth;
+	int max_elements;
+};
+
 /**
  * Detector strategy function signature
  */
-typedef struct ui_detection_result* (*detector_fn)(void);
+typedef struct ui_detection_result* (*detector_fn)(const struct detector_limits *limits,
+						   const struct ui_cancel_token *cancel);
 typedef int (*detector_available_fn)(void);
 typedef void (*detector_free_fn)(struct ui_detection_result *result);
+typedef int (*detector_resolve_fn)(struct ui_detection_result *result,
+				   const struct ui_cancel_token *cancel);
 
 /**
  * Single detector strategy
@@ -29,28 +43,52 @@ typedef void (*detector_free_fn)(struct ui_detection_result *result);
 typedef struct {
 	const char *name;              /* Human-readable name (e.g., "AT-SPI", "OpenCV") */
 	detector_available_fn is_available;  /* Check if detector is available */
-	detector_fn detect;            /* Detect function */
+	detector_fn detect;            /* Detect function (within limits, stops early once cancel is set) */
 	detector_free_fn free_result;  /* Free result function */
+	detector_resolve_fn resolve_names; /* Fill in deferred names before a merge (may be NULL) */
 	int min_elements;              /* Minimum elements threshold (0 = any) */
+	int budget_ms;                 /* Time budget when racing (0 = ui_strategy_budget) */
 } detector_strategy_t;
 
 /**
  * Run detection through chain of strategies
  *
- * Tries each detector in order until one succeeds.
+ * With the default "sequential" ui_detector_policy, tries each detector
+ * in order until one succeeds. "race" runs all available detectors at
+ * once, each cancelled when over its budget; the first result meeting
+ * min_elements wins and the others are cancelled. "race-then-merge" waits
+ * for every detector and merges the results that meet min_elements.
  * If all detectors fail, returns error result.
+ * Once cancel is set no further strategy is tried and the result has
+ * error UI_DETECTION_CANCELLED.
+ *
+ * With app set (and ui_detector_profiles on) the outcomes are recorded in
+ * the detection profile of the application, which in turn may reorder
+ * strategies and raise the limits passed to them for this detection.
  *
- * @param strategies Array of detector strategies
+ * @param strategies Array of detector strategies (may be reordered)
  * @param count Number of strategies
  * @param platform_name Name of platform (for debug output)
+ * @param app Application the detection is for (may be NULL)
+ * @param cancel Cancellation token passed to every strategy (may be NULL)
  * @return Detection result (always non-NULL, check result->error)
  */
 struct ui_detection_result* detector_orchestrator_run(
 	detector_strategy_t *strategies,
 	size_t count,
-	const char *platform_name
+	const char *platform_name,
+	const char *app,
+	const struct ui_cancel_token *cancel
 );
 
+/**
+ * Get the limits detector_orchestrator_run() would detect in app with
+ *
+ * @param app Application the detection is for (may be NULL)
+ * @param limits Filled in
+ */
+void detector_orchestrator_limits(const char *app, struct detector_limits *limits);
+
 /**
  * Free detection result with proper cleanup
  *
@@ -0,0 +1,475 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Per-application detection profiles
+ *
+ * The profiles file is plain text, one application line followed by one
+ * line per strategy tried in it (fields separated by tabs):
+ *
+ *   A <app> <detections> <last used> <max depth> <max elements>
+ *     <quiet depth runs> <quiet element runs>
+ *   S <strategy> <runs> <successes> <elements> <deepest level> <total ms>
+ *
+ * A detection that reached ui_max_depth or filled ui_max_elements raises
+ * the limit for the next one, up to a cap. A learned limit that many
+ * detections in a row stay well under shrinks again, so one large
+ * document does not keep an application on the raised limits for good.
+ */
+
+#include "detector_profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Import data path function */
+extern const char *get_data_path(const char *file);
+
+#define PROFILE_FILE "detector_profiles"
+
+#define PROFILE_MAX_APPS 128
+#define PROFILE_MAX_STRATEGIES 4
+
+/* Runs before a strategy's success rate is trusted */
+#define PROFILE_MIN_RUNS 3
+
+/* Strategies succeeding less often than this (percent) are tried last */
+#define PROFILE_MIN_SUCCESS 25
+
+/* Every this many detections the configured order is used again */
+#define PROFILE_RETRY_INTERVAL 10
+
+/* Growth steps and caps of the learned limits */
+#define PROFILE_DEPTH_STEP 8
+#define PROFILE_DEPTH_CAP 64
+#define PROFILE_ELEMENTS_CAP 4096
+
+/*
+ * Detections in a row that stay this far under a learned limit (levels,
+ * or a quarter of the elements) before it shrinks by one step
+ */
+#define PROFILE_SHRINK_RUNS 20
+#define PROFILE_DEPTH_SLACK (2 * PROFILE_DEPTH_STEP)
+
+struct strategy_profile {
+	char name[32];
+	unsigned int runs;
+	unsigned int successes;
+	unsigned long long elements;
+	int deepest;                  /* Deepest tree level any run reached */
+	unsigned long long total_ms;
+};
+
+struct app_profile {
+	char app[64];
+	unsigned int detections;
+	long long last_used;          /* time() of the last detection */
+	int max_depth;                /* Learned, 0 = configured value */
+	int max_elements;
+	unsigned int quiet_depth;     /* Detections in a row well under max_depth */
+	unsigned int quiet_elements;  /* Detections in a row well under max_elements */
+	struct strategy_profile strategies[PROFILE_MAX_STRATEGIES];
+	size_t strategy_count;
+};
+
+static struct app_profile profiles[PROFILE_MAX_APPS];
+static size_t profile_count = 0;
+static int loaded = 0;
+static int dirty = 0;
+
+#ifdef _WIN32
+static CRITICAL_SECTION lock;
+static int lock_initialized = 0;
+
+static void lock_acquire(void)
+{
+	if (!lock_initialized) {
+		InitializeCriticalSection(&lock);
+		lock_initialized = 1;
+	}
+	EnterCriticalSection(&lock);
+}
+static void lock_release(void) { LeaveCriticalSection(&lock); }
+#else
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_acquire(void) { pthread_mutex_lock(&lock); }
+static void lock_release(void) { pthread_mutex_unlock(&lock); }
+#endif
+
+/**
+ * Copy a key, replacing the characters the file format reserves
+ */
+static void copy_key(char *dest, size_t size, const char *src)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < size && src[i]; i++)
+		dest[i] = (src[i] == '\t' || src[i] == '\n' || src[i] == '\r') ? ' ' : src[i];
+	dest[i] = 0;
+}
+
+/**
+ * Read the profiles file (lock held)
+ */
+static void load_profiles(void)
+{
+	char line[256];
+	struct app_profile *app = NULL;
+
+	if (loaded)
+		return;
+	loaded = 1;
+
+	FILE *fh = fopen(get_data_path(PROFILE_FILE), "r");
+	if (!fh)
+		return;
+
+	while (fgets(line, sizeof line, fh)) {
+		line[strcspn(line, "\r\n")] = 0;
+
+		char *type = strtok(line, "\t");
+		char *key = strtok(NULL, "\t");
+		if (!type || !key)
+			continue;
+
+		if (!strcmp(type, "A") && profile_count < PROFILE_MAX_APPS) {
+			app = &profiles[profile_count++];
+			memset(app, 0, sizeof(*app));
+			copy_key(app->app, sizeof app->app, key);
+
+			char *field;
+			if ((field = strtok(NULL, "\t")))
+				app->detections = (unsigned int)strtoul(field, NULL, 10);
+			if ((field = strtok(NULL, "\t")))
+				app->last_used = strtoll(field, NULL, 10);
+			if ((field = strtok(NULL, "\t")))
+				app->max_depth = atoi(field);
+			if ((field = strtok(NULL, "\t")))
+				app->max_elements = atoi(field);
+			if ((field = strtok(NULL, "\t")))
+				app->quiet_depth = (unsigned int)strtoul(field, NULL, 10);
+			if ((field = strtok(NULL, "\t")))
+				app->quiet_elements = (unsigned int)strtoul(field, NULL, 10);
+		} else if (!strcmp(type, "S") && app &&
+			   app->strategy_count < PROFILE_MAX_STRATEGIES) {
+			struct strategy_profile *sp = &app->strategies[app->strategy_count++];
+
+			copy_key(sp->name, sizeof sp->name, key);
+
+			char *field;
+			if ((field = strtok(NULL, "\t")))
+				sp->runs = (unsigned int)strtoul(field, NULL, 10);
+			if ((field = strtok(NULL, "\t")))
+				sp->successes = (unsigned int)strtoul(field, NULL, 10);
+			if ((field = strtok(NULL, "\t")))
+				sp->elements = strtoull(field, NULL, 10);
+			if ((field = strtok(NULL, "\t")))
+				sp->deepest = atoi(field);
+			if ((field = strtok(NULL, "\t")))
+				sp->total_ms = strtoull(field, NULL, 10);
+		}
+	}
+
+	fclose(fh);
+}
+
+/**
+ * Find the profile of app, creating it if create is set (lock held)
+ *
+ * Once the table is full the least recently used profile is replaced.
+ */
+static struct app_profile *find_app(const char *app, int create)
+{
+	char key[sizeof(profiles[0].app)];
+	struct app_profile *oldest = NULL;
+
+	load_profiles();
+	copy_key(key, sizeof key, app);
+
+	for (size_t i = 0; i < profile_count; i++) {
+		if (!strcmp(profiles[i].app, key))
+			return &profiles[i];
+		if (!oldest || profiles[i].last_used < oldest->last_used)
+			oldest = &profiles[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	struct app_profile *profile = profile_count < PROFILE_MAX_APPS ?
+				      &profiles[profile_count++] : oldest;
+	memset(profile, 0, sizeof(*profile));
+	strcpy(profile->app, key);
+	return profile;
+}
+
+static struct strategy_profile *find_strategy(struct app_profile *app, const char *name,
+					      int create)
+{
+	for (size_t i = 0; i < app->strategy_count; i++) {
+		if (!strcmp(app->strategies[i].name, name))
+			return &app->strategies[i];
+	}
+
+	if (!create || app->strategy_count == PROFILE_MAX_STRATEGIES)
+		return NULL;
+
+	struct strategy_profile *sp = &app->strategies[app->strategy_count++];
+	memset(sp, 0, sizeof(*sp));
+	copy_key(sp->name, sizeof sp->name, name);
+	return sp;
+}
+
+/**
+ * Check whether a strategy has failed too often in app to be tried first
+ */
+static int keeps_failing(struct app_profile *app, const char *name)
+{
+	struct strategy_profile *sp = find_strategy(app, name, 0);
+
+	return sp && sp->runs >= PROFILE_MIN_RUNS &&
+	       sp->successes * 100 < sp->runs * PROFILE_MIN_SUCCESS;
+}
+
+/**
+ * Raise limits to the ones learned in profile (lock held)
+ *
+ * Returns whether any limit was raised.
+ */
+static int raise_limits(const struct app_profile *profile, struct detector_limits *limits)
+{
+	int raised = 0;
+
+	/* Learned limits never replace a limit that is switched off */
+	if (limits->max_depth > 0 && profile->max_depth > limits->max_depth) {
+		limits->max_depth = profile->max_depth;
+		raised = 1;
+	}
+	if (limits->max_elements > 0 && profile->max_elements > limits->max_elements) {
+		limits->max_elements = profile->max_elements;
+		raised = 1;
+	}
+
+	return raised;
+}
+
+void detector_profile_plan(const char *app, detector_strategy_t *strategies, size_t count,
+			   struct detector_limits *limits)
+{
+	lock_acquire();
+
+	struct app_profile *profile = find_app(app, 1);
+	profile->detections++;
+	profile->last_used = (long long)time(NULL);
+	dirty = 1;
+
+	int raised = raise_limits(profile, limits);
+
+	/* Stable partition: strategies that keep failing go last */
+	int reordered = 0;
+	if (profile->detections % PROFILE_RETRY_INTERVAL != 0) {
+		size_t next = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			if (keeps_failing(profile, strategies[i].name))
+				continue;
+
+			if (i != next) {
+				detector_strategy_t strategy = strategies[i];
+				memmove(&strategies[next + 1], &strategies[next],
+					(i - next) * sizeof(*strategies));
+				strategies[next] = strategy;
+				reordered = 1;
+			}
+			next++;
+		}
+	}
+
+	if (reordered || raised)
+		fprintf(stderr, "Profile of %s: %s first, max depth %d, max elements %d\n",
+			profile->app, strategies[0].name, limits->max_depth, limits->max_elements);
+
+	lock_release();
+}
+
+void detector_profile_limits(const char *app, struct detector_limits *limits)
+{
+	lock_acquire();
+
+	struct app_profile *profile = find_app(app, 0);
+	if (profile)
+		raise_limits(profile, limits);
+
+	lock_release();
+}
+
+/**
+ * Raise the learned limits that the detection ran into, shrink the ones
+ * detections keep staying well under (lock held)
+ *
+ * Only tree walks tell how deep and how large the tree is, results that
+ * reached no depth (OpenCV) leave the limits alone.
+ */
+static void adapt_limits(struct app_profile *profile, const struct detector_limits *limits,
+			 const struct ui_detection_result *result)
+{
+	int max_depth = limits->max_depth;
+	int max_elements = limits->max_elements;
+
+	if (result->max_depth_reached <= 0)
+		return;
+
+	if (max_depth > 0 && result->max_depth_reached >= max_depth &&
+	    max_depth < PROFILE_DEPTH_CAP) {
+		profile->max_depth = max_depth + PROFILE_DEPTH_STEP;
+		if (profile->max_depth > PROFILE_DEPTH_CAP)
+			profile->max_depth = PROFILE_DEPTH_CAP;
+		profile->quiet_depth = 0;
+	} else if (profile->max_depth > 0 &&
+		   result->max_depth_reached + PROFILE_DEPTH_SLACK <= profile->max_depth) {
+		if (++profile->quiet_depth >= PROFILE_SHRINK_RUNS) {
+			profile->max_depth -= PROFILE_DEPTH_STEP;
+			if (profile->max_depth < 0)
+				profile->max_depth = 0;
+			profile->quiet_depth = 0;
+			fprintf(stderr, "Profile of %s: max depth lowered to %d\n",
+				profile->app, profile->max_depth);
+		}
+	} else {
+		profile->quiet_depth = 0;
+	}
+
+	if (max_elements > 0 && result->count >= (size_t)max_elements &&
+	    max_elements < PROFILE_ELEMENTS_CAP) {
+		profile->max_elements = max_elements * 2;
+		if (profile->max_elements > PROFILE_ELEMENTS_CAP)
+			profile->max_elements = PROFILE_ELEMENTS_CAP;
+		profile->quiet_elements = 0;
+	} else if (profile->max_elements > 0 &&
+		   result->count * 4 <= (size_t)profile->max_elements) {
+		if (++profile->quiet_elements >= PROFILE_SHRINK_RUNS) {
+			profile->max_elements /= 2;
+			profile->quiet_elements = 0;
+			fprintf(stderr, "Profile of %s: max elements lowered to %d\n",
+				profile->app, profile->max_elements);
+		}
+	} else {
+		profile->quiet_elements = 0;
+	}
+}
+
+void detector_profile_record(const char *app, const detector_strategy_t *strategy,
+			     const struct detector_limits *limits,
+			     const struct ui_detection_result *result, int acceptable,
+			     int64_t elapsed_ms)
+{
+	lock_acquire();
+
+	struct app_profile *profile = find_app(app, 1);
+	struct strategy_profile *sp = find_strategy(profile, strategy->name, 1);
+
+	if (sp) {
+		sp->runs++;
+		sp->successes += acceptable ? 1 : 0;
+		sp->total_ms += elapsed_ms > 0 ? (unsigned long long)elapsed_ms : 0;
+		if (acceptable)
+			sp->elements += result->count;
+		if (result && result->max_depth_reached > sp->deepest)
+			sp->deepest = result->max_depth_reached;
+	}
+
+	if (result && result->error == 0)
+		adapt_limits(profile, limits, result);
+
+	dirty = 1;
+
+	lock_release();
+}
+
+void detector_profile_save(void)
+{
+	char tmp[1024];
+
+	lock_acquire();
+
+	if (!dirty) {
+		lock_release();
+		return;
+	}
+
+	const char *path = get_data_path(PROFILE_FILE);
+	snprintf(tmp, sizeof tmp, "%s.tmp", path);
+
+	FILE *fh = fopen(tmp, "w");
+	if (!fh) {
+		perror("detector profiles");
+		lock_release();
+		return;
+	}
+
+	for (size_t i = 0; i < profile_count; i++) {
+		struct app_profile *app = &profiles[i];
+
+		fprintf(fh, "A\t%s\t%u\t%lld\t%d\t%d\t%u\t%u\n", app->app, app->detections,
+			app->last_used, app->max_depth, app->max_elements, app->quiet_depth,
+			app->quiet_elements);
+
+		for (size_t j = 0; j < app->strategy_count; j++) {
+			struct strategy_profile *sp = &app->strategies[j];
+
+			fprintf(fh, "S\t%s\t%u\t%u\t%llu\t%d\t%llu\n", sp->name, sp->runs,
+				sp->successes, sp->elements, sp->deepest, sp->total_ms);
+		}
+	}
+
+	if (fclose(fh) == 0 && rename(tmp, path) == 0)
+		dirty = 0;
+	else
+		remove(tmp);
+
+	lock_release();
+}
+
+void detector_profile_dump(FILE *out)
+{
+	lock_acquire();
+	load_profiles();
+
+	if (profile_count == 0)
+		fprintf(out, "No detector profiles learned yet (%s)\n", get_data_path(PROFILE_FILE));
+
+	for (size_t i = 0; i < profile_count; i++) {
+		struct app_profile *app = &profiles[i];
+
+		fprintf(out, "%s: %u detections, ui_max_depth ", app->app, app->detections);
+		if (app->max_depth)
+			fprintf(out, "%d", app->max_depth);
+		else
+			fprintf(out, "default");
+		fprintf(out, ", ui_max_elements ");
+		if (app->max_elements)
+			fprintf(out, "%d\n", app->max_elements);
+		else
+			fprintf(out, "default\n");
+
+		for (size_t j = 0; j < app->strategy_count; j++) {
+			struct strategy_profile *sp = &app->strategies[j];
+			unsigned int runs = sp->runs ? sp->runs : 1;
+			unsigned int successes = sp->successes ? sp->successes : 1;
+
+			fprintf(out, "  %-8s %4u runs, %3u%% success, %5llu elements avg, "
+				"depth %2d, %5llu ms avg%s\n",
+				sp->name, sp->runs, sp->successes * 100 / runs,
+				sp->elements / successes, sp->deepest, sp->total_ms / runs,
+				keeps_failing(app, sp->name) ? " (tried last)" : "");
+		}
+	}
+
+	lock_release();
+}
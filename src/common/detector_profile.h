@@ -0,0 +1,65 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Per-application detection profiles
+ *
+ * Applications differ a lot in how well each detector works on them: some
+ * answer AT-SPI quickly, some only yield elements to OpenCV, some nest
+ * their controls deeper than ui_max_depth. The orchestrator records the
+ * outcome of every strategy per application and uses that history to
+ * order the strategies and size ui_max_depth and ui_max_elements for the
+ * application. Profiles are kept in the data directory.
+ */
+
+#ifndef DETECTOR_PROFILE_H
+#define DETECTOR_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "detector_orchestrator.h"
+
+/**
+ * Prepare a detection in app
+ *
+ * Moves the strategies that keep failing in app behind the others (every
+ * few detections the given order is kept, so that they are retried) and
+ * raises limits to the ones learned for app.
+ *
+ * @param app Application key (window class)
+ * @param strategies Strategies, reordered in place
+ * @param limits Configured limits, raised in place
+ */
+void detector_profile_plan(const char *app, detector_strategy_t *strategies, size_t count,
+			   struct detector_limits *limits);
+
+/**
+ * Raise limits to the ones learned for app, without counting a detection
+ */
+void detector_profile_limits(const char *app, struct detector_limits *limits);
+
+/**
+ * Record the outcome of one strategy in app
+ *
+ * A strategy that ran into one of the limits it detected with raises
+ * that limit for the next detection; learned limits that detections keep
+ * staying well under are lowered again.
+ */
+void detector_profile_record(const char *app, const detector_strategy_t *strategy,
+			     const struct detector_limits *limits,
+			     const struct ui_detection_result *result, int acceptable,
+			     int64_t elapsed_ms);
+
+/**
+ * Write the profiles back if anything changed
+ *
+ * Rewrites the whole file, so it is called once the user is done with a
+ * mode rather than from the detection.
+ */
+void detector_profile_save(void);
+
+/**
+ * Print the learned profiles (warpd --detector-stats)
+ */
+void detector_profile_dump(FILE *out);
+
+#endif /* DETECTOR_PROFILE_H */
@@ -21,8 +21,14 @@ extern int config_get_int(const char *key);
 }
 #endif
 
+#include "opencv_detector.h"
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <cstring>
 #include <algorithm>
 #include <cstdlib>  // for atof
 
@@ -69,29 +75,120 @@ std::vector<cv::Rect> deduplicate_rectangles(std::vector<cv::Rect> &rects)
     return result;
 }
 
+/*
+ * Detection runs over overlapping tiles in parallel. The margin covers the
+ * blur and Canny apertures and makes the pieces of a contour cut by a seam
+ * intersect, so they can be merged again.
+ */
+#define TILE_MARGIN 16
+
+// Downscale factor of the coarse pass that finds the tiles worth refining
+#define COARSE_SCALE 4
+
+// Tolerance in pixels when matching contours seen by neighbouring tiles
+#define SEAM_TOLERANCE 3
+
+struct tile_contour {
+    cv::Rect rect;
+    double area;
+    bool owned;   // Center lies in the tile's core
+    bool crosses; // Reaches out of the core into the margin
+};
+
+struct tile_result {
+    std::vector<tile_contour> complete;
+    std::vector<cv::Rect> cut; // Pieces of contours crossing the tile edge
+    bool done;                 // Processed (not cancelled)
+    bool refined;              // Passed the coarse pass
+};
+
+struct cached_tile {
+    cv::Rect ext;      // Must match, the margin is clipped at the image edges
+    tile_result result;
+};
+
+// Keyed by the tile core in screen coordinates
+struct opencv_tile_cache {
+    std::map<std::tuple<int, int, int, int>, cached_tile> tiles;
+};
+
+struct rect_filter {
+    int min_area, max_area;
+    int min_width, min_height;
+    int max_width, max_height;
+    double min_aspect, max_aspect;
+
+    bool accepts(const cv::Rect &rect, double area) const
+    {
+        if (area < min_area || area > max_area)
+            return false;
+
+        if (rect.width < min_width || rect.width > max_width ||
+            rect.height < min_height || rect.height > max_height)
+            return false;
+
+        double aspect = (double)rect.width / rect.height;
+        return aspect >= min_aspect && aspect <= max_aspect;
+    }
+};
+
+static cv::Rect inflate(const cv::Rect &rect, int by)
+{
+    return cv::Rect(rect.x - by, rect.y - by, rect.width + 2 * by, rect.height + 2 * by);
+}
+
+static bool nearly_equal(const cv::Rect &a, const cv::Rect &b)
+{
+    return std::abs(a.x - b.x) <= SEAM_TOLERANCE && std::abs(a.y - b.y) <= SEAM_TOLERANCE &&
+           std::abs(a.width - b.width) <= SEAM_TOLERANCE &&
+           std::abs(a.height - b.height) <= SEAM_TOLERANCE;
+}
+
+static cv::Rect shifted(const cv::Rect &rect, const cv::Point &by)
+{
+    return cv::Rect(rect.x + by.x, rect.y + by.y, rect.width, rect.height);
+}
+
+static void shift_result(tile_result &result, const cv::Point &by)
+{
+    for (auto &c : result.complete)
+        c.rect = shifted(c.rect, by);
+    for (auto &piece : result.cut)
+        piece = shifted(piece, by);
+}
+
 /**
- * Detect rectangular UI elements using edge detection
- * Cross-platform detection logic - works with any cv::Mat input
+ * Coarse pass: whether a downscaled copy of area has any edges
+ *
+ * Downscaling flattens the gradients, hence the lower thresholds; a tile
+ * is rather refined in vain than missed.
  */
-std::vector<cv::Rect> detect_rectangles(const cv::Mat &img)
+static bool has_coarse_edges(const cv::Mat &area)
 {
-    cv::Mat gray, blurred, edges;
+    cv::Mat small, gray, edges;
 
-    // Read filter parameters from config
-    int min_area = config_get_int("opencv_min_area");
-    int max_area = config_get_int("opencv_max_area");
-    int min_width = config_get_int("opencv_min_width");
-    int min_height = config_get_int("opencv_min_height");
-    int max_width = config_get_int("opencv_max_width");
-    int max_height = config_get_int("opencv_max_height");
-    double min_aspect = atof(config_get("opencv_min_aspect"));
-    double max_aspect = atof(config_get("opencv_max_aspect"));
+    cv::resize(area, small, cv::Size(), 1.0 / COARSE_SCALE, 1.0 / COARSE_SCALE, cv::INTER_AREA);
+    cv::cvtColor(small, gray, cv::COLOR_BGRA2GRAY);
+    cv::Canny(gray, edges, 20, 60);
 
-    fprintf(stderr, "OpenCV: Using config - area: %d-%d, size: %dx%d to %dx%d, aspect: %.2f-%.2f\n",
-            min_area, max_area, min_width, min_height, max_width, max_height, min_aspect, max_aspect);
+    return cv::countNonZero(edges) > 0;
+}
+
+/**
+ * Find the contours of one tile (core plus TILE_MARGIN, clipped to img)
+ */
+static void detect_tile(const cv::Mat &img, const cv::Rect &core, bool coarse, tile_result &out)
+{
+    cv::Mat gray, blurred, edges;
+    cv::Rect ext = inflate(core, TILE_MARGIN) & cv::Rect(0, 0, img.cols, img.rows);
+
+    out.done = true;
+    if (coarse && !has_coarse_edges(img(ext)))
+        return;
+    out.refined = true;
 
     // Step 1: Convert to grayscale
-    cv::cvtColor(img, gray, cv::COLOR_BGRA2GRAY);
+    cv::cvtColor(img(ext), gray, cv::COLOR_BGRA2GRAY);
 
     // Step 2: Apply Gaussian blur
     cv::GaussianBlur(gray, blurred, cv::Size(5, 5), 0);
@@ -103,43 +200,252 @@ std::vector<cv::Rect> detect_rectangles(const cv::Mat &img)
     std::vector<std::vector<cv::Point>> contours;
     cv::findContours(edges, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
 
-    // Step 5: Filter rectangles
+    for (const auto &contour : contours) {
+        cv::Rect rect = cv::boundingRect(contour);
+
+        // Touches an edge of the tile that is not an edge of the image
+        bool cut = (rect.x <= 1 && ext.x > 0) || (rect.y <= 1 && ext.y > 0) ||
+                   (rect.x + rect.width >= ext.width - 1 && ext.x + ext.width < img.cols) ||
+                   (rect.y + rect.height >= ext.height - 1 && ext.y + ext.height < img.rows);
+
+        rect.x += ext.x;
+        rect.y += ext.y;
+
+        if (cut) {
+            out.cut.push_back(rect);
+        } else {
+            cv::Point center(rect.x + rect.width / 2, rect.y + rect.height / 2);
+            out.complete.push_back({ rect, cv::contourArea(contour), core.contains(center),
+                                     (rect & core) != rect });
+        }
+    }
+}
+
+/**
+ * Merge the contours of all tiles into filtered rectangles
+ *
+ * A contour that lies in the overlap of two tiles is seen by both; the
+ * tile owning its center keeps it, the other copy is only used if the
+ * owner saw the contour cut. Pieces of contours cut by seams are dropped
+ * when a tile saw the whole contour, the rest are joined by intersection
+ * and filtered by their bounding box.
+ */
+static std::vector<cv::Rect> merge_tiles(const std::vector<tile_result> &tiles,
+                                         const rect_filter &filter)
+{
     std::vector<cv::Rect> rectangles;
-    int rejected_area = 0, rejected_aspect = 0, rejected_size = 0;
+    std::vector<cv::Rect> crossing;
+    std::vector<const tile_contour *> unowned;
 
-    for (const auto &contour : contours) {
-        double area = cv::contourArea(contour);
+    for (const auto &tile : tiles) {
+        for (const auto &c : tile.complete) {
+            // Only these can contain the piece of a cut contour
+            if (c.crosses)
+                crossing.push_back(c.rect);
 
-        // Filter by area
-        if (area < min_area) {
-            rejected_area++;
-            continue;
+            if (!filter.accepts(c.rect, c.area))
+                continue;
+
+            if (c.owned)
+                rectangles.push_back(c.rect);
+            else
+                unowned.push_back(&c);
         }
-        if (area > max_area) {
-            rejected_area++;
-            continue;
+    }
+
+    size_t owned_count = rectangles.size();
+    for (const tile_contour *c : unowned) {
+        bool seen = false;
+        for (const auto &rect : rectangles) {
+            if (nearly_equal(rect, c->rect)) {
+                seen = true;
+                break;
+            }
         }
 
-        // Get bounding rectangle
-        cv::Rect rect = cv::boundingRect(contour);
+        if (!seen)
+            rectangles.push_back(c->rect);
+    }
 
-        // Filter by dimensions
-        if (rect.width < min_width || rect.width > max_width ||
-            rect.height < min_height || rect.height > max_height) {
-            rejected_size++;
-            continue;
+    size_t seam_count = rectangles.size() - owned_count;
+
+    // Pieces of contours some tile saw whole
+    std::vector<cv::Rect> pieces;
+    for (const auto &tile : tiles) {
+        for (const auto &piece : tile.cut) {
+            bool whole = false;
+            for (const auto &rect : crossing) {
+                if ((piece & inflate(rect, SEAM_TOLERANCE)) == piece) {
+                    whole = true;
+                    break;
+                }
+            }
+
+            if (!whole)
+                pieces.push_back(piece);
         }
+    }
 
-        // Filter by aspect ratio
-        double aspect = (double)rect.width / rect.height;
-        if (aspect < min_aspect || aspect > max_aspect) {
-            rejected_aspect++;
+    // Join intersecting pieces until nothing changes
+    std::vector<bool> merged(pieces.size(), false);
+    for (size_t i = 0; i < pieces.size(); i++) {
+        if (merged[i])
             continue;
+
+        bool grew = true;
+        while (grew) {
+            grew = false;
+            for (size_t j = i + 1; j < pieces.size(); j++) {
+                if (!merged[j] && (pieces[i] & pieces[j]).area() > 0) {
+                    pieces[i] |= pieces[j];
+                    merged[j] = true;
+                    grew = true;
+                }
+            }
         }
 
-        rectangles.push_back(rect);
+        if (filter.accepts(pieces[i], pieces[i].area()))
+            rectangles.push_back(pieces[i]);
     }
 
+    fprintf(stderr, "OpenCV: %zu contours, %zu seen across seams, %zu joined from pieces\n",
+            owned_count, seam_count, rectangles.size() - owned_count - seam_count);
+
+    return rectangles;
+}
+
+opencv_tile_cache *opencv_tile_cache_new()
+{
+    return new opencv_tile_cache();
+}
+
+void opencv_tile_cache_free(opencv_tile_cache *cache)
+{
+    delete cache;
+}
+
+void opencv_tile_cache_invalidate(opencv_tile_cache *cache, const cv::Rect &damage)
+{
+    for (auto it = cache->tiles.begin(); it != cache->tiles.end();) {
+        if ((it->second.ext & damage).area() > 0)
+            it = cache->tiles.erase(it);
+        else
+            ++it;
+    }
+}
+
+void opencv_tile_cache_clear(opencv_tile_cache *cache)
+{
+    cache->tiles.clear();
+}
+
+/**
+ * Detect rectangular UI elements using edge detection
+ * Cross-platform detection logic - works with any cv::Mat input
+ *
+ * The image is split into tiles of opencv_tile_size pixels, on a grid
+ * anchored at the screen origin. A coarse pass over a downscaled copy
+ * of each tile skips those without any edges, the others are processed
+ * in parallel (cv::parallel_for_) and merged. Tiles found in cache are
+ * not processed again.
+ */
+std::vector<cv::Rect> detect_rectangles(const cv::Mat &img, const struct ui_cancel_token *cancel,
+                                        opencv_tile_cache *cache, cv::Point origin)
+{
+    // Read filter parameters from config
+    rect_filter filter;
+    filter.min_area = config_get_int("opencv_min_area");
+    filter.max_area = config_get_int("opencv_max_area");
+    filter.min_width = config_get_int("opencv_min_width");
+    filter.min_height = config_get_int("opencv_min_height");
+    filter.max_width = config_get_int("opencv_max_width");
+    filter.max_height = config_get_int("opencv_max_height");
+    filter.min_aspect = atof(config_get("opencv_min_aspect"));
+    filter.max_aspect = atof(config_get("opencv_max_aspect"));
+    int tile_size = config_get_int("opencv_tile_size");
+
+    fprintf(stderr, "OpenCV: Using config - area: %d-%d, size: %dx%d to %dx%d, aspect: %.2f-%.2f\n",
+            filter.min_area, filter.max_area, filter.min_width, filter.min_height,
+            filter.max_width, filter.max_height, filter.min_aspect, filter.max_aspect);
+
+    // Split into tiles (in screen coordinates)
+    cv::Rect bounds(origin.x, origin.y, img.cols, img.rows);
+    std::vector<cv::Rect> tiles;
+
+    if (tile_size <= 0) {
+        tiles.push_back(bounds);
+    } else {
+        tile_size = std::max(tile_size, 4 * TILE_MARGIN);
+
+        int x0 = origin.x - ((origin.x % tile_size) + tile_size) % tile_size;
+        int y0 = origin.y - ((origin.y % tile_size) + tile_size) % tile_size;
+
+        for (int y = y0; y < bounds.y + bounds.height; y += tile_size) {
+            for (int x = x0; x < bounds.x + bounds.width; x += tile_size) {
+                cv::Rect core = cv::Rect(x, y, tile_size, tile_size) & bounds;
+                if (core.area() > 0)
+                    tiles.push_back(core);
+            }
+        }
+    }
+
+    // Take what the cache has, the rest is detected below
+    std::vector<tile_result> results(tiles.size());
+    std::vector<int> pending;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        if (cache) {
+            cv::Rect ext = inflate(tiles[i], TILE_MARGIN) & bounds;
+            auto it = cache->tiles.find(std::make_tuple(tiles[i].x, tiles[i].y,
+                                                         tiles[i].width, tiles[i].height));
+            if (it != cache->tiles.end() && it->second.ext == ext) {
+                results[i] = it->second.result;
+                continue;
+            }
+        }
+        pending.push_back((int)i);
+    }
+
+    if (ui_cancel_requested(cancel))
+        return std::vector<cv::Rect>();
+
+    // Refine the remaining tiles in parallel
+    bool coarse = tiles.size() > 1;
+    cv::Point to_image(-origin.x, -origin.y);
+    cv::parallel_for_(cv::Range(0, (int)pending.size()), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            if (ui_cancel_requested(cancel))
+                return;
+
+            tile_result &result = results[pending[i]];
+            detect_tile(img, shifted(tiles[pending[i]], to_image), coarse, result);
+            shift_result(result, origin);
+        }
+    });
+
+    size_t refined = 0;
+    for (int i : pending) {
+        if (results[i].refined)
+            refined++;
+
+        if (cache && results[i].done) {
+            cached_tile &entry = cache->tiles[std::make_tuple(tiles[i].x, tiles[i].y,
+                                                              tiles[i].width, tiles[i].height)];
+            entry.ext = inflate(tiles[i], TILE_MARGIN) & bounds;
+            entry.result = results[i];
+        }
+    }
+
+    fprintf(stderr, "OpenCV: %zu tiles, %zu cached, %zu refined on %d threads\n", tiles.size(),
+            tiles.size() - pending.size(), refined, cv::getNumThreads());
+
+    if (ui_cancel_requested(cancel))
+        return std::vector<cv::Rect>();
+
+    // Step 5: Merge the tiles and filter rectangles
+    std::vector<cv::Rect> rectangles = merge_tiles(results, filter);
+    for (auto &rect : rectangles)
+        rect = shifted(rect, to_image);
+
     // Sort rectangles by area (largest first)
     std::sort(rectangles.begin(), rectangles.end(),
               [](const cv::Rect &a, const cv::Rect &b) {
@@ -154,6 +460,123 @@ std::vector<cv::Rect> detect_rectangles(const cv::Mat &img)
     return rectangles;
 }
 
+struct cached_result {
+    uint64_t window;
+    uint64_t hash;
+    std::vector<cv::Rect> rects;
+};
+
+// Most recently used first
+static std::list<cached_result> result_cache;
+static std::mutex result_cache_lock;
+static unsigned long result_cache_lookups, result_cache_hits;
+
+#define HASH_PRIME 0x100000001b3ULL
+
+static uint64_t hash_mix(uint64_t hash, uint64_t value)
+{
+    hash ^= value;
+    hash *= HASH_PRIME;
+    return hash ^ (hash >> 29);
+}
+
+/*
+ * Hashed into the key, so that results found with other filter or tile
+ * settings are not returned
+ */
+static uint64_t filter_signature()
+{
+    static const char *const keys[] = {
+        "opencv_min_area", "opencv_max_area", "opencv_min_width", "opencv_min_height",
+        "opencv_max_width", "opencv_max_height", "opencv_min_aspect", "opencv_max_aspect",
+        "opencv_tile_size",
+    };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (const char *key : keys) {
+        for (const char *c = config_get(key); c && *c; c++)
+            hash = hash_mix(hash, (unsigned char)*c);
+        hash = hash_mix(hash, 0);
+    }
+
+    return hash;
+}
+
+/**
+ * Hash the pixels of img eight bytes at a time
+ *
+ * Not a perceptual hash: a changed pixel is a changed image, which is
+ * what the cached rectangles depend on.
+ */
+uint64_t opencv_image_hash(const cv::Mat &img)
+{
+    uint64_t hash = hash_mix(hash_mix(0xcbf29ce484222325ULL, img.cols), img.rows);
+    size_t row_bytes = img.cols * img.elemSize();
+
+    for (int y = 0; y < img.rows; y++) {
+        const unsigned char *row = img.ptr<unsigned char>(y);
+        size_t i = 0;
+
+        for (; i + 8 <= row_bytes; i += 8) {
+            uint64_t word;
+            memcpy(&word, row + i, 8);
+            hash = hash_mix(hash, word);
+        }
+        for (; i < row_bytes; i++)
+            hash = hash_mix(hash, row[i]);
+    }
+
+    return hash;
+}
+
+bool opencv_result_cache_lookup(uint64_t window, uint64_t hash, std::vector<cv::Rect> &rects)
+{
+    if (config_get_int("opencv_result_cache_size") <= 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(result_cache_lock);
+    hash = hash_mix(hash, filter_signature());
+    result_cache_lookups++;
+
+    bool hit = false;
+    for (auto it = result_cache.begin(); it != result_cache.end(); ++it) {
+        if (it->window == window && it->hash == hash) {
+            result_cache.splice(result_cache.begin(), result_cache, it);
+            rects = result_cache.front().rects;
+            result_cache_hits++;
+            hit = true;
+            break;
+        }
+    }
+
+    fprintf(stderr, "OpenCV: Result cache %s (hit rate: %lu/%lu, %.0f%%)\n", hit ? "hit" : "miss",
+            result_cache_hits, result_cache_lookups,
+            100.0 * result_cache_hits / result_cache_lookups);
+
+    return hit;
+}
+
+void opencv_result_cache_store(uint64_t window, uint64_t hash, const std::vector<cv::Rect> &rects)
+{
+    int size = config_get_int("opencv_result_cache_size");
+    if (size <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(result_cache_lock);
+    hash = hash_mix(hash, filter_signature());
+
+    for (auto it = result_cache.begin(); it != result_cache.end(); ++it) {
+        if (it->window == window && it->hash == hash) {
+            result_cache.erase(it);
+            break;
+        }
+    }
+
+    result_cache.push_front({ window, hash, rects });
+    while (result_cache.size() > (size_t)size)
+        result_cache.pop_back();
+}
+
 /**
  * Convert rectangles to ui_element array
  * Common logic for all platforms
@@ -11,10 +11,34 @@
 #ifdef __cplusplus
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <stdint.h>
+
+struct ui_cancel_token;
+
+// Tile contours kept across runs, for platforms that know which parts of
+// the screen changed since the last run
+struct opencv_tile_cache;
+opencv_tile_cache *opencv_tile_cache_new();
+void opencv_tile_cache_free(opencv_tile_cache *cache);
+// Drop the tiles overlapping damage (in screen coordinates)
+void opencv_tile_cache_invalidate(opencv_tile_cache *cache, const cv::Rect &damage);
+void opencv_tile_cache_clear(opencv_tile_cache *cache);
 
 // Common detection functions
-std::vector<cv::Rect> detect_rectangles(const cv::Mat &img);
+// Returns no rectangles once cancel (may be NULL) is set. With a cache
+// (may be NULL), origin is the screen position of img and only the tiles
+// missing from the cache are processed.
+std::vector<cv::Rect> detect_rectangles(const cv::Mat &img, const struct ui_cancel_token *cancel,
+                                        opencv_tile_cache *cache = NULL,
+                                        cv::Point origin = cv::Point());
 std::vector<cv::Rect> deduplicate_rectangles(std::vector<cv::Rect> &rects);
+
+// Hash of the pixels (and size) of img, for opencv_result_cache_*()
+uint64_t opencv_image_hash(const cv::Mat &img);
+// Recently detected rectangles keyed by window and image hash, an LRU of
+// opencv_result_cache_size entries. lookup returns false on a miss.
+bool opencv_result_cache_lookup(uint64_t window, uint64_t hash, std::vector<cv::Rect> &rects);
+void opencv_result_cache_store(uint64_t window, uint64_t hash, const std::vector<cv::Rect> &rects);
 struct ui_detection_result *rectangles_to_ui_elements(const std::vector<cv::Rect> &rectangles, const char *detector_name);
 void opencv_free_ui_elements_common(struct ui_detection_result *result);
 
@@ -26,12 +50,12 @@ extern "C" {
 
 #ifdef HAVE_OPENCV
 // C interface functions that each platform must implement
-struct ui_detection_result *opencv_detect_ui_elements(void);
+struct ui_detection_result *opencv_detect_ui_elements(const struct ui_cancel_token *cancel);
 void opencv_free_ui_elements(struct ui_detection_result *result);
 int opencv_is_available(void);
 #else
 // Stubs for when OpenCV is disabled
-static inline struct ui_detection_result *opencv_detect_ui_elements(void) { return NULL; }
+static inline struct ui_detection_result *opencv_detect_ui_elements(const struct ui_cancel_token *cancel) { (void)cancel; return NULL; }
 static inline void opencv_free_ui_elements(struct ui_detection_result *result) { (void)result; }
 static inline int opencv_is_available(void) { return 0; }
 #endif
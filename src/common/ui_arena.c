@@ -0,0 +1,228 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Detection session arena
+ *
+ * Memory comes from a chain of blocks that only grows; the arena header
+ * and the intern table live in the blocks too, so destroying the arena
+ * is one free() per block (usually exactly one).
+ */
+
+#include "ui_arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK 4096
+#define ARENA_INITIAL_TABLE 64
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	unsigned char data[];
+};
+
+struct ui_arena {
+	struct arena_block *blocks; /* Newest first */
+	char **table;               /* Interned strings, open addressing */
+	size_t table_size;          /* Power of two */
+	struct ui_arena_stats stats;
+};
+
+static size_t align_up(size_t n)
+{
+	return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static struct arena_block *block_new(size_t size)
+{
+	/* Room for aligning the first allocation */
+	struct arena_block *block = malloc(sizeof(struct arena_block) + size + ARENA_ALIGN);
+	if (!block) {
+		return NULL;
+	}
+
+	block->next = NULL;
+	block->size = size + ARENA_ALIGN;
+	block->used = 0;
+	return block;
+}
+
+static void *block_alloc(struct arena_block *block, size_t size)
+{
+	uintptr_t base = (uintptr_t)block->data;
+	uintptr_t start = (base + block->used + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+	size_t offset = start - base;
+
+	if (offset + size > block->size) {
+		return NULL;
+	}
+
+	block->used = offset + size;
+	return block->data + offset;
+}
+
+struct ui_arena *ui_arena_create(size_t size_hint)
+{
+	size_t size = align_up(sizeof(struct ui_arena)) +
+	              align_up(ARENA_INITIAL_TABLE * sizeof(char *)) + size_hint;
+	if (size < ARENA_MIN_BLOCK) {
+		size = ARENA_MIN_BLOCK;
+	}
+
+	struct arena_block *block = block_new(size);
+	if (!block) {
+		return NULL;
+	}
+
+	struct ui_arena *arena = block_alloc(block, sizeof(struct ui_arena));
+	if (!arena) {
+		free(block);
+		return NULL;
+	}
+
+	memset(arena, 0, sizeof(*arena));
+	arena->blocks = block;
+	arena->stats.blocks = 1;
+
+	arena->table = ui_arena_alloc(arena, ARENA_INITIAL_TABLE * sizeof(char *));
+	if (!arena->table) {
+		ui_arena_destroy(arena);
+		return NULL;
+	}
+	arena->table_size = ARENA_INITIAL_TABLE;
+
+	return arena;
+}
+
+void *ui_arena_alloc(struct ui_arena *arena, size_t size)
+{
+	if (!arena) {
+		return NULL;
+	}
+
+	void *ptr = block_alloc(arena->blocks, size);
+	if (!ptr) {
+		size_t block_size = size > ARENA_MIN_BLOCK ? size : ARENA_MIN_BLOCK;
+		struct arena_block *block = block_new(block_size);
+		if (!block) {
+			return NULL;
+		}
+
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->stats.blocks++;
+
+		ptr = block_alloc(block, size);
+	}
+
+	memset(ptr, 0, size);
+	arena->stats.bytes += size;
+	return ptr;
+}
+
+/* FNV-1a */
+static size_t hash_string(const char *str)
+{
+	size_t hash = 2166136261u;
+
+	for (; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static char **table_slot(char **table, size_t size, const char *str)
+{
+	size_t i = hash_string(str) & (size - 1);
+
+	while (table[i] && strcmp(table[i], str) != 0) {
+		i = (i + 1) & (size - 1);
+	}
+
+	return &table[i];
+}
+
+/**
+ * Double the intern table (the old one stays in the arena, unused)
+ */
+static int grow_table(struct ui_arena *arena)
+{
+	size_t size = arena->table_size * 2;
+	char **table = ui_arena_alloc(arena, size * sizeof(char *));
+	if (!table) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < arena->table_size; i++) {
+		if (arena->table[i]) {
+			*table_slot(table, size, arena->table[i]) = arena->table[i];
+		}
+	}
+
+	arena->table = table;
+	arena->table_size = size;
+	return 1;
+}
+
+char *ui_arena_intern(struct ui_arena *arena, const char *str)
+{
+	if (!arena || !str || !arena->table) {
+		return NULL;
+	}
+
+	arena->stats.strings++;
+
+	char **slot = table_slot(arena->table, arena->table_size, str);
+	if (*slot) {
+		return *slot;
+	}
+
+	/* Keep the load factor at or below one half */
+	if ((arena->stats.unique_strings + 1) * 2 > arena->table_size) {
+		if (!grow_table(arena)) {
+			return NULL;
+		}
+		slot = table_slot(arena->table, arena->table_size, str);
+	}
+
+	size_t len = strlen(str) + 1;
+	char *copy = ui_arena_alloc(arena, len);
+	if (!copy) {
+		return NULL;
+	}
+
+	memcpy(copy, str, len);
+	*slot = copy;
+	arena->stats.unique_strings++;
+
+	return copy;
+}
+
+void ui_arena_get_stats(struct ui_arena *arena, struct ui_arena_stats *stats)
+{
+	if (!arena || !stats) {
+		return;
+	}
+
+	*stats = arena->stats;
+}
+
+void ui_arena_destroy(struct ui_arena *arena)
+{
+	if (!arena) {
+		return;
+	}
+
+	/* The header lives in the oldest block, which is freed last */
+	struct arena_block *block = arena->blocks;
+	while (block) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+}
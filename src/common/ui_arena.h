@@ -0,0 +1,59 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Detection session arena
+ *
+ * Bump allocator with an interned-string table. A detection result
+ * allocated from an arena (elements, names, roles and the result itself)
+ * is released with a single ui_arena_destroy() instead of one free() per
+ * string.
+ */
+
+#ifndef UI_ARENA_H
+#define UI_ARENA_H
+
+#include <stddef.h>
+
+struct ui_arena;
+
+/* Allocation statistics (reported in debug output) */
+struct ui_arena_stats {
+	size_t blocks;            /* malloc() calls made by the arena */
+	size_t bytes;             /* Bytes handed out */
+	size_t strings;           /* ui_arena_intern() calls */
+	size_t unique_strings;    /* Strings actually stored */
+};
+
+/**
+ * Create an arena
+ *
+ * @param size_hint Expected number of bytes; sizing it right keeps the
+ *                  whole session in one block
+ * @return New arena, or NULL on allocation failure
+ */
+struct ui_arena *ui_arena_create(size_t size_hint);
+
+/**
+ * Allocate zeroed memory from the arena (suitably aligned for any type)
+ *
+ * @return Pointer valid until the arena is destroyed, or NULL on failure
+ */
+void *ui_arena_alloc(struct ui_arena *arena, size_t size);
+
+/**
+ * Return the arena's copy of a string, storing it on first use
+ *
+ * Equal strings share one copy, so the result must not be modified.
+ *
+ * @return Interned string, or NULL if str is NULL or allocation failed
+ */
+char *ui_arena_intern(struct ui_arena *arena, const char *str);
+
+void ui_arena_get_stats(struct ui_arena *arena, struct ui_arena_stats *stats);
+
+/**
+ * Free the arena and everything allocated from it
+ */
+void ui_arena_destroy(struct ui_arena *arena);
+
+#endif /* UI_ARENA_H */
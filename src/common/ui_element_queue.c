@@ -0,0 +1,97 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Lock-free queue of UI element batches
+ *
+ * A ring buffer indexed by two free-running counters. The producer only
+ * writes tail and the consumer only writes head, so publishing a slot with
+ * a release store of tail (and freeing one with a release store of head)
+ * is all the synchronization needed.
+ */
+
+#include "ui_element_queue.h"
+#include <stdlib.h>
+
+struct ui_element_queue {
+	struct ui_element_batch slots[UI_ELEMENT_QUEUE_CAPACITY];
+	size_t head; /* Next slot to consume, written by the consumer */
+	size_t tail; /* Next slot to fill, written by the producer */
+};
+
+struct ui_element_queue *ui_element_queue_create(void)
+{
+	return calloc(1, sizeof(struct ui_element_queue));
+}
+
+int ui_element_queue_push(struct ui_element_queue *queue,
+                          struct ui_element *elements, size_t count)
+{
+	if (!queue) {
+		return 0;
+	}
+
+	size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head >= UI_ELEMENT_QUEUE_CAPACITY) {
+		return 0;
+	}
+
+	struct ui_element_batch *slot = &queue->slots[tail % UI_ELEMENT_QUEUE_CAPACITY];
+	slot->elements = elements;
+	slot->count = count;
+
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int ui_element_queue_pop(struct ui_element_queue *queue,
+                         struct ui_element_batch *batch)
+{
+	if (!queue) {
+		return 0;
+	}
+
+	size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+		return 0;
+	}
+
+	*batch = queue->slots[head % UI_ELEMENT_QUEUE_CAPACITY];
+
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void ui_element_batch_free(struct ui_element_batch *batch)
+{
+	if (!batch || !batch->elements) {
+		return;
+	}
+
+	for (size_t i = 0; i < batch->count; i++) {
+		free(batch->elements[i].name);
+		free(batch->elements[i].role);
+	}
+	free(batch->elements);
+
+	batch->elements = NULL;
+	batch->count = 0;
+}
+
+void ui_element_queue_destroy(struct ui_element_queue *queue)
+{
+	struct ui_element_batch batch;
+
+	if (!queue) {
+		return;
+	}
+
+	while (ui_element_queue_pop(queue, &batch)) {
+		ui_element_batch_free(&batch);
+	}
+
+	free(queue);
+}
@@ -0,0 +1,63 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Lock-free queue of UI element batches
+ *
+ * Single producer (the detector thread) and single consumer (the UI
+ * thread). Used to stream elements to smart hint mode while detection is
+ * still running.
+ */
+
+#ifndef UI_ELEMENT_QUEUE_H
+#define UI_ELEMENT_QUEUE_H
+
+#include "../platform.h"
+
+/* Maximum number of batches waiting to be consumed */
+#define UI_ELEMENT_QUEUE_CAPACITY 128
+
+struct ui_element_batch {
+	struct ui_element *elements; /* Owned by whoever holds the batch */
+	size_t count;
+};
+
+/**
+ * Create an empty queue
+ *
+ * @return New queue, or NULL on allocation failure
+ */
+struct ui_element_queue *ui_element_queue_create(void);
+
+/**
+ * Publish a batch of elements (producer side)
+ *
+ * On success the queue takes ownership of the elements array and the
+ * strings it points to.
+ *
+ * @return 1 on success, 0 if the queue is full
+ */
+int ui_element_queue_push(struct ui_element_queue *queue,
+                          struct ui_element *elements, size_t count);
+
+/**
+ * Take the oldest batch (consumer side)
+ *
+ * @return 1 if a batch was taken (free it with ui_element_batch_free),
+ *         0 if the queue is empty
+ */
+int ui_element_queue_pop(struct ui_element_queue *queue,
+                         struct ui_element_batch *batch);
+
+/**
+ * Free the elements of a batch taken from the queue
+ */
+void ui_element_batch_free(struct ui_element_batch *batch);
+
+/**
+ * Destroy the queue and any batches still in it
+ *
+ * The producer must have stopped using the queue.
+ */
+void ui_element_queue_destroy(struct ui_element_queue *queue);
+
+#endif /* UI_ELEMENT_QUEUE_H */
@@ -6,6 +6,8 @@
 
 #include "../platform.h"
 #include "image_loader.h"
+#include "ui_arena.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -143,6 +145,186 @@ static double calculate_overlap_ratio(struct ui_element *a, struct ui_element *b
     return (double)overlap_area / smaller_area;
 }
 
+/* Overlap removal thresholds */
+struct overlap_params {
+    int distance_threshold;
+    double area_threshold;
+    int hint_w;
+    int hint_h;
+};
+
+/**
+ * Resolve one pair of elements (i < j) whose hints may collide
+ *
+ * If the hints are too close or overlap too much, the element with the
+ * smaller area is marked for removal.
+ */
+static void resolve_pair(struct ui_detection_result *result, char *keep,
+                         size_t i, size_t j, const struct overlap_params *params)
+{
+    struct ui_element *elem_i = &result->elements[i];
+    struct ui_element *elem_j = &result->elements[j];
+
+    /* Calculate hint positions (top-left corner of element) */
+    int hint_i_x = elem_i->x;
+    int hint_i_y = elem_i->y;
+    int hint_j_x = elem_j->x;
+    int hint_j_y = elem_j->y;
+
+    /* Check distance between hint positions */
+    double distance = calculate_distance(hint_i_x, hint_i_y, hint_j_x, hint_j_y);
+    int collide = distance < params->distance_threshold;
+
+    if (!collide) {
+        /* Check hint overlap areas */
+        struct ui_element hint_i = { .x = hint_i_x, .y = hint_i_y,
+                                     .w = params->hint_w, .h = params->hint_h };
+        struct ui_element hint_j = { .x = hint_j_x, .y = hint_j_y,
+                                     .w = params->hint_w, .h = params->hint_h };
+
+        collide = calculate_overlap_ratio(&hint_i, &hint_j) > params->area_threshold;
+    }
+
+    if (collide) {
+        /* Hints are too close or overlap significantly, remove one */
+        int area_i = elem_i->w * elem_i->h;
+        int area_j = elem_j->w * elem_j->h;
+
+        if (area_i < area_j) {
+            keep[i] = 0;
+        } else {
+            keep[j] = 0;
+        }
+    }
+}
+
+/**
+ * Check each pair of elements for hint overlap
+ */
+static void mark_overlaps_pairwise(struct ui_detection_result *result, char *keep,
+                                   const struct overlap_params *params)
+{
+    for (size_t i = 0; i < result->count; i++) {
+        if (!keep[i]) continue;
+
+        for (size_t j = i + 1; j < result->count; j++) {
+            if (!keep[j]) continue;
+
+            resolve_pair(result, keep, i, j, params);
+        }
+    }
+}
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (a % b != 0 && a < 0) ? q - 1 : q;
+}
+
+static uint64_t cell_key(int64_t cx, int64_t cy)
+{
+    return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+}
+
+static size_t cell_hash(uint64_t key, size_t mask)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key & mask;
+}
+
+/**
+ * Check only the pairs that can collide, found through a uniform grid
+ *
+ * Two hints can only collide if their positions are less than a cell
+ * apart on both axes, so each element is compared with the elements of
+ * its own and the eight neighbouring cells. Within the pass for element i
+ * the order of the j's does not matter (each step only changes keep[i],
+ * which the pass no longer reads, or keep[j]), so the outcome is exactly
+ * that of mark_overlaps_pairwise().
+ *
+ * Returns 0 if the grid could not be built.
+ */
+static int mark_overlaps_grid(struct ui_detection_result *result, char *keep,
+                              const struct overlap_params *params)
+{
+    size_t n = result->count;
+    int64_t cell_w = params->distance_threshold > params->hint_w ?
+                     params->distance_threshold : params->hint_w;
+    int64_t cell_h = params->distance_threshold > params->hint_h ?
+                     params->distance_threshold : params->hint_h;
+
+    if (cell_w <= 0 || cell_h <= 0) {
+        return 0;
+    }
+
+    size_t table_size = 16;
+    while (table_size < n * 2) {
+        table_size *= 2;
+    }
+
+    /* Cells by open addressing; each holds a chain of elements via next[] */
+    uint64_t *keys = malloc(table_size * sizeof(*keys));
+    size_t *heads = malloc(table_size * sizeof(*heads));
+    size_t *next = malloc(n * sizeof(*next));
+    if (!keys || !heads || !next) {
+        free(keys);
+        free(heads);
+        free(next);
+        return 0;
+    }
+
+    const size_t empty = (size_t)-1;
+    for (size_t k = 0; k < table_size; k++) {
+        heads[k] = empty;
+    }
+
+    /* Insert in descending order so every chain is in ascending order */
+    for (size_t i = n; i-- > 0;) {
+        uint64_t key = cell_key(floor_div(result->elements[i].x, cell_w),
+                                floor_div(result->elements[i].y, cell_h));
+        size_t slot = cell_hash(key, table_size - 1);
+
+        while (heads[slot] != empty && keys[slot] != key) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        keys[slot] = key;
+        next[i] = heads[slot];
+        heads[slot] = i;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!keep[i]) continue;
+
+        int64_t cx = floor_div(result->elements[i].x, cell_w);
+        int64_t cy = floor_div(result->elements[i].y, cell_h);
+
+        for (int64_t dy = -1; dy <= 1; dy++) {
+            for (int64_t dx = -1; dx <= 1; dx++) {
+                uint64_t key = cell_key(cx + dx, cy + dy);
+                size_t slot = cell_hash(key, table_size - 1);
+
+                while (heads[slot] != empty && keys[slot] != key) {
+                    slot = (slot + 1) & (table_size - 1);
+                }
+
+                for (size_t j = heads[slot]; j != empty; j = next[j]) {
+                    if (j <= i || !keep[j]) continue;
+
+                    resolve_pair(result, keep, i, j, params);
+                }
+            }
+        }
+    }
+
+    free(keys);
+    free(heads);
+    free(next);
+    return 1;
+}
+
 /**
  * Remove overlapping UI elements based on configurable thresholds
  * This function modifies the result in-place, removing overlapping elements
@@ -154,26 +336,26 @@ void remove_overlapping_elements(struct ui_detection_result *result)
         return;
     }
 
-    /* Get configuration values */
-    int distance_threshold = 30;  /* Default */
-    double area_threshold = 0.7;  /* Default */
+    struct overlap_params params;
 
-    distance_threshold = config_get_int("ui_overlap_threshold");
+    /* Get configuration values */
+    params.distance_threshold = config_get_int("ui_overlap_threshold");
+    params.area_threshold = 0.7;  /* Default */
 
     const char *area_str = config_get("ui_overlap_area_threshold");
     if (area_str) {
-        area_threshold = atof(area_str);
+        params.area_threshold = atof(area_str);
     }
 
     /* Get hint size for overlap detection */
-    int hint_w = 20;  /* Default hint size */
-    int hint_h = 20;  /* Default hint size */
+    params.hint_w = 20;  /* Default hint size */
+    params.hint_h = 20;  /* Default hint size */
 
     /* Try to get actual hint size from config */
     int hint_size = config_get_int("hint_size");
     if (hint_size > 0) {
-        hint_w = hint_size;
-        hint_h = hint_size;
+        params.hint_w = hint_size;
+        params.hint_h = hint_size;
     }
 
     /* Mark elements for removal */
@@ -187,57 +369,15 @@ void remove_overlapping_elements(struct ui_detection_result *result)
         keep[i] = 1;
     }
 
-    /* Check each pair of elements for hint overlap */
-    for (size_t i = 0; i < result->count; i++) {
-        if (!keep[i]) continue;
-
-        for (size_t j = i + 1; j < result->count; j++) {
-            if (!keep[j]) continue;
-
-            struct ui_element *elem_i = &result->elements[i];
-            struct ui_element *elem_j = &result->elements[j];
-
-            /* Calculate hint positions (top-left corner of element) */
-            int hint_i_x = elem_i->x;
-            int hint_i_y = elem_i->y;
-            int hint_j_x = elem_j->x;
-            int hint_j_y = elem_j->y;
-
-            /* Check distance between hint positions */
-            double distance = calculate_distance(hint_i_x, hint_i_y, hint_j_x, hint_j_y);
-
-            if (distance < distance_threshold) {
-                /* Hints are too close, remove one */
-                int area_i = elem_i->w * elem_i->h;
-                int area_j = elem_j->w * elem_j->h;
-
-                if (area_i < area_j) {
-                    keep[i] = 0;
-                } else {
-                    keep[j] = 0;
-                }
-            } else {
-                /* Check hint overlap areas */
-                struct ui_element hint_i = {hint_i_x, hint_i_y, hint_w, hint_h, NULL, NULL};
-                struct ui_element hint_j = {hint_j_x, hint_j_y, hint_w, hint_h, NULL, NULL};
-
-                double overlap = calculate_overlap_ratio(&hint_i, &hint_j);
-
-                if (overlap > area_threshold) {
-                    /* Hints overlap significantly, remove one */
-                    int area_i = elem_i->w * elem_i->h;
-                    int area_j = elem_j->w * elem_j->h;
-
-                    if (area_i < area_j) {
-                        keep[i] = 0;
-                    } else {
-                        keep[j] = 0;
-                    }
-                }
-            }
-        }
+    /*
+     * A negative area threshold makes every pair collide, only the
+     * pairwise pass handles that.
+     */
+    if (!(params.area_threshold >= 0.0) ||
+        !mark_overlaps_grid(result, keep, &params)) {
+        mark_overlaps_pairwise(result, keep, &params);
     }
-    
+
     /* Count remaining elements */
     size_t new_count = 0;
     for (size_t i = 0; i < result->count; i++) {
@@ -246,31 +386,73 @@ void remove_overlapping_elements(struct ui_detection_result *result)
         }
     }
     
-    /* Create new array with only kept elements */
+    /* Compact the array in place, keeping only kept elements */
     if (new_count < result->count) {
-        struct ui_element *new_elements = calloc(new_count, sizeof(struct ui_element));
-        if (new_elements) {
-            size_t new_index = 0;
-            for (size_t i = 0; i < result->count; i++) {
-                if (keep[i]) {
-                    new_elements[new_index] = result->elements[i];
-                    new_index++;
-                } else {
-                    /* Free memory for removed elements */
-                    if (result->elements[i].name) {
-                        free(result->elements[i].name);
-                    }
-                    if (result->elements[i].role) {
-                        free(result->elements[i].role);
-                    }
+        size_t new_index = 0;
+        for (size_t i = 0; i < result->count; i++) {
+            if (keep[i]) {
+                result->elements[new_index] = result->elements[i];
+                new_index++;
+            } else if (!result->shared_strings) {
+                /* Free memory for removed elements */
+                if (result->elements[i].name) {
+                    free(result->elements[i].name);
+                }
+                if (result->elements[i].role) {
+                    free(result->elements[i].role);
                 }
             }
-            
-            free(result->elements);
-            result->elements = new_elements;
-            result->count = new_count;
         }
+
+        result->count = new_count;
     }
     
     free(keep);
-}
\ No newline at end of file
+}
+
+/**
+ * Check whether a detection was asked to stop (cancel may be NULL)
+ */
+int ui_cancel_requested(const struct ui_cancel_token *cancel)
+{
+    return cancel && cancel->cancelled;
+}
+
+/**
+ * Create the error result returned by a cancelled detection
+ */
+struct ui_detection_result *ui_cancelled_result(void)
+{
+    struct ui_detection_result *result = calloc(1, sizeof(*result));
+    if (result) {
+        result->error = UI_DETECTION_CANCELLED;
+        snprintf(result->error_msg, sizeof(result->error_msg), "Detection cancelled");
+    }
+    return result;
+}
+
+/**
+ * Free a detection result, whether it is arena-backed or not
+ */
+void free_detection_result(struct ui_detection_result *result)
+{
+    if (!result) {
+        return;
+    }
+
+    if (result->arena) {
+        /* The result itself lives in the arena */
+        ui_arena_destroy(result->arena);
+        return;
+    }
+
+    if (result->elements) {
+        for (size_t i = 0; i < result->count && !result->shared_strings; i++) {
+            free(result->elements[i].name);
+            free(result->elements[i].role);
+        }
+        free(result->elements);
+    }
+
+    free(result);
+}
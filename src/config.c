@@ -6,6 +6,7 @@
 #include <stdlib.h>
 
 struct config_entry *config = NULL;
+static unsigned int generation = 0;
 
 static struct {
 	char *key;
@@ -17,6 +18,11 @@ static struct {
 	{ "hint_activation_key", "A-M-x", "Activates hint mode.", OPT_KEY },
 	{ "hint2_activation_key", "A-M-X", "Activate two pass hint mode.", OPT_KEY },
 	{ "smart_hint_activation_key", "A-M-f", "Activate smart hint mode (element-based detection).", OPT_KEY },
+	{ "smart_hint_predetect", "0", "Detect UI elements in the background whenever the focused window changes, so smart hint mode can start without waiting (daemon mode, X11 only).", OPT_INT },
+	{ "smart_hint_predetect_max_age", "10000", "Maximum age in milliseconds of a pre-detected result before smart hint mode detects again.", OPT_INT },
+	{ "smart_hint_streaming", "0", "Draw hints while detection is still running. Labels keep a fixed width (sized for ui_max_elements) so they never change once shown.", OPT_INT },
+	{ "smart_hint_scope", "window", "What smart hint mode detects: 'window' (the active window) or 'desktop' (every visible window on the current monitor, Linux AT-SPI only).", OPT_STRING },
+	{ "smart_hint_lazy_names", "1", "Draw hints before element names are known and look the names up while the hints are shown; text filtering waits for them (Linux AT-SPI).", OPT_INT },
 	{ "smart_hint_mode", "numeric", "Smart hint label mode: 'numeric' (Vimium-style with fuzzy text filter) or 'alphabet' (classic label matching).", OPT_STRING },
 	{ "grid_activation_key", "A-M-g", "Activates grid mode and allows for further manipulation of the pointer using the mapped keys.", OPT_KEY },
 	{ "history_activation_key", "A-M-h", "Activate history mode.", OPT_KEY },
@@ -114,6 +120,10 @@ static struct {
 	{ "opencv_max_height", "300", "Maximum element height in pixels (OpenCV).", OPT_INT },
 	{ "opencv_min_aspect", "0.15", "Minimum aspect ratio (width/height, OpenCV).", OPT_STRING },
 	{ "opencv_max_aspect", "15.0", "Maximum aspect ratio (width/height, OpenCV).", OPT_STRING },
+	{ "opencv_tile_size", "512", "Size in pixels of the tiles the screenshot is split into and processed on all cores (OpenCV, 0 = one pass over the whole image).", OPT_INT },
+	{ "opencv_active_window_only", "1", "Only capture and search the focused window, clipped to the screen the pointer is on (OpenCV, X only).", OPT_INT },
+	{ "opencv_incremental", "1", "Keep a copy of the screen up to date from XDamage and only search the parts that changed since the last detection (OpenCV, X only).", OPT_INT },
+	{ "opencv_result_cache_size", "16", "Number of recent OpenCV results kept per window and screen contents, reused when a window is shown again unchanged (0 = disable).", OPT_INT },
 
 	/* UI element detection parameters (shared across all detectors) */
 	{ "ui_max_depth", "25", "Maximum UI tree traversal depth.", OPT_INT },
@@ -123,6 +133,16 @@ static struct {
 	{ "ui_min_area", "100", "Minimum element area in pixels.", OPT_INT },
 	{ "ui_min_visible_area", "100", "Minimum visible area in pixels for clipped elements.", OPT_INT },
 	{ "ui_detection_timeout", "5000", "Maximum time in milliseconds for UI detection (stops traversal early).", OPT_INT },
+	{ "ui_atspi_call_timeout", "1000", "Maximum time in milliseconds for a single AT-SPI call (Linux).", OPT_INT },
+	{ "ui_atspi_direct", "1", "Query applications over their private AT-SPI connection instead of through the accessibility bus daemon when they offer one (Linux).", OPT_INT },
+	{ "ui_atspi_pipeline_depth", "32", "Maximum number of AT-SPI calls in flight at once when fetching element extents (0 = one call at a time, Linux).", OPT_INT },
+	{ "ui_atspi_skip_barren", "1", "Skip subtrees that yielded no hints on several earlier traversals of the same application, walking them again every few traversals (Linux).", OPT_INT },
+	{ "ui_atspi_dump_tree", "", "Write the AT-SPI tree of the active window to this file on each detection, in the format bench/walk_recall.c replays (empty = off, Linux).", OPT_STRING },
+	{ "ui_detector_helper", "1", "Run AT-SPI detection in a separate warpd-detectd process, which is restarted when it hangs or crashes instead of taking the daemon down with it (Linux).", OPT_INT },
+	{ "ui_detector_policy", "sequential", "How detection strategies are combined: sequential (try each in turn), race (run all at once, the first good result wins and the rest are cancelled) or race-then-merge (run all at once and merge their results).", OPT_STRING },
+	{ "ui_strategy_budget", "0", "Time budget in milliseconds of each strategy when they run concurrently, a strategy over budget is cancelled (0 = ui_detection_timeout).", OPT_INT },
+	{ "ui_detector_profiles", "1", "Learn from past detections in each application which strategy to try first and how far to raise ui_max_depth and ui_max_elements for it (see --detector-stats).", OPT_INT },
+	{ "ui_atspi_cache_ttl", "60000", "Maximum age in milliseconds of the cached AT-SPI elements of a window, kept up to date by AT-SPI events (0 = disable the cache, Linux).", OPT_INT },
 
 	/* UI element overlap removal */
 	{ "ui_overlap_threshold", "10", "Minimum distance in pixels between UI elements to avoid overlap.", OPT_INT },
@@ -250,12 +270,14 @@ static void config_add(const char *key, const char *val)
 	config = ent;
 }
 
-void parse_config(const char *path)
+/*
+ * Same as parse_config(), reading from fh (closed afterwards, NULL for
+ * the defaults only)
+ */
+void parse_config_stream(FILE *fh)
 {
 	size_t i;
 
-	FILE *fh = (path[0] == '-' && path[1] == 0) ? stdin : fopen(path, "r");
-
 	struct config_entry *ent = config;
 	while (ent) {
 		struct config_entry *tmp = ent;
@@ -295,6 +317,28 @@ void parse_config(const char *path)
 
 		fclose(fh);
 	}
+
+	generation++;
+}
+
+void parse_config(const char *path)
+{
+	parse_config_stream((path[0] == '-' && path[1] == 0) ? stdin : fopen(path, "r"));
+}
+
+/* Write the value in effect of every option, in config file syntax */
+void config_write(FILE *fh)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+		fprintf(fh, "%s: %s\n", options[i].key, config_get(options[i].key));
+}
+
+/* Changes each time the config is parsed */
+unsigned int config_generation(void)
+{
+	return generation;
 }
 
 static int keyidx(const char *key_list, struct input_event *ev, int *exact)
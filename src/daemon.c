@@ -1,4 +1,7 @@
 #include "warpd.h"
+#include "common/detector_profile.h"
+#include "smart_hint/predetector.h"
+
 static const char *activation_keys[] = {
 	"activation_key",
 	"hint_activation_key",
@@ -17,6 +20,8 @@ static void reload_config(const char *path)
 {
 	int i;
 
+	/* The pre-detector reads the config while it detects */
+	predetector_stop();
 	parse_config(path);
 
 	init_hints();
@@ -25,6 +30,10 @@ static void reload_config(const char *path)
 	for (i = 0; i < sizeof activation_keys / sizeof activation_keys[0]; i++)
 		input_parse_string(&activation_events[i], config_get(activation_keys[i]));
 
+	if (config_get_int("smart_hint_predetect"))
+		predetector_start(config_get_int("smart_hint_predetect_max_age"));
+	else
+		predetector_stop();
 }
 
 void daemon_loop(const char *config_path)
@@ -74,6 +83,9 @@ void daemon_loop(const char *config_path)
 		}
 
 		mode_loop(mode, 0, 1);
+
+		/* Learned while the mode ran, written back now that nobody waits */
+		detector_profile_save();
 	}
 }
 
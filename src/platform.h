@@ -51,22 +51,69 @@ struct ui_element {
 	int h;           /* Height of element */
 	char *name;      /* Element name/label (may be NULL) */
 	char *role;      /* Element role/type (may be NULL) */
+	const void *source; /* Detector object of an element whose name is deferred (may be NULL) */
 };
 
+/* Top-level window, in root window coordinates */
+struct window_frame {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
+/* Forward declarations */
+struct screen;
+struct ui_element_queue;
+struct ui_arena;
+
 /* Result of UI element detection */
 struct ui_detection_result {
 	struct ui_element *elements;
 	size_t count;
+	int partial;             /* 1 if detection stopped at the time budget */
+	int max_depth_reached;   /* Deepest tree level visited (0 = unknown) */
 	int error;               /* 0 = success, negative = error */
 	char error_msg[256];     /* Human-readable error message */
+
+	/*
+	 * If set, the result itself, elements and their (interned, shared)
+	 * strings all live in this arena and are released together by
+	 * free_detection_result(). Otherwise every piece is malloc'ed.
+	 */
+	struct ui_arena *arena;
+
+	/*
+	 * Set if name and role are not individually malloc'ed (arena or
+	 * helper segment strings), they must never be passed to free().
+	 */
+	int shared_strings;
+
+	/*
+	 * Detector state for resolve_ui_element_names(), NULL once every name
+	 * is known. Released by free_ui_elements.
+	 */
+	void *deferred_names;
 };
 
-/* Forward declarations */
-struct screen;
+/*
+ * Cancellation token of a running detection. Set cancelled from any
+ * thread; detectors check it between units of work and return early
+ * with UI_DETECTION_CANCELLED.
+ */
+struct ui_cancel_token {
+	volatile int cancelled;
+};
+
+#define UI_DETECTION_CANCELLED -100
+
 typedef struct screen *screen_t;
 
 /* Common UI utility functions */
 void remove_overlapping_elements(struct ui_detection_result *result);
+void free_detection_result(struct ui_detection_result *result);
+int ui_cancel_requested(const struct ui_cancel_token *cancel);
+struct ui_detection_result *ui_cancelled_result(void);
 void show_message(screen_t scr, const char *message, int hint_h);
 void draw_loading_cursor(screen_t scr, int x, int y);
 void draw_target_cursor(screen_t scr, int x, int y);
@@ -130,10 +177,29 @@ struct platform {
 	 *   - macOS: Accessibility API
 	 *   - Windows: UI Automation
 	 *
+	 * cancel (may be NULL) stops the detection early when set.
+	 *
 	 * Returns: ui_detection_result with elements array (must be freed with free_ui_elements)
 	 *          NULL if detection not supported on this platform
 	 */
-	struct ui_detection_result *(*detect_ui_elements)();
+	struct ui_detection_result *(*detect_ui_elements)(const struct ui_cancel_token *cancel);
+
+	/*
+	 * Same as detect_ui_elements, but also publishes elements to queue in
+	 * batches as they are found (optional, may be NULL). The returned
+	 * result is still complete.
+	 */
+	struct ui_detection_result *(*detect_ui_elements_streaming)(struct ui_element_queue *queue,
+								    const struct ui_cancel_token *cancel);
+
+	/*
+	 * Fill in the element names a detection deferred (optional, may be
+	 * NULL). Detectors may leave names out so hints are drawn sooner, and
+	 * set result->deferred_names if they did. Called from a background
+	 * thread while the hints are shown; returns the number of names found.
+	 */
+	int (*resolve_ui_element_names)(struct ui_detection_result *result,
+					const struct ui_cancel_token *cancel);
 	
 	/*
 	 * Insert text mode - shows dialog, allows editing, and pastes result
@@ -155,6 +221,42 @@ struct platform {
 	 */
 	void (*free_ui_elements)(struct ui_detection_result *result);
 
+	/*
+	 * Active window tracking for speculative detection (optional, may be NULL)
+	 *
+	 * active_window_id returns an opaque identifier of the focused window
+	 * (0 if unknown). wait_active_window_change blocks for up to timeout
+	 * milliseconds and returns 1 if the focused window changed.
+	 *
+	 * Both are called from a background thread.
+	 */
+	uint64_t (*active_window_id)();
+	int (*wait_active_window_change)(int timeout);
+
+	/*
+	 * Copy the class (e.g. WM_CLASS) of the focused window to buf,
+	 * returns 0 if unknown (optional, may be NULL). Detection profiles
+	 * are kept per window class.
+	 */
+	int (*active_window_class)(char *buf, size_t size);
+
+	/*
+	 * Get the focused window clipped to the screen the pointer is on, in
+	 * root window coordinates. Returns 0 if unknown (optional, may be
+	 * NULL). Called from a background thread; image based detection is
+	 * limited to this area.
+	 */
+	int (*active_window_region)(int *x, int *y, int *w, int *h);
+
+	/*
+	 * Fill frames with the mapped top-level windows from the bottom of
+	 * the stacking order to the top, keeping the topmost max. Returns the
+	 * number filled in, 0 if unknown (optional, may be NULL). Called from
+	 * a background thread; desktop-wide detection drops elements covered
+	 * by windows stacked above their own.
+	 */
+	size_t (*window_stacking)(struct window_frame *frames, size_t max);
+
 	/*
 	* Draw operations may (or may not) be queued until this function
 	* is called.
@@ -163,4 +265,11 @@ struct platform {
 };
 
 void platform_run(int (*main) (struct platform *platform));
+
+/*
+ * Serve detections to the daemon as a separate process, without setting
+ * up the platform. Runs when warpd is started with --detectd, until the
+ * daemon goes away; returns the exit status.
+ */
+int platform_run_detector_helper(void);
 #endif
@@ -9,8 +9,12 @@
 Display *dpy = NULL;
 
 /* UI element detector functions (implemented in ui_detector.c) */
-extern struct ui_detection_result *linux_detect_ui_elements(void);
+extern struct ui_detection_result *linux_detect_ui_elements(const struct ui_cancel_token *cancel);
+extern struct ui_detection_result *linux_detect_ui_elements_streaming(struct ui_element_queue *queue,
+								      const struct ui_cancel_token *cancel);
 extern void linux_free_ui_elements(struct ui_detection_result *result);
+extern int linux_resolve_ui_element_names(struct ui_detection_result *result,
+					  const struct ui_cancel_token *cancel);
 
 /* AT-SPI cleanup function */
 extern void atspi_cleanup(void);
@@ -261,12 +265,21 @@ void x_monitor_file(const char *path)
 
 void x_init(struct platform *platform)
 {
+	/* Detection may run on a background thread (e.g. OpenCV screen capture) */
+	XInitThreads();
+
 	dpy = XOpenDisplay(NULL);
 	if (!dpy) {
 		fprintf(stderr, "Could not connect to X server\n");
 		exit(-1);
 	}
 	
+	/* Before any thread can touch the error handler */
+	x_active_window_init();
+#ifdef HAVE_OPENCV
+	x_opencv_capture_init();
+#endif
+
 	/* Register cleanup function to be called on exit */
 	atexit(atspi_cleanup);
 
@@ -300,7 +313,14 @@ void x_init(struct platform *platform)
 
 	/* UI element detection for smart hint mode */
 	platform->detect_ui_elements = linux_detect_ui_elements;
+	platform->detect_ui_elements_streaming = linux_detect_ui_elements_streaming;
 	platform->free_ui_elements = linux_free_ui_elements;
+	platform->resolve_ui_element_names = linux_resolve_ui_element_names;
+	platform->active_window_id = x_active_window_id;
+	platform->wait_active_window_change = x_wait_active_window_change;
+	platform->active_window_class = x_active_window_class;
+	platform->active_window_region = x_active_window_region;
+	platform->window_stacking = x_window_stacking;
 	
 	/* Insert text mode */
 	platform->insert_text_mode = x_insert_text_mode;
@@ -109,6 +109,13 @@ void x_copy_selection();
 void x_commit();
 void x_monitor_file(const char *path);
 long x_get_mtime(const char *path);
+void x_active_window_init();
+void x_opencv_capture_init();
+uint64_t x_active_window_id();
+int x_wait_active_window_change(int timeout);
+int x_active_window_class(char *buf, size_t size);
+int x_active_window_region(int *x, int *y, int *w, int *h);
+size_t x_window_stacking(struct window_frame *frames, size_t max);
 
 extern struct monitored_file monitored_files[32];
 extern size_t nr_monitored_files;
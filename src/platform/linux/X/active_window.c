@@ -0,0 +1,294 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Active window tracking through _NET_ACTIVE_WINDOW, and the stacking
+ * order of the other windows through _NET_CLIENT_LIST_STACKING
+ *
+ * Used by the smart hint pre-detector from a background thread, so it
+ * talks to the X server over its own connection instead of dpy. Errors
+ * on that connection are caught by an error handler installed once at
+ * startup, since swapping the process-wide handler from another thread
+ * would race with the main thread.
+ */
+
+#include "X.h"
+#include <pthread.h>
+#include <sys/select.h>
+
+static Display *watch_dpy = NULL;
+static Atom net_active_window;
+static Atom net_client_list_stacking;
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set when a request on watch_dpy failed, windows may vanish at any time */
+static volatile int watch_error = 0;
+static XErrorHandler previous_error_handler;
+
+/**
+ * Record errors on the watch connection, pass the others on
+ */
+static int watch_error_handler(Display *d, XErrorEvent *ev)
+{
+	if (d && d == watch_dpy) {
+		watch_error = 1;
+		return 0;
+	}
+
+	return previous_error_handler ? previous_error_handler(d, ev) : 0;
+}
+
+void x_active_window_init()
+{
+	previous_error_handler = XSetErrorHandler(watch_error_handler);
+}
+
+/* Must be called with watch_lock held */
+static int open_watch_display()
+{
+	if (watch_dpy)
+		return 1;
+
+	watch_dpy = XOpenDisplay(NULL);
+	if (!watch_dpy) {
+		fprintf(stderr, "Could not open X connection for window tracking\n");
+		return 0;
+	}
+
+	net_active_window = XInternAtom(watch_dpy, "_NET_ACTIVE_WINDOW", False);
+	net_client_list_stacking = XInternAtom(watch_dpy, "_NET_CLIENT_LIST_STACKING", False);
+
+	XSelectInput(watch_dpy, DefaultRootWindow(watch_dpy), PropertyChangeMask);
+	XFlush(watch_dpy);
+
+	return 1;
+}
+
+uint64_t x_active_window_id()
+{
+	Atom type;
+	int format;
+	unsigned long nitems, remaining;
+	unsigned char *data = NULL;
+	uint64_t id = 0;
+
+	pthread_mutex_lock(&watch_lock);
+
+	if (open_watch_display() &&
+	    XGetWindowProperty(watch_dpy, DefaultRootWindow(watch_dpy),
+			       net_active_window, 0, 1, False, XA_WINDOW,
+			       &type, &format, &nitems, &remaining,
+			       &data) == Success) {
+		if (data && nitems == 1 && format == 32)
+			id = *(Window *)data;
+	}
+
+	if (data)
+		XFree(data);
+
+	pthread_mutex_unlock(&watch_lock);
+
+	return id;
+}
+
+int x_active_window_class(char *buf, size_t size)
+{
+	XClassHint hint = { NULL, NULL };
+	Window window = (Window)x_active_window_id();
+	int found = 0;
+
+	if (!window || !size)
+		return 0;
+
+	pthread_mutex_lock(&watch_lock);
+
+	/* The window may be gone by now */
+	watch_error = 0;
+	if (XGetClassHint(watch_dpy, window, &hint) && hint.res_class &&
+	    hint.res_class[0]) {
+		snprintf(buf, size, "%s", hint.res_class);
+		found = 1;
+	}
+	XSync(watch_dpy, False);
+	if (watch_error)
+		found = 0;
+
+	pthread_mutex_unlock(&watch_lock);
+
+	if (hint.res_name)
+		XFree(hint.res_name);
+	if (hint.res_class)
+		XFree(hint.res_class);
+
+	return found;
+}
+
+int x_active_window_region(int *x, int *y, int *w, int *h)
+{
+	Window window = (Window)x_active_window_id();
+	XWindowAttributes attrs;
+	Window root, child;
+	int wx, wy, px, py, dummy;
+	unsigned int mask;
+	int found = 0;
+	size_t i;
+
+	if (!window)
+		return 0;
+
+	pthread_mutex_lock(&watch_lock);
+
+	/* The window may be gone by now */
+	watch_error = 0;
+	root = DefaultRootWindow(watch_dpy);
+	if (XGetWindowAttributes(watch_dpy, window, &attrs) &&
+	    XTranslateCoordinates(watch_dpy, window, root, 0, 0, &wx, &wy, &child) &&
+	    XQueryPointer(watch_dpy, root, &root, &child, &px, &py, &dummy, &dummy, &mask))
+		found = 1;
+	XSync(watch_dpy, False);
+	if (watch_error)
+		found = 0;
+
+	pthread_mutex_unlock(&watch_lock);
+
+	if (!found)
+		return 0;
+
+	*x = wx;
+	*y = wy;
+	*w = attrs.width;
+	*h = attrs.height;
+
+	/* Clip to the screen under the pointer */
+	for (i = 0; i < nr_xscreens; i++) {
+		struct screen *scr = &xscreens[i];
+
+		if (px >= scr->x && px < scr->x + scr->w &&
+		    py >= scr->y && py < scr->y + scr->h) {
+			int x1 = *x > scr->x ? *x : scr->x;
+			int y1 = *y > scr->y ? *y : scr->y;
+			int x2 = *x + *w < scr->x + scr->w ? *x + *w : scr->x + scr->w;
+			int y2 = *y + *h < scr->y + scr->h ? *y + *h : scr->y + scr->h;
+
+			if (x2 <= x1 || y2 <= y1)
+				return 0;
+
+			*x = x1;
+			*y = y1;
+			*w = x2 - x1;
+			*h = y2 - y1;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+size_t x_window_stacking(struct window_frame *frames, size_t max)
+{
+	Atom type;
+	int format;
+	unsigned long nitems, remaining;
+	unsigned char *data = NULL;
+	size_t n = 0;
+	size_t i;
+
+	pthread_mutex_lock(&watch_lock);
+
+	if (!open_watch_display() ||
+	    XGetWindowProperty(watch_dpy, DefaultRootWindow(watch_dpy),
+			       net_client_list_stacking, 0, 4096, False, XA_WINDOW,
+			       &type, &format, &nitems, &remaining,
+			       &data) != Success || !data || format != 32) {
+		pthread_mutex_unlock(&watch_lock);
+		if (data)
+			XFree(data);
+		return 0;
+	}
+
+	/* Windows may be gone by now (failed requests are skipped) */
+	Window root = DefaultRootWindow(watch_dpy);
+	Window *windows = (Window *)data;
+
+	/* Walk down from the top, only the topmost max can matter */
+	for (i = nitems; i > 0 && n < max; i--) {
+		XWindowAttributes attrs;
+		Window child;
+		int x, y;
+
+		if (XGetWindowAttributes(watch_dpy, windows[i - 1], &attrs) &&
+		    attrs.map_state == IsViewable &&
+		    XTranslateCoordinates(watch_dpy, windows[i - 1], root, 0, 0,
+					  &x, &y, &child)) {
+			frames[n].x = x;
+			frames[n].y = y;
+			frames[n].w = attrs.width;
+			frames[n].h = attrs.height;
+			n++;
+		}
+	}
+	XSync(watch_dpy, False);
+
+	pthread_mutex_unlock(&watch_lock);
+
+	XFree(data);
+
+	/* Bottom first */
+	for (i = 0; i < n / 2; i++) {
+		struct window_frame tmp = frames[i];
+
+		frames[i] = frames[n - 1 - i];
+		frames[n - 1 - i] = tmp;
+	}
+
+	return n;
+}
+
+/* Drain pending events, returns 1 if the active window property changed. */
+static int drain_events()
+{
+	int changed = 0;
+
+	pthread_mutex_lock(&watch_lock);
+
+	while (XPending(watch_dpy)) {
+		XEvent ev;
+
+		XNextEvent(watch_dpy, &ev);
+		if (ev.type == PropertyNotify &&
+		    ev.xproperty.atom == net_active_window)
+			changed = 1;
+	}
+
+	pthread_mutex_unlock(&watch_lock);
+
+	return changed;
+}
+
+int x_wait_active_window_change(int timeout)
+{
+	fd_set fds;
+	struct timeval tv;
+	int fd;
+
+	pthread_mutex_lock(&watch_lock);
+	if (!open_watch_display()) {
+		pthread_mutex_unlock(&watch_lock);
+		return 0;
+	}
+	fd = ConnectionNumber(watch_dpy);
+	pthread_mutex_unlock(&watch_lock);
+
+	if (drain_events())
+		return 1;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0)
+		return 0;
+
+	return drain_events();
+}
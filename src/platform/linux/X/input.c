@@ -138,8 +138,14 @@ static uint8_t process_xinput_event(XEvent *ev, int *state, int *mods)
 }
 
 static const char *xerr_key = NULL;
-static int input_xerr(Display *dpy, XErrorEvent *ev)
+static XErrorHandler previous_xerr;
+
+static int input_xerr(Display *d, XErrorEvent *ev)
 {
+	/* Other connections (e.g. window tracking) have their own handling */
+	if (d != dpy)
+		return previous_xerr ? previous_xerr(d, ev) : 0;
+
 	fprintf(stderr,
 		"ERROR: Failed to grab %s (ensure it isn't mapped by another application)\n",
 		xerr_key);
@@ -177,12 +183,13 @@ static const char *input_tostr(struct input_event *ev)
 
 static void xgrab_key(uint8_t code, uint8_t mods, int grab)
 {
-	XSetErrorHandler(input_xerr);
 	int xmods = 0;
 
 	if (!code)
 		return;
 
+	previous_xerr = XSetErrorHandler(input_xerr);
+
 	if (mods & PLATFORM_MOD_CONTROL)
 		xmods |= ControlMask;
 	if (mods & PLATFORM_MOD_SHIFT)
@@ -207,7 +214,7 @@ static void xgrab_key(uint8_t code, uint8_t mods, int grab)
 
 	XSync(dpy, False);
 
-	XSetErrorHandler(NULL);
+	XSetErrorHandler(previous_xerr);
 }
 
 void x_input_grab_keyboard()
@@ -0,0 +1,171 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Learned skip-list of barren AT-SPI subtrees
+ *
+ * Tables are kept per application bus name, so they live as long as the
+ * application (or the detector) does.
+ */
+
+#include "atspi-barren.h"
+
+/* Smallest subtree (in visited nodes) worth remembering */
+#define BARREN_MIN_NODES 16
+
+/* Empty complete walks before a signature is skipped */
+#define BARREN_MIN_WALKS 3
+
+/* Every this many skips the subtree is walked again */
+#define BARREN_REVALIDATE_INTERVAL 8
+
+/* Bounds of the tables */
+#define BARREN_MAX_APPS 32
+#define BARREN_MAX_SIGNATURES 256
+
+#define FNV_PRIME 1099511628211ULL
+#define FNV_OFFSET 14695981039346656037ULL
+
+typedef struct {
+	guint empty_walks; /* Consecutive complete walks without candidates */
+	guint skips;
+} BarrenEntry;
+
+struct AtspiBarrenTable {
+	GHashTable *entries; /* guint64 signature -> BarrenEntry */
+	gint64 last_used;
+};
+
+static GHashTable *tables = NULL; /* Bus name -> AtspiBarrenTable */
+
+static guint64 mix(guint64 hash, guint64 value)
+{
+	for (gint i = 0; i < 8; i++) {
+		hash ^= (value >> (i * 8)) & 0xff;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+guint64 atspi_barren_path(guint64 parent_path, AtspiRole role)
+{
+	return mix(parent_path ? parent_path : FNV_OFFSET, (guint64)role);
+}
+
+guint64 atspi_barren_signature(guint64 path, gint child_count)
+{
+	/* Child counts within a power of two share a signature */
+	return mix(path, g_bit_storage((gulong)MAX(child_count, 0)));
+}
+
+static void table_free(gpointer data)
+{
+	AtspiBarrenTable *table = data;
+
+	g_hash_table_destroy(table->entries);
+	g_free(table);
+}
+
+/**
+ * Drop the table used least recently
+ */
+static void evict_table(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gpointer oldest = NULL;
+	gint64 oldest_use = G_MAXINT64;
+
+	g_hash_table_iter_init(&iter, tables);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		AtspiBarrenTable *table = value;
+		if (table->last_used < oldest_use) {
+			oldest_use = table->last_used;
+			oldest = key;
+		}
+	}
+
+	if (oldest)
+		g_hash_table_remove(tables, oldest);
+}
+
+AtspiBarrenTable *atspi_barren_table(AtspiApplication *app)
+{
+	if (!app || !app->bus_name)
+		return NULL;
+
+	if (!tables)
+		tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, table_free);
+
+	AtspiBarrenTable *table = g_hash_table_lookup(tables, app->bus_name);
+	if (!table) {
+		if (g_hash_table_size(tables) >= BARREN_MAX_APPS)
+			evict_table();
+
+		table = g_new0(AtspiBarrenTable, 1);
+		table->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+						       g_free, g_free);
+		g_hash_table_insert(tables, g_strdup(app->bus_name), table);
+	}
+
+	table->last_used = g_get_monotonic_time();
+	return table;
+}
+
+gboolean atspi_barren_skip(AtspiBarrenTable *table, guint64 signature)
+{
+	BarrenEntry *entry = g_hash_table_lookup(table->entries, &signature);
+
+	if (!entry || entry->empty_walks < BARREN_MIN_WALKS)
+		return FALSE;
+
+	return ++entry->skips % BARREN_REVALIDATE_INTERVAL != 0;
+}
+
+void atspi_barren_observe(AtspiBarrenTable *table, guint64 signature,
+			  guint nodes, guint candidates)
+{
+	if (candidates > 0) {
+		/* Not (or no longer) barren */
+		g_hash_table_remove(table->entries, &signature);
+		return;
+	}
+
+	if (nodes < BARREN_MIN_NODES)
+		return;
+
+	BarrenEntry *entry = g_hash_table_lookup(table->entries, &signature);
+	if (!entry) {
+		if (g_hash_table_size(table->entries) >= BARREN_MAX_SIGNATURES)
+			return;
+
+		guint64 *key = g_new(guint64, 1);
+		*key = signature;
+		entry = g_new0(BarrenEntry, 1);
+		g_hash_table_insert(table->entries, key, entry);
+	}
+
+	entry->empty_walks++;
+}
+
+guint atspi_barren_learned(AtspiBarrenTable *table)
+{
+	GHashTableIter iter;
+	gpointer value;
+	guint learned = 0;
+
+	g_hash_table_iter_init(&iter, table->entries);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		if (((BarrenEntry *)value)->empty_walks >= BARREN_MIN_WALKS)
+			learned++;
+	}
+
+	return learned;
+}
+
+void atspi_barren_cleanup(void)
+{
+	if (tables) {
+		g_hash_table_destroy(tables);
+		tables = NULL;
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Learned skip-list of barren AT-SPI subtrees
+ *
+ * Document canvases, terminal panes and long text views can hold
+ * thousands of nodes without a single hint candidate, and every traversal
+ * walks them again. Subtrees are identified by a signature (the role path
+ * from the window down to them plus the range of their child count);
+ * a signature that came up empty on several complete walks is skipped in
+ * later traversals of the same application, and walked again every few
+ * skips in case the UI changed.
+ */
+
+#ifndef ATSPI_BARREN_H
+#define ATSPI_BARREN_H
+
+#include <at-spi-2.0/atspi/atspi.h>
+#include <glib.h>
+
+typedef struct AtspiBarrenTable AtspiBarrenTable;
+
+/* Role path of a node whose parent has role path parent_path (0 for the root) */
+guint64 atspi_barren_path(guint64 parent_path, AtspiRole role);
+
+/* Signature of the subtree of a node */
+guint64 atspi_barren_signature(guint64 path, gint child_count);
+
+/* Skip-list of the application app (created on first use) */
+AtspiBarrenTable *atspi_barren_table(AtspiApplication *app);
+
+/*
+ * Check whether a subtree is to be skipped. Every few skips it is not, so
+ * the walk that follows revalidates the entry.
+ */
+gboolean atspi_barren_skip(AtspiBarrenTable *table, guint64 signature);
+
+/*
+ * Report a completely walked subtree: nodes visited in it and how many
+ * of them became hint candidates
+ */
+void atspi_barren_observe(AtspiBarrenTable *table, guint64 signature,
+			  guint nodes, guint candidates);
+
+/* Number of barren signatures learned in table */
+guint atspi_barren_learned(AtspiBarrenTable *table);
+
+void atspi_barren_cleanup(void);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Per-window AT-SPI element cache
+ *
+ * The elements found in a window are kept between smart hint activations.
+ * AT-SPI change events mark the subtrees they originate from as dirty, so
+ * the next activation on the same window only re-walks those subtrees
+ * instead of traversing the whole window again.
+ *
+ * Gecko and Chromium report neither scrolling nor reflow of web content
+ * as bounds changes, so a few cached elements are also checked against
+ * their current extents before a cache is used.
+ */
+
+#include "atspi-cache.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Import config functions */
+extern int config_get_int(const char *key);
+
+#define CACHE_MAX_WINDOWS 8
+
+/* More dirty subtrees than this and a full traversal is cheaper */
+#define CACHE_MAX_DIRTY 64
+
+/* Bound on parent walks (the tree walker never goes deeper either) */
+#define CACHE_MAX_ANCESTRY 256
+
+/* Cached elements whose extents are checked on lookup */
+#define CACHE_SAMPLE_SIZE 4
+
+struct AtspiWindowCache {
+	AtspiAccessible *window;
+	AtspiRect extents;       /* Window extents when the cache was built */
+	GSList *elements;        /* ElementInfo, owned */
+	GHashTable *dirty;       /* Dirty subtree roots (referenced) */
+	gboolean invalid;        /* Whole window needs a traversal */
+	gint64 created;          /* Time of the last full traversal (us) */
+	gint64 last_used;
+};
+
+static const char *invalidating_events[] = {
+	"object:children-changed",
+	"object:bounds-changed",
+	"object:state-changed:showing",
+};
+
+/* Events after which every element of the window may have moved */
+static const char *window_invalidating_events[] = {
+	"object:visible-data-changed",
+	"document:load-complete",
+	"document:reload",
+};
+
+/*
+ * libatspi updates its own property cache (role, name, states) from the
+ * events it receives, but only events somebody listens for are delivered.
+ * These keep the cached properties the detector relies on current.
+ */
+static const char *cache_sync_events[] = {
+	"object:property-change:accessible-name",
+	"object:property-change:accessible-role",
+	"object:state-changed",
+};
+
+static GHashTable *caches = NULL; /* AtspiAccessible *window -> cache */
+static AtspiEventListener *activate_listener = NULL;
+static AtspiEventListener *listener = NULL;      /* NULL while the cache is disabled */
+static AtspiEventListener *sync_listener = NULL;
+static AtspiAccessible *active_window = NULL;
+
+static void cache_free(AtspiWindowCache *cache)
+{
+	g_slist_free_full(cache->elements, (GDestroyNotify)element_info_free);
+	g_hash_table_destroy(cache->dirty);
+	g_free(cache);
+}
+
+static void cache_invalidate(AtspiWindowCache *cache)
+{
+	cache->invalid = TRUE;
+	g_hash_table_remove_all(cache->dirty);
+}
+
+/*
+ * Objects of one application share their AtspiApplication, which lets
+ * events from other applications be discarded without any D-Bus call.
+ */
+static gboolean same_application(AtspiAccessible *a, AtspiAccessible *b)
+{
+	return ((AtspiObject *)a)->app == ((AtspiObject *)b)->app;
+}
+
+static void mark_dirty(AtspiWindowCache *cache, AtspiAccessible *node)
+{
+	if (cache->invalid || !same_application(cache->window, node))
+		return;
+
+	if (node == cache->window) {
+		cache_invalidate(cache);
+		return;
+	}
+
+	if (g_hash_table_contains(cache->dirty, node))
+		return;
+
+	if (g_hash_table_size(cache->dirty) >= CACHE_MAX_DIRTY) {
+		cache_invalidate(cache);
+		return;
+	}
+
+	g_hash_table_add(cache->dirty, g_object_ref(node));
+}
+
+static gboolean invalidates_window(const char *type)
+{
+	for (gsize i = 0; i < G_N_ELEMENTS(window_invalidating_events); i++) {
+		if (g_str_has_prefix(type, window_invalidating_events[i]))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void on_event(AtspiEvent *event, void *user_data)
+{
+	if (event->source && caches) {
+		gboolean whole = invalidates_window(event->type);
+		GHashTableIter iter;
+		gpointer value;
+
+		/*
+		 * Finding the window of a document takes D-Bus calls, every
+		 * window of its application is invalidated instead
+		 */
+		g_hash_table_iter_init(&iter, caches);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			AtspiWindowCache *cache = value;
+
+			if (!whole)
+				mark_dirty(cache, event->source);
+			else if (same_application(cache->window, event->source))
+				cache_invalidate(cache);
+		}
+	}
+
+	g_boxed_free(ATSPI_TYPE_EVENT, event);
+}
+
+static void on_activate(AtspiEvent *event, void *user_data)
+{
+	if (event->source) {
+		if (active_window)
+			g_object_unref(active_window);
+		active_window = g_object_ref(event->source);
+	}
+
+	g_boxed_free(ATSPI_TYPE_EVENT, event);
+}
+
+static void on_sync_event(AtspiEvent *event, void *user_data)
+{
+	/* libatspi already applied the change to its cache */
+	g_boxed_free(ATSPI_TYPE_EVENT, event);
+}
+
+static void listen_for(AtspiEventListener *events_listener, const char *const *events,
+		       gsize count)
+{
+	GError *error = NULL;
+
+	for (gsize i = 0; i < count; i++) {
+		if (!atspi_event_listener_register(events_listener, events[i], &error)) {
+			fprintf(stderr, "AT-SPI: Failed to listen for %s: %s\n",
+				events[i], error ? error->message : "unknown error");
+			g_clear_error(&error);
+		}
+	}
+}
+
+static void stop_listening(AtspiEventListener *events_listener, const char *const *events,
+			   gsize count)
+{
+	for (gsize i = 0; i < count; i++)
+		atspi_event_listener_deregister(events_listener, events[i], NULL);
+}
+
+/*
+ * Every application sends the object events to the listening process,
+ * so they are only listened for while the cache uses them
+ */
+static void stop_cache_listeners(void)
+{
+	if (listener) {
+		stop_listening(listener, invalidating_events, G_N_ELEMENTS(invalidating_events));
+		stop_listening(listener, window_invalidating_events,
+			       G_N_ELEMENTS(window_invalidating_events));
+		g_object_unref(listener);
+		listener = NULL;
+	}
+
+	if (sync_listener) {
+		stop_listening(sync_listener, cache_sync_events, G_N_ELEMENTS(cache_sync_events));
+		g_object_unref(sync_listener);
+		sync_listener = NULL;
+	}
+
+	if (caches) {
+		g_hash_table_destroy(caches);
+		caches = NULL;
+	}
+}
+
+void atspi_cache_init(void)
+{
+	static const char *activate_events[] = { "window:activate" };
+
+	if (!activate_listener) {
+		activate_listener = atspi_event_listener_new(on_activate, NULL, NULL);
+		listen_for(activate_listener, activate_events, G_N_ELEMENTS(activate_events));
+	}
+
+	if (!atspi_cache_enabled()) {
+		stop_cache_listeners();
+		return;
+	}
+
+	if (listener)
+		return;
+
+	listener = atspi_event_listener_new(on_event, NULL, NULL);
+	listen_for(listener, invalidating_events, G_N_ELEMENTS(invalidating_events));
+	listen_for(listener, window_invalidating_events,
+		   G_N_ELEMENTS(window_invalidating_events));
+
+	sync_listener = atspi_event_listener_new(on_sync_event, NULL, NULL);
+	listen_for(sync_listener, cache_sync_events, G_N_ELEMENTS(cache_sync_events));
+}
+
+gboolean atspi_cache_enabled(void)
+{
+	return config_get_int("ui_atspi_cache_ttl") > 0;
+}
+
+void atspi_cache_dispatch_events(void)
+{
+	/* Bounded, so a flood of events cannot stall detection */
+	for (int i = 0; i < 10000; i++) {
+		if (!g_main_context_iteration(NULL, FALSE))
+			break;
+	}
+}
+
+AtspiAccessible *atspi_cache_ref_active_window(void)
+{
+	return active_window ? g_object_ref(active_window) : NULL;
+}
+
+/*
+ * Check whether a few cached elements, spread over the cache, are still
+ * where they were found
+ */
+static gboolean sample_in_place(AtspiWindowCache *cache)
+{
+	guint count = g_slist_length(cache->elements);
+	guint step = MAX(count / CACHE_SAMPLE_SIZE, 1);
+	guint checked = 0;
+	guint i = 0;
+
+	for (GSList *it = cache->elements; it && checked < CACHE_SAMPLE_SIZE; it = it->next, i++) {
+		ElementInfo *element = it->data;
+
+		if (i % step != 0)
+			continue;
+		checked++;
+
+		AtspiComponent *component = atspi_accessible_get_component(element->node);
+		if (!component)
+			return FALSE;
+
+		AtspiRect *rect = atspi_component_get_extents(component, ATSPI_COORD_TYPE_SCREEN,
+							      NULL);
+		g_object_unref(component);
+
+		gboolean moved = !rect || rect->x != element->x || rect->y != element->y ||
+				 rect->width != element->w || rect->height != element->h;
+		g_free(rect);
+
+		if (moved)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+AtspiWindowCache *atspi_cache_lookup(AtspiAccessible *window,
+				     const AtspiRect *extents)
+{
+	if (!caches)
+		return NULL;
+
+	AtspiWindowCache *cache = g_hash_table_lookup(caches, window);
+	if (!cache)
+		return NULL;
+
+	gint64 now = g_get_monotonic_time();
+	gint64 ttl = config_get_int("ui_atspi_cache_ttl");
+
+	if (cache->invalid || ttl <= 0 ||
+	    now - cache->created > ttl * 1000 ||
+	    memcmp(&cache->extents, extents, sizeof(*extents)) != 0 ||
+	    !sample_in_place(cache)) {
+		g_hash_table_remove(caches, window);
+		return NULL;
+	}
+
+	cache->last_used = now;
+	return cache;
+}
+
+/*
+ * Find the depth of a dirty node below the cached window.
+ *
+ * Returns FALSE if the node is not inside the window, or if one of its
+ * ancestors is dirty too (re-walking that ancestor covers the node).
+ */
+static gboolean locate_dirty_root(AtspiWindowCache *cache, AtspiAccessible *node,
+				  gint *depth)
+{
+	AtspiAccessible *current = g_object_ref(node);
+	gboolean found = FALSE;
+
+	for (gint d = 1; d < CACHE_MAX_ANCESTRY; d++) {
+		AtspiAccessible *parent = atspi_accessible_get_parent(current, NULL);
+		g_object_unref(current);
+		current = parent;
+
+		if (!current)
+			break;
+
+		if (current == cache->window) {
+			*depth = d;
+			found = TRUE;
+			break;
+		}
+
+		if (g_hash_table_contains(cache->dirty, current))
+			break;
+	}
+
+	if (current)
+		g_object_unref(current);
+
+	return found;
+}
+
+/*
+ * Check whether a cached element lies in a dirty subtree, or is no longer
+ * attached to the window at all.
+ */
+static gboolean is_stale(AtspiWindowCache *cache, AtspiAccessible *node)
+{
+	AtspiAccessible *current = g_object_ref(node);
+	gboolean stale = TRUE;
+
+	for (gint d = 0; current && d < CACHE_MAX_ANCESTRY; d++) {
+		if (current == cache->window) {
+			stale = FALSE;
+			break;
+		}
+
+		if (g_hash_table_contains(cache->dirty, current))
+			break;
+
+		AtspiAccessible *parent = atspi_accessible_get_parent(current, NULL);
+		g_object_unref(current);
+		current = parent;
+	}
+
+	if (current)
+		g_object_unref(current);
+
+	return stale;
+}
+
+GArray *atspi_cache_take_dirty(AtspiWindowCache *cache)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (cache->invalid)
+		return NULL;
+
+	GArray *roots = g_array_new(FALSE, FALSE, sizeof(AtspiDirtyRoot));
+
+	g_hash_table_iter_init(&iter, cache->dirty);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		AtspiDirtyRoot root = { key, 0 };
+
+		if (locate_dirty_root(cache, root.node, &root.depth)) {
+			g_object_ref(root.node);
+			g_array_append_val(roots, root);
+		}
+	}
+
+	/* Drop the cached elements the re-walk will produce again */
+	if (roots->len > 0) {
+		GSList *kept = NULL;
+
+		for (GSList *it = cache->elements; it; it = it->next) {
+			ElementInfo *element = it->data;
+
+			if (is_stale(cache, element->node))
+				element_info_free(element);
+			else
+				kept = g_slist_prepend(kept, element);
+		}
+
+		g_slist_free(cache->elements);
+		cache->elements = g_slist_reverse(kept);
+	}
+
+	g_hash_table_remove_all(cache->dirty);
+	return roots;
+}
+
+void atspi_cache_free_dirty(GArray *roots)
+{
+	if (!roots)
+		return;
+
+	for (guint i = 0; i < roots->len; i++)
+		g_object_unref(g_array_index(roots, AtspiDirtyRoot, i).node);
+
+	g_array_free(roots, TRUE);
+}
+
+guint atspi_cache_count(AtspiWindowCache *cache)
+{
+	return g_slist_length(cache->elements);
+}
+
+void atspi_cache_add(AtspiWindowCache *cache, ElementInfo *element)
+{
+	cache->elements = g_slist_append(cache->elements, element);
+}
+
+GSList *atspi_cache_copy_elements(AtspiWindowCache *cache)
+{
+	GSList *copy = NULL;
+
+	for (GSList *it = cache->elements; it; it = it->next)
+		copy = g_slist_prepend(copy, element_info_dup(it->data));
+
+	return g_slist_reverse(copy);
+}
+
+static void evict_least_recently_used(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gpointer oldest = NULL;
+	gint64 oldest_time = G_MAXINT64;
+
+	g_hash_table_iter_init(&iter, caches);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		AtspiWindowCache *cache = value;
+		if (cache->last_used < oldest_time) {
+			oldest_time = cache->last_used;
+			oldest = key;
+		}
+	}
+
+	if (oldest)
+		g_hash_table_remove(caches, oldest);
+}
+
+void atspi_cache_store(AtspiAccessible *window, const AtspiRect *extents,
+		       GSList *elements)
+{
+	if (!atspi_cache_enabled())
+		return;
+
+	if (!caches)
+		caches = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					       g_object_unref,
+					       (GDestroyNotify)cache_free);
+
+	g_hash_table_remove(caches, window);
+	if (g_hash_table_size(caches) >= CACHE_MAX_WINDOWS)
+		evict_least_recently_used();
+
+	AtspiWindowCache *cache = g_new0(AtspiWindowCache, 1);
+	cache->window = window;
+	cache->extents = *extents;
+	cache->dirty = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					     g_object_unref, NULL);
+	cache->created = g_get_monotonic_time();
+	cache->last_used = cache->created;
+
+	for (GSList *it = elements; it; it = it->next)
+		cache->elements = g_slist_prepend(cache->elements,
+						  element_info_dup(it->data));
+	cache->elements = g_slist_reverse(cache->elements);
+
+	g_hash_table_insert(caches, g_object_ref(window), cache);
+}
+
+void atspi_cache_drop(AtspiAccessible *window)
+{
+	if (caches)
+		g_hash_table_remove(caches, window);
+}
+
+void atspi_cache_cleanup(void)
+{
+	stop_cache_listeners();
+
+	if (activate_listener) {
+		atspi_event_listener_deregister(activate_listener, "window:activate", NULL);
+		g_object_unref(activate_listener);
+		activate_listener = NULL;
+	}
+
+	if (active_window) {
+		g_object_unref(active_window);
+		active_window = NULL;
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Per-window AT-SPI element cache, invalidated by AT-SPI events
+ */
+
+#ifndef ATSPI_CACHE_H
+#define ATSPI_CACHE_H
+
+#include "atspi-detector.h"
+#include <glib.h>
+
+/* Root of a subtree that changed since the window was last traversed */
+typedef struct AtspiDirtyRoot {
+	AtspiAccessible *node;
+	gint depth; /* Depth below the window, as used by the tree walker */
+} AtspiDirtyRoot;
+
+typedef struct AtspiWindowCache AtspiWindowCache;
+
+/*
+ * Register the event listeners (safe to call repeatedly). The ones the
+ * cache needs are registered or removed as ui_atspi_cache_ttl switches
+ * the cache on or off.
+ */
+void atspi_cache_init(void);
+
+/*
+ * Whether the cache is in use. While it is not, nothing keeps the
+ * properties libatspi caches up to date.
+ */
+gboolean atspi_cache_enabled(void);
+
+/*
+ * Dispatch AT-SPI events queued since the last call.
+ *
+ * Nothing runs a GLib main loop between activations, so events are only
+ * delivered here, right before the cache is consulted.
+ */
+void atspi_cache_dispatch_events(void);
+
+/* Last window reported by window:activate (new reference, may be NULL) */
+AtspiAccessible *atspi_cache_ref_active_window(void);
+
+/*
+ * Look up the cache of a window. Returns NULL if the window has no usable
+ * cache: never traversed, expired, moved/resized since it was stored (the
+ * extents are compared against the current ones), invalidated as a whole
+ * by its events, or a sampled element is no longer where it was cached.
+ */
+AtspiWindowCache *atspi_cache_lookup(AtspiAccessible *window,
+				     const AtspiRect *extents);
+
+/*
+ * Take the dirty subtree roots of a cached window.
+ *
+ * Cached elements inside those subtrees are dropped; the caller re-walks
+ * each returned root and adds the elements it finds back with
+ * atspi_cache_add(). Returns NULL if the whole window needs a traversal.
+ * Free the array with atspi_cache_free_dirty().
+ */
+GArray *atspi_cache_take_dirty(AtspiWindowCache *cache);
+void atspi_cache_free_dirty(GArray *roots);
+
+/* Number of cached elements */
+guint atspi_cache_count(AtspiWindowCache *cache);
+
+/* Add an element to the cache (ownership is transferred) */
+void atspi_cache_add(AtspiWindowCache *cache, ElementInfo *element);
+
+/* Copy the cached elements into a new list owned by the caller */
+GSList *atspi_cache_copy_elements(AtspiWindowCache *cache);
+
+/* Replace the cache of a window with copies of a fresh traversal */
+void atspi_cache_store(AtspiAccessible *window, const AtspiRect *extents,
+		       GSList *elements);
+
+/* Forget the cache of a window */
+void atspi_cache_drop(AtspiAccessible *window);
+
+void atspi_cache_cleanup(void);
+
+#endif
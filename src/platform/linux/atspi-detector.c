@@ -5,6 +5,12 @@ atspi-2` -pthread -L/usr/X11R6/lib -lm `pkg-config --libs glib-2.0 gobject-2.0
 atk-bridge-2.0 atspi-2`
 */
 #include "atspi-detector.h"
+#include "atspi-barren.h"
+#include "atspi-cache.h"
+#include "atspi-helper.h"
+#include "atspi-pipeline.h"
+#include "atspi-transport.h"
+#include "atspi-walk.h"
 #include "../../platform.h"
 #include <at-spi-2.0/atspi/atspi.h>
 #include <glib-2.0/glib.h>
@@ -18,6 +24,8 @@ atk-bridge-2.0 atspi-2`
 extern const char *config_get(const char *key);
 extern int config_get_int(const char *key);
 
+extern struct platform *platform;
+
 /* Helper macros */
 #ifndef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -27,18 +35,134 @@ extern int config_get_int(const char *key);
 #endif
 
 GSList *element_list = NULL;
+static GSList *element_tail = NULL;     /* Last link, appends are O(1) */
+static guint element_count = 0;
 static gint max_depth_reached = 0;
 
+/* Traversal deadline (monotonic time in us, 0 = unbounded) */
+static gint64 traversal_deadline = 0;
+static gboolean traversal_timed_out = FALSE;
+
+/* Cancellation token of the running detection (may be NULL) */
+static const struct ui_cancel_token *traversal_cancel = NULL;
+
+/*
+ * Share of the budget of the window being walked in desktop scope (0 =
+ * none). Running past it ends that window only.
+ */
+static gint64 slice_deadline = 0;
+static gboolean slice_expired = FALSE;
+
+/*
+ * Windows stacked above the one being walked in desktop scope, elements
+ * they cover are dropped (see is_occluded())
+ */
+static AtspiRect occluders[ATSPI_HELPER_MAX_WINDOWS];
+static guint occluder_count = 0;
+
+/*
+ * Properties kept by libatspi once fetched. Applications that implement
+ * the Cache interface hand them over in bulk when they are first seen, so
+ * role, name and state checks never leave the process. Extents cannot be
+ * cached by libatspi and are memoized per traversal instead.
+ */
+#define PREFETCH_CACHE_MASK (ATSPI_CACHE_PARENT | ATSPI_CACHE_NAME | \
+			     ATSPI_CACHE_STATES | ATSPI_CACHE_ROLE | \
+			     ATSPI_CACHE_INTERFACES)
+
+/*
+ * Per-traversal memo: node extents, and the clip rectangle of the root
+ * (the window on the monitor hints are shown on). root_clip_valid is FALSE
+ * if neither is known, everything then counts as visible.
+ */
+static AtspiRect root_clip = { -1, -1, -1, -1 };
+static gboolean root_clip_valid = FALSE;
+static GHashTable *extents_memo = NULL; /* AtspiAccessible * -> AtspiRect */
+static gint min_visible_area = 100;
+
+/* D-Bus calls the cache cannot serve, counted per traversal */
+static guint round_trips = 0;
+
+/* Calls of those sent while others were in flight, and how many at most */
+static guint pipelined_calls = 0;
+static gint pipeline_depth = 0;
+
+/* Subtrees skipped because their clip rectangle was empty */
+static guint pruned_subtrees = 0;
+
+/* Skip subtrees learned to hold no candidates (see atspi-barren.h) */
+static gboolean skip_barren = FALSE;
+static guint barren_skipped = 0;
+
+/* Leave names to atspi_element_name(), called once the hints are shown */
+static gboolean lazy_names = FALSE;
+
+/* Elements handed to the sink while the traversal is still running */
+#define STREAM_BATCH_SIZE 8
+
+static AtspiElementSink element_sink = NULL;
+static GSList *stream_last = NULL;      /* Last element handed to the sink */
+static guint stream_pending = 0;        /* Elements collected since then */
+static gboolean stream_paused = FALSE;
+
+void atspi_set_element_sink(AtspiElementSink sink)
+{
+	element_sink = sink;
+}
+
+/**
+ * Hand the elements collected since the last flush to the sink
+ */
+static void stream_flush(void)
+{
+	if (!element_sink || stream_paused || stream_pending == 0)
+		return;
+
+	GSList *first = stream_last ? stream_last->next : element_list;
+	if (!first)
+		return;
+
+	element_sink(first);
+	stream_last = g_slist_last(first);
+	stream_pending = 0;
+}
+
+/**
+ * Check whether the ui_detection_timeout budget has been used up
+ *
+ * Once the deadline passes every traversal stops at its next check, and the
+ * elements collected so far are returned as a partial result. A cancelled
+ * detection stops the same way.
+ */
+static gboolean deadline_reached(void)
+{
+	if (traversal_timed_out || slice_expired)
+		return TRUE;
+
+	if (ui_cancel_requested(traversal_cancel)) {
+		traversal_timed_out = TRUE;
+		fprintf(stderr, "AT-SPI: Detection cancelled\n");
+	} else if (traversal_deadline && g_get_monotonic_time() >= traversal_deadline) {
+		traversal_timed_out = TRUE;
+		fprintf(stderr, "AT-SPI: Detection timeout reached, returning partial results\n");
+	} else if (slice_deadline && g_get_monotonic_time() >= slice_deadline) {
+		slice_expired = TRUE;
+	}
+
+	return traversal_timed_out || slice_expired;
+}
+
 static gchar *get_label(AtspiAccessible *accessible)
 {
 	GArray *relations;
 	AtspiRelation *relation;
 	guint i;
-	gchar *result = "";
+	gchar *result = NULL;
 
+	round_trips++;
 	relations = atspi_accessible_get_relation_set(accessible, NULL);
 	if (relations == NULL) {
-		return "";
+		return NULL;
 	}
 
 	for (i = 0; i < relations->len; i++) {
@@ -46,6 +170,8 @@ static gchar *get_label(AtspiAccessible *accessible)
 
 		if (atspi_relation_get_relation_type(relation) ==
 		    ATSPI_RELATION_LABELLED_BY) {
+			round_trips++;
+			g_free(result);
 			result = atspi_accessible_get_name(
 			    atspi_relation_get_target(relation, 0), NULL);
 		}
@@ -57,22 +183,46 @@ static gchar *get_label(AtspiAccessible *accessible)
 	return result;
 }
 
+/**
+ * Get the screen extents of a node, all -1 if it has none
+ *
+ * Within a traversal the extents of each node are fetched only once.
+ */
 static void get_rect(AtspiAccessible *accessible, gint *x, gint *y, gint *w,
 		     gint *h)
 {
-	AtspiComponent *component = atspi_accessible_get_component(accessible);
-	if (component != NULL) {
-		AtspiRect *rect = atspi_component_get_extents(
-		    component, ATSPI_COORD_TYPE_SCREEN, NULL);
-		if (rect != NULL) {
-			*x = rect->x;
-			*y = rect->y;
-			*w = rect->width;
-			*h = rect->height;
-			g_free(rect);
+	AtspiRect *memo = extents_memo ? g_hash_table_lookup(extents_memo, accessible) : NULL;
+	if (!memo) {
+		memo = g_new(AtspiRect, 1);
+		memo->x = memo->y = memo->width = memo->height = -1;
+
+		AtspiComponent *component = atspi_accessible_get_component(accessible);
+		if (component != NULL) {
+			round_trips++;
+			AtspiRect *rect = atspi_component_get_extents(
+			    component, ATSPI_COORD_TYPE_SCREEN, NULL);
+			if (rect != NULL) {
+				*memo = *rect;
+				g_free(rect);
+			}
+			g_object_unref(component);
 		}
-		g_object_unref(component);
+
+		if (!extents_memo) {
+			*x = memo->x;
+			*y = memo->y;
+			*w = memo->width;
+			*h = memo->height;
+			g_free(memo);
+			return;
+		}
+		g_hash_table_insert(extents_memo, g_object_ref(accessible), memo);
 	}
+
+	*x = memo->x;
+	*y = memo->y;
+	*w = memo->width;
+	*h = memo->height;
 }
 
 static gboolean check_is_visible(AtspiStateSet *states)
@@ -81,26 +231,132 @@ static gboolean check_is_visible(AtspiStateSet *states)
 	       atspi_state_set_contains(states, ATSPI_STATE_VISIBLE);
 }
 
+static void memoize_extents(AtspiAccessible *node, const AtspiRect *extents, gpointer data)
+{
+	AtspiRect *memo = g_new(AtspiRect, 1);
+
+	(void)data;
+	*memo = *extents;
+	g_hash_table_insert(extents_memo, g_object_ref(node), memo);
+}
+
 /**
- * Check if element is actually visible within the active window bounds
- * This handles clipping by parent containers and window boundaries
+ * Fetch the extents of the visible nodes among nodes in one pipelined
+ * batch, so the get_rect() calls that follow are served from the memo
  */
-static gboolean check_is_actually_visible(AtspiAccessible *accessible, AtspiAccessible *window)
+static void prefetch_extents(AtspiAccessible **nodes, guint count)
+{
+	if (pipeline_depth <= 0 || !extents_memo || count < 2)
+		return;
+
+	GPtrArray *wanted = g_ptr_array_sized_new(count);
+
+	for (guint i = 0; i < count; i++) {
+		AtspiAccessible *node = nodes[i];
+
+		/* Interfaces and states come from the cache */
+		if (g_hash_table_contains(extents_memo, node) ||
+		    !atspi_accessible_is_component(node))
+			continue;
+
+		AtspiStateSet *states = atspi_accessible_get_state_set(node);
+		gboolean is_visible = states && check_is_visible(states);
+		if (states)
+			g_object_unref(states);
+
+		if (is_visible)
+			g_ptr_array_add(wanted, node);
+	}
+
+	if (wanted->len > 1) {
+		guint calls = atspi_pipeline_get_extents((AtspiAccessible **)wanted->pdata,
+							 wanted->len, pipeline_depth,
+							 deadline_reached, memoize_extents, NULL);
+		round_trips += calls;
+		pipelined_calls += calls;
+	}
+
+	g_ptr_array_free(wanted, TRUE);
+}
+
+/**
+ * Intersect two rectangles, FALSE if the intersection is empty
+ */
+static gboolean intersect_rect(const AtspiRect *a, const AtspiRect *b, AtspiRect *out)
+{
+	gint x = MAX(a->x, b->x);
+	gint y = MAX(a->y, b->y);
+	gint w = MIN(a->x + a->width, b->x + b->width) - x;
+	gint h = MIN(a->y + a->height, b->y + b->height) - y;
+
+	if (w <= 0 || h <= 0)
+		return FALSE;
+
+	out->x = x;
+	out->y = y;
+	out->width = w;
+	out->height = h;
+	return TRUE;
+}
+
+/*
+ * Roles whose children are only visible within their own bounds. Their
+ * extents are intersected into the clip rectangle handed to the children,
+ * so scrolled-away rows of a list or table are never visited.
+ */
+static gboolean clips_children(AtspiRole role)
+{
+	return role == ATSPI_ROLE_SCROLL_PANE || role == ATSPI_ROLE_VIEWPORT;
+}
+
+/**
+ * Get the rectangle of the monitor hints are shown on (the one holding
+ * the pointer), FALSE if the platform cannot tell
+ *
+ * The detector helper has no platform, the daemon tells it the monitor.
+ */
+static gboolean get_monitor_rect(AtspiRect *out)
+{
+	screen_t scr = NULL;
+
+	if (!platform)
+		return atspi_helper_monitor(&out->x, &out->y, &out->width, &out->height);
+	if (!platform->mouse_get_position || !platform->screen_get_dimensions)
+		return FALSE;
+
+	platform->mouse_get_position(&scr, NULL, NULL);
+	if (!scr)
+		return FALSE;
+
+	out->x = out->y = 0;
+	if (platform->screen_get_offset)
+		platform->screen_get_offset(scr, &out->x, &out->y);
+	platform->screen_get_dimensions(scr, &out->width, &out->height);
+
+	return out->width > 0 && out->height > 0;
+}
+
+/**
+ * Check if element is actually visible within the clip rectangle
+ * This handles clipping by scrolling containers, the window boundaries
+ * and the monitor
+ *
+ * Takes the element extents the caller already fetched; clip is NULL if
+ * no bounds are known.
+ */
+static gboolean check_is_actually_visible(const AtspiRect *clip, gint elem_x, gint elem_y,
+					  gint elem_w, gint elem_h)
 {
-	gint elem_x, elem_y, elem_w, elem_h;
-	gint win_x, win_y, win_w, win_h;
-	
-	/* Get element coordinates */
-	get_rect(accessible, &elem_x, &elem_y, &elem_w, &elem_h);
 	if (elem_w <= 0 || elem_h <= 0) {
 		return FALSE;
 	}
 	
-	/* Get window coordinates */
-	get_rect(window, &win_x, &win_y, &win_w, &win_h);
-	if (win_w <= 0 || win_h <= 0) {
+	if (!clip) {
 		return TRUE; /* If we can't get window bounds, assume visible */
 	}
+
+	gint win_x = clip->x, win_y = clip->y;
+	gint win_w = clip->width, win_h = clip->height;
 	
 	/* Check if element is completely outside window bounds */
 	if (elem_x >= win_x + win_w ||  /* Element starts after window ends */
@@ -119,44 +375,102 @@ static gboolean check_is_actually_visible(AtspiAccessible *accessible, AtspiAcce
 	/* Require at least 50% of element to be visible, or configurable minimum area */
 	gint visible_area = overlap_w * overlap_h;
 	gint total_area = elem_w * elem_h;
-	gint min_visible_area = 100;  /* Default */
-	
-	/* Get configurable minimum visible area */
-	min_visible_area = config_get_int("ui_min_visible_area");
 	
 	return (visible_area >= total_area / 2) || (visible_area >= min_visible_area);
 }
 
-/* Optimized role validation using hash table for faster lookup */
-static GHashTable *excluded_roles = NULL;
+static gint compare_int(const void *a, const void *b)
+{
+	gint x = *(const gint *)a;
+	gint y = *(const gint *)b;
+
+	return (x > y) - (x < y);
+}
 
-static void init_excluded_roles(void)
+/**
+ * Check if the windows stacked above cover so much of an element that it
+ * no longer counts as visible, by the rule of check_is_actually_visible()
+ *
+ * The covered area is summed over the grid spanned by the edges of the
+ * covered parts, so parts covered by several windows count once.
+ */
+static gboolean is_occluded(gint x, gint y, gint w, gint h)
 {
-	if (excluded_roles)
-		return;
-		
-	excluded_roles = g_hash_table_new(g_str_hash, g_str_equal);
-	g_hash_table_insert(excluded_roles, "panel", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "section", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "html container", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "frame", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "menu bar", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "tool bar", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "list", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "page tab list", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "description list", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "scroll pane", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "table", GINT_TO_POINTER(1));
-	g_hash_table_insert(excluded_roles, "grouping", GINT_TO_POINTER(1));
-}
-
-gboolean validate_role(char *role)
-{
-	if (!role)
+	AtspiRect element = { x, y, w, h };
+	AtspiRect covers[ATSPI_HELPER_MAX_WINDOWS];
+	gint xs[2 * ATSPI_HELPER_MAX_WINDOWS + 2];
+	gint ys[2 * ATSPI_HELPER_MAX_WINDOWS + 2];
+	guint n = 0;
+
+	for (guint i = 0; i < occluder_count; i++) {
+		if (intersect_rect(&element, &occluders[i], &covers[n]))
+			n++;
+	}
+	if (n == 0)
 		return FALSE;
-		
-	init_excluded_roles();
-	return !g_hash_table_contains(excluded_roles, role);
+
+	guint edges = 0;
+	xs[edges] = x;
+	ys[edges++] = y;
+	xs[edges] = x + w;
+	ys[edges++] = y + h;
+	for (guint i = 0; i < n; i++) {
+		xs[edges] = covers[i].x;
+		ys[edges++] = covers[i].y;
+		xs[edges] = covers[i].x + covers[i].width;
+		ys[edges++] = covers[i].y + covers[i].height;
+	}
+	qsort(xs, edges, sizeof(gint), compare_int);
+	qsort(ys, edges, sizeof(gint), compare_int);
+
+	gint covered = 0;
+	for (guint i = 0; i + 1 < edges; i++) {
+		for (guint j = 0; j + 1 < edges; j++) {
+			if (xs[i] == xs[i + 1] || ys[j] == ys[j + 1])
+				continue;
+
+			/* Cells lie between edges, their corner tells if they are covered */
+			for (guint k = 0; k < n; k++) {
+				if (xs[i] >= covers[k].x && xs[i] < covers[k].x + covers[k].width &&
+				    ys[j] >= covers[k].y && ys[j] < covers[k].y + covers[k].height) {
+					covered += (xs[i + 1] - xs[i]) * (ys[j + 1] - ys[j]);
+					break;
+				}
+			}
+		}
+	}
+
+	gint visible = w * h - covered;
+	return visible < w * h / 2 && visible < min_visible_area;
+}
+
+/*
+ * Container roles that never get a hint. The Collection match rule uses
+ * the same set as an inverted (MATCH_NONE) role filter.
+ */
+static const AtspiRole excluded_role_ids[] = {
+	ATSPI_ROLE_PANEL,
+	ATSPI_ROLE_SECTION,
+	ATSPI_ROLE_HTML_CONTAINER,
+	ATSPI_ROLE_FRAME,
+	ATSPI_ROLE_MENU_BAR,
+	ATSPI_ROLE_TOOL_BAR,
+	ATSPI_ROLE_LIST,
+	ATSPI_ROLE_PAGE_TAB_LIST,
+	ATSPI_ROLE_DESCRIPTION_LIST,
+	ATSPI_ROLE_SCROLL_PANE,
+	ATSPI_ROLE_TABLE,
+	ATSPI_ROLE_GROUPING,
+};
+
+gboolean validate_role(AtspiRole role)
+{
+	for (gsize i = 0; i < G_N_ELEMENTS(excluded_role_ids); i++) {
+		if (excluded_role_ids[i] == role)
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 void print_info(ElementInfo *element)
@@ -201,6 +515,13 @@ static void dump_element_tree(AtspiAccessible *node, gint depth, gint max_depth)
 		role ? role : "unknown",
 		name ? name : "",
 		x, y, w, h);
+
+	/* The walker skips nodes that are not showing and visible */
+	AtspiStateSet *states = atspi_accessible_get_state_set(node);
+	if (!states || !check_is_visible(states))
+		fprintf(g_dump_fp, " hidden");
+	if (states)
+		g_object_unref(states);
 	
 	if (desc && desc[0])
 		fprintf(g_dump_fp, " desc='%s'", desc);
@@ -221,119 +542,639 @@ static void dump_element_tree(AtspiAccessible *node, gint depth, gint max_depth)
 	}
 }
 
-static void collect_element_info(AtspiAccessible *accessible, gint depth,
-				 gint x, gint y, gint w, gint h)
+/**
+ * Record the tree of window to the ui_atspi_dump_tree file, if set
+ */
+static void dump_window_tree(AtspiAccessible *window, gint max_depth)
 {
-	gchar *raw_name = atspi_accessible_get_name(accessible, NULL);
-	gchar *label = get_label(accessible);
-	gchar *description = atspi_accessible_get_description(accessible, NULL);
-	
-	static int debug_count = 0;
-	if (debug_count < 5) {
-		// fprintf(stderr, "DEBUG RAW [Linux AT-SPI]: Name='%s' Label='%s' Description='%s'\n",
-		// 	raw_name ? raw_name : "(null)",
-		// 	label ? label : "(null)",
-		// 	description ? description : "(null)");
-		debug_count++;
+	const char *path = config_get("ui_atspi_dump_tree");
+
+	if (!path || !path[0])
+		return;
+
+	g_dump_fp = fopen(path, "w");
+	if (!g_dump_fp) {
+		perror(path);
+		return;
 	}
-	
-	gchar *name = NULL;
-	if (raw_name == NULL || g_strcmp0(raw_name, "") == 0) {
-		name = label ? g_strdup(label) : g_strdup("NULL");
-	} else {
-		name = g_strdup(raw_name);
+
+	dump_element_tree(window, 0, max_depth);
+	fclose(g_dump_fp);
+	g_dump_fp = NULL;
+
+	fprintf(stderr, "AT-SPI: Tree written to %s\n", path);
+}
+
+gchar *atspi_element_name(AtspiAccessible *accessible)
+{
+	gchar *name = atspi_accessible_get_name(accessible, NULL);
+	if (name == NULL || g_strcmp0(name, "") == 0) {
+		/* Fall back to the label only for unnamed elements */
+		gchar *label = get_label(accessible);
+		g_free(name);
+		name = label ? label : g_strdup("NULL");
 	}
 
-	gchar *raw_role = atspi_accessible_get_role_name(accessible, NULL);
-	gchar *role_name = raw_role ? g_strdup(raw_role) : g_strdup("");
-	
-	if (description) g_free(description);
+	return name;
+}
+
+/**
+ * Append to element_list, keeping element_tail and element_count
+ */
+static void element_list_append(ElementInfo *element)
+{
+	GSList *link = g_slist_prepend(NULL, element);
+
+	if (element_tail)
+		element_tail->next = link;
+	else
+		element_list = link;
+	element_tail = link;
+	element_count++;
+}
+
+/**
+ * Collect a node as an element if it is a hint candidate
+ *
+ * Returns TRUE if it was collected.
+ */
+static gboolean collect_element_info(AtspiAccessible *accessible, gint depth,
+				     gint x, gint y, gint w, gint h)
+{
+	/* The role comes from the cache, rejected nodes cost no round trip */
+	AtspiRole role = atspi_accessible_get_role(accessible, NULL);
+	if (!validate_role(role) || x <= 0 || y <= 0)
+		return FALSE;
+
+	/* Hidden behind windows stacked above */
+	if (is_occluded(x, y, w, h))
+		return FALSE;
+
+	gchar *name = lazy_names ? NULL : atspi_element_name(accessible);
+
+	/* Role names come from a small fixed set, all elements share one copy of each */
+	gchar *raw_role = atspi_role_get_name(role);
+	const gchar *role_name = g_intern_string(raw_role ? raw_role : "");
+	g_free(raw_role);
 
-	if (validate_role(role_name) && x > 0 && y > 0) {
-		ElementInfo *element = g_new0(ElementInfo, 1);
-		element->x = x;
-		element->y = y;
-		element->w = w;
-		element->h = h;
-		element->name = name;
-		element->role = role_name;
-		element->depth = depth;
-		element_list = g_slist_append(element_list, element);
+	ElementInfo *element = g_new0(ElementInfo, 1);
+	element->x = x;
+	element->y = y;
+	element->w = w;
+	element->h = h;
+	element->name = name;
+	element->role = role_name;
+	element->depth = depth;
+	element->node = g_object_ref(accessible);
+	element_list_append(element);
+
+	if (element_sink && ++stream_pending >= STREAM_BATCH_SIZE)
+		stream_flush();
+
+	return TRUE;
+}
+
+/*
+ * Best-first walk: visible nodes wait in a priority queue and the most
+ * promising one is expanded next, so when ui_max_elements is reached the
+ * budget went to likely targets (toolbars, buttons, links) rather than to
+ * whatever a depth-first walk happened to be inside of. The weights are
+ * in atspi-walk.h, bench/walk_recall.c measures them on recorded trees.
+ */
+
+typedef struct {
+	AtspiAccessible *node; /* Referenced */
+	gint depth;
+	gint x, y, w, h;
+	const AtspiRect *clip; /* NULL, or points into clips */
+	gint score;
+	guint order;           /* Insertion order, breaks ties */
+	gint parent;           /* WalkRecord of the parent, -1 if not tracked */
+	guint64 path;          /* Role path from the root */
+} WalkEntry;
+
+/*
+ * A node whose children were queued. Records are only kept when the
+ * skip-list learns from the walk: once the walk ends, a record without
+ * pending descendants describes a completely walked subtree.
+ */
+typedef struct {
+	gint parent;           /* Index of the parent's record, -1 for the root */
+	guint64 signature;
+	guint nodes;           /* Nodes visited in the subtree */
+	guint candidates;      /* Of those, collected as elements */
+	guint pending;         /* Descendants still queued */
+	gboolean truncated;    /* Some descendants were never fetched */
+} WalkRecord;
+
+typedef struct {
+	GArray *heap;          /* WalkEntry, highest score first */
+	GPtrArray *clips;      /* AtspiRect clip rectangles of scroll panes */
+	guint next_order;
+} WalkQueue;
+
+/**
+ * How likely a node is a target, or contains targets (0-2)
+ */
+static gint role_interactivity(AtspiRole role)
+{
+	switch (role) {
+	case ATSPI_ROLE_PUSH_BUTTON:
+	case ATSPI_ROLE_TOGGLE_BUTTON:
+	case ATSPI_ROLE_CHECK_BOX:
+	case ATSPI_ROLE_RADIO_BUTTON:
+	case ATSPI_ROLE_LINK:
+	case ATSPI_ROLE_MENU_ITEM:
+	case ATSPI_ROLE_CHECK_MENU_ITEM:
+	case ATSPI_ROLE_RADIO_MENU_ITEM:
+	case ATSPI_ROLE_PAGE_TAB:
+	case ATSPI_ROLE_ENTRY:
+	case ATSPI_ROLE_PASSWORD_TEXT:
+	case ATSPI_ROLE_COMBO_BOX:
+	case ATSPI_ROLE_SPIN_BUTTON:
+	case ATSPI_ROLE_SLIDER:
+		return 2;
+	case ATSPI_ROLE_TOOL_BAR:
+	case ATSPI_ROLE_MENU_BAR:
+	case ATSPI_ROLE_MENU:
+	case ATSPI_ROLE_PAGE_TAB_LIST:
+		return 1;
+	default:
+		return 0;
 	}
 }
 
-static void dump_node_content(AtspiAccessible *node, gint dept, gint max_depth, gint max_elements, AtspiAccessible *window)
+/**
+ * Roles whose children are never targets of their own
+ */
+static gboolean is_leaf_role(AtspiRole role)
 {
-	AtspiAccessible *inner_node = NULL;
-	gint c;
-	gint x = -1, y = -1, w = -1, h = -1;
+	switch (role) {
+	case ATSPI_ROLE_PUSH_BUTTON:
+	case ATSPI_ROLE_TOGGLE_BUTTON:
+	case ATSPI_ROLE_CHECK_BOX:
+	case ATSPI_ROLE_RADIO_BUTTON:
+	case ATSPI_ROLE_MENU_ITEM:
+	case ATSPI_ROLE_CHECK_MENU_ITEM:
+	case ATSPI_ROLE_RADIO_MENU_ITEM:
+	case ATSPI_ROLE_ENTRY:
+	case ATSPI_ROLE_PASSWORD_TEXT:
+	case ATSPI_ROLE_SLIDER:
+	case ATSPI_ROLE_SCROLL_BAR:
+	case ATSPI_ROLE_PROGRESS_BAR:
+	case ATSPI_ROLE_SEPARATOR:
+	case ATSPI_ROLE_ICON:
+	case ATSPI_ROLE_IMAGE:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
 
-	if (node == NULL || dept > max_depth) {
-		return;
+/**
+ * Score a node by role, depth and (logarithmic) visible area
+ */
+static gint walk_score(AtspiRole role, gint depth, const WalkEntry *entry)
+{
+	AtspiRect bounds = { entry->x, entry->y, entry->w, entry->h };
+	AtspiRect visible = bounds;
+
+	if (entry->clip && !intersect_rect(entry->clip, &bounds, &visible))
+		visible.width = visible.height = 0;
+
+	return atspi_walk_score(role_interactivity(role), depth,
+				(gulong)visible.width * (gulong)visible.height);
+}
+
+static gboolean walk_before(const WalkEntry *a, const WalkEntry *b)
+{
+	return a->score > b->score || (a->score == b->score && a->order < b->order);
+}
+
+static void walk_push(WalkQueue *queue, WalkEntry *entry)
+{
+	entry->order = queue->next_order++;
+	g_array_append_val(queue->heap, *entry);
+
+	WalkEntry *heap = (WalkEntry *)queue->heap->data;
+	guint i = queue->heap->len - 1;
+	while (i > 0 && walk_before(&heap[i], &heap[(i - 1) / 2])) {
+		WalkEntry tmp = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
 	}
-	
-	/* Track maximum depth actually reached */
-	if (dept > max_depth_reached) {
-		max_depth_reached = dept;
+}
+
+static WalkEntry walk_pop(WalkQueue *queue)
+{
+	WalkEntry *heap = (WalkEntry *)queue->heap->data;
+	WalkEntry top = heap[0];
+	guint len = queue->heap->len - 1;
+
+	heap[0] = heap[len];
+	g_array_set_size(queue->heap, len);
+
+	guint i = 0;
+	for (;;) {
+		guint best = i;
+		guint l = 2 * i + 1, r = 2 * i + 2;
+
+		if (l < len && walk_before(&heap[l], &heap[best]))
+			best = l;
+		if (r < len && walk_before(&heap[r], &heap[best]))
+			best = r;
+		if (best == i)
+			break;
+
+		WalkEntry tmp = heap[i];
+		heap[i] = heap[best];
+		heap[best] = tmp;
+		i = best;
 	}
-	
-	/* Early termination if we have enough elements */
-	if (g_slist_length(element_list) >= max_elements) {
-		return;
+
+	return top;
+}
+
+/**
+ * Queue a node if it is visible within clip
+ *
+ * parent and parent_path describe the node's parent (-1 and 0 for the
+ * root). Returns TRUE if the node was queued.
+ */
+static gboolean walk_offer(WalkQueue *queue, AtspiAccessible *node, gint depth,
+			   gint max_depth, const AtspiRect *clip,
+			   gint parent, guint64 parent_path)
+{
+	WalkEntry entry = { NULL, depth, -1, -1, -1, -1, clip, 0, 0, parent, 0 };
+
+	if (node == NULL || depth > max_depth) {
+		return FALSE;
 	}
 
 	AtspiStateSet *states = atspi_accessible_get_state_set(node);
 	if (states == NULL) {
-		return;
+		return FALSE;
 	}
 
 	gboolean is_visible = check_is_visible(states);
 	g_object_unref(states);
 	if (!is_visible) {
-		return;
+		return FALSE;
 	}
 	
-	/* Additional check for actual visibility within window bounds */
-	if (!check_is_actually_visible(node, window)) {
+	get_rect(node, &entry.x, &entry.y, &entry.w, &entry.h);
+
+	/* Additional check for actual visibility within the clip rectangle */
+	if (!check_is_actually_visible(clip, entry.x, entry.y, entry.w, entry.h)) {
 		/* Uncomment for debugging clipped elements:
-		gint x, y, w, h;
-		get_rect(node, &x, &y, &w, &h);
-		fprintf(stderr, "AT-SPI: Skipping clipped element at (%d,%d) %dx%d\n", x, y, w, h);
+		fprintf(stderr, "AT-SPI: Skipping clipped element at (%d,%d) %dx%d\n",
+			entry.x, entry.y, entry.w, entry.h);
 		*/
-		return;
+		return FALSE;
 	}
 
-	get_rect(node, &x, &y, &w, &h);
-	if (x == -1 && y == -1 && w == -1 && h == -1)
-		return;
+	/* The role comes from the cache */
+	AtspiRole role = atspi_accessible_get_role(node, NULL);
+	entry.score = walk_score(role, depth, &entry);
+	entry.path = atspi_barren_path(parent_path, role);
+	entry.node = g_object_ref(node);
+	walk_push(queue, &entry);
 
-	collect_element_info(node, dept, x, y, w, h);
+	return TRUE;
+}
 
-	for (c = 0; c < atspi_accessible_get_child_count(node, NULL); c++) {
-		/* Early termination check */
-		if (g_slist_length(element_list) >= max_elements) {
+/**
+ * Add to the counters of record and all its ancestors
+ */
+static void walk_account(GArray *records, gint record, gint nodes, gint candidates,
+			 gint pending)
+{
+	for (; record >= 0; record = g_array_index(records, WalkRecord, record).parent) {
+		WalkRecord *r = &g_array_index(records, WalkRecord, record);
+		r->nodes += nodes;
+		r->candidates += candidates;
+		r->pending += pending;
+	}
+}
+
+/**
+ * Mark record and its ancestors as not completely walked
+ */
+static void walk_truncate(GArray *records, gint record)
+{
+	for (; record >= 0; record = g_array_index(records, WalkRecord, record).parent)
+		g_array_index(records, WalkRecord, record).truncated = TRUE;
+}
+
+/**
+ * Walk the visible subtree of node best-first until max_elements elements
+ * are collected
+ */
+static void dump_node_content(AtspiAccessible *node, gint dept, gint max_depth, gint max_elements,
+			      AtspiAccessible *window, const AtspiRect *clip)
+{
+	WalkQueue queue;
+	AtspiBarrenTable *barren = NULL;
+	GArray *records = NULL;
+
+	queue.heap = g_array_new(FALSE, FALSE, sizeof(WalkEntry));
+	queue.clips = g_ptr_array_new_with_free_func(g_free);
+	queue.next_order = 0;
+
+	/* Only walks from the window down have comparable role paths */
+	if (skip_barren && dept == 0 && window)
+		barren = atspi_barren_table(((AtspiObject *)window)->app);
+	if (barren)
+		records = g_array_new(FALSE, FALSE, sizeof(WalkRecord));
+
+	if (!deadline_reached())
+		walk_offer(&queue, node, dept, max_depth, clip, -1, 0);
+
+	while (queue.heap->len > 0) {
+		/* Early termination if we have enough elements */
+		if (element_count >= (guint)max_elements || deadline_reached()) {
 			break;
 		}
-		
-		inner_node = atspi_accessible_get_child_at_index(node, c, NULL);
-		dump_node_content(inner_node, dept + 1, max_depth, max_elements, window);
-		g_object_unref(inner_node);
+
+		WalkEntry entry = walk_pop(&queue);
+
+		/* Track maximum depth actually reached */
+		if (entry.depth > max_depth_reached) {
+			max_depth_reached = entry.depth;
+		}
+
+		gboolean collected = collect_element_info(entry.node, entry.depth, entry.x,
+							  entry.y, entry.w, entry.h);
+		if (records)
+			walk_account(records, entry.parent, 1, collected, -1);
+
+		/* The children of a button or a slider are never targets */
+		AtspiRole role = atspi_accessible_get_role(entry.node, NULL);
+		if (is_leaf_role(role)) {
+			g_object_unref(entry.node);
+			continue;
+		}
+
+		/* Children of scrolling containers are clipped to the visible part */
+		const AtspiRect *child_clip = entry.clip;
+		if (child_clip && clips_children(role)) {
+			AtspiRect bounds = { entry.x, entry.y, entry.w, entry.h };
+			AtspiRect *clipped = g_new(AtspiRect, 1);
+
+			if (!intersect_rect(child_clip, &bounds, clipped)) {
+				g_free(clipped);
+				pruned_subtrees++;
+				g_object_unref(entry.node);
+				continue;
+			}
+			g_ptr_array_add(queue.clips, clipped);
+			child_clip = clipped;
+		}
+
+		round_trips++;
+		gint child_count = atspi_accessible_get_child_count(entry.node, NULL);
+
+		gint record = -1;
+		if (records && child_count > 0) {
+			guint64 signature = atspi_barren_signature(entry.path, child_count);
+
+			if (atspi_barren_skip(barren, signature)) {
+				/* The ancestors did not see this subtree, they learn nothing */
+				barren_skipped++;
+				walk_truncate(records, entry.parent);
+				g_object_unref(entry.node);
+				continue;
+			}
+
+			WalkRecord r = { entry.parent, signature, 1, collected, 0, FALSE };
+			g_array_append_val(records, r);
+			record = records->len - 1;
+		}
+
+		GPtrArray *children = g_ptr_array_new_with_free_func(g_object_unref);
+		for (gint c = 0; c < child_count; c++) {
+			if (deadline_reached()) {
+				if (records)
+					walk_truncate(records, record >= 0 ? record : entry.parent);
+				break;
+			}
+
+			round_trips++;
+			AtspiAccessible *child = atspi_accessible_get_child_at_index(entry.node, c, NULL);
+			if (child) {
+				g_ptr_array_add(children, child);
+			}
+		}
+
+		/* Children below max_depth are dropped, not seen */
+		if (record >= 0 && entry.depth >= max_depth)
+			walk_truncate(records, record);
+
+		/* Ask for the extents of all children at once */
+		prefetch_extents((AtspiAccessible **)children->pdata, children->len);
+
+		for (guint c = 0; c < children->len; c++) {
+			if (walk_offer(&queue, children->pdata[c], entry.depth + 1, max_depth,
+				       child_clip, record, entry.path) && record >= 0)
+				walk_account(records, record, 0, 0, 1);
+		}
+		g_ptr_array_free(children, TRUE);
+
+		g_object_unref(entry.node);
+	}
+
+	/* Nodes left over when the budget ran out */
+	for (guint i = 0; i < queue.heap->len; i++)
+		g_object_unref(g_array_index(queue.heap, WalkEntry, i).node);
+
+	/* Learn from the subtrees that were walked completely */
+	if (records) {
+		for (guint i = 0; i < records->len; i++) {
+			WalkRecord *r = &g_array_index(records, WalkRecord, i);
+			if (r->pending == 0 && !r->truncated)
+				atspi_barren_observe(barren, r->signature, r->nodes, r->candidates);
+		}
+		g_array_free(records, TRUE);
+	}
+
+	g_array_free(queue.heap, TRUE);
+	g_ptr_array_free(queue.clips, TRUE);
+}
+
+/**
+ * Build the Collection match rule: showing and visible elements whose role
+ * is not one of the excluded container roles.
+ */
+static AtspiMatchRule *create_match_rule(void)
+{
+	GArray *states = g_array_new(FALSE, FALSE, sizeof(AtspiStateType));
+	AtspiStateType showing = ATSPI_STATE_SHOWING;
+	AtspiStateType visible = ATSPI_STATE_VISIBLE;
+	g_array_append_val(states, showing);
+	g_array_append_val(states, visible);
+
+	AtspiStateSet *state_set = atspi_state_set_new(states);
+	g_array_free(states, TRUE);
+
+	GArray *roles = g_array_new(FALSE, FALSE, sizeof(AtspiRole));
+	for (gsize i = 0; i < G_N_ELEMENTS(excluded_role_ids); i++)
+		g_array_append_val(roles, excluded_role_ids[i]);
+
+	AtspiMatchRule *rule = atspi_match_rule_new(
+	    state_set, ATSPI_Collection_MATCH_ALL,
+	    NULL, ATSPI_Collection_MATCH_ALL,
+	    roles, ATSPI_Collection_MATCH_NONE,
+	    NULL, ATSPI_Collection_MATCH_ALL,
+	    FALSE);
+
+	g_object_unref(state_set);
+	g_array_free(roles, TRUE);
+
+	return rule;
+}
+
+/*
+ * GetMatches count asking for every match. The server truncates in
+ * document order before extents are known, so a bounded count would
+ * spend the budget on nodes that are showing but scrolled away.
+ */
+#define COLLECTION_ALL_MATCHES 0
+
+typedef struct {
+	AtspiAccessible *node;
+	gint x, y, w, h;
+	gint score;
+	guint order;
+} RankedMatch;
+
+static gint compare_ranked(gconstpointer a, gconstpointer b)
+{
+	const RankedMatch *ra = a, *rb = b;
+
+	if (ra->score != rb->score)
+		return ra->score > rb->score ? -1 : 1;
+	return ra->order < rb->order ? -1 : ra->order > rb->order;
+}
+
+/**
+ * Collect the visible nodes among the candidates a Collection query
+ * returned, best first (same scoring as the walker, at depth 0) when
+ * there are more than max_elements of them
+ */
+static void collect_matches(AtspiAccessible **nodes, guint count, gint max_elements)
+{
+	if (element_count >= (guint)max_elements)
+		return;
+
+	prefetch_extents(nodes, count);
+
+	GArray *ranked = g_array_sized_new(FALSE, FALSE, sizeof(RankedMatch), count);
+
+	for (guint i = 0; i < count && !deadline_reached(); i++) {
+		gint x = -1, y = -1, w = -1, h = -1;
+
+		get_rect(nodes[i], &x, &y, &w, &h);
+		if (!check_is_actually_visible(root_clip_valid ? &root_clip : NULL, x, y, w, h))
+			continue;
+
+		AtspiRect bounds = { x, y, w, h };
+		AtspiRect visible = bounds;
+		if (root_clip_valid && !intersect_rect(&root_clip, &bounds, &visible))
+			visible.width = visible.height = 0;
+
+		AtspiRole role = atspi_accessible_get_role(nodes[i], NULL);
+		RankedMatch match = {
+			.node = nodes[i],
+			.x = x, .y = y, .w = w, .h = h,
+			.score = atspi_walk_score(role_interactivity(role), 0,
+						  (gulong)visible.width * (gulong)visible.height),
+			.order = i,
+		};
+		g_array_append_val(ranked, match);
+	}
+
+	g_array_sort(ranked, compare_ranked);
+
+	for (guint i = 0; i < ranked->len && element_count < (guint)max_elements; i++) {
+		RankedMatch *match = &g_array_index(ranked, RankedMatch, i);
+		collect_element_info(match->node, 0, match->x, match->y, match->w, match->h);
+	}
+
+	g_array_free(ranked, TRUE);
+}
+
+/**
+ * Collect candidate elements through the Collection interface
+ *
+ * The registry evaluates the match rule on the application side and returns
+ * all candidates in a single reply, instead of one round trip per node and
+ * property as in dump_node_content(). Only extents and names are fetched
+ * per candidate afterwards.
+ *
+ * Returns FALSE if the toolkit does not implement Collection (or the call
+ * failed), in which case the caller falls back to the recursive walker.
+ */
+static gboolean collect_with_collection(AtspiAccessible *window, gint max_elements)
+{
+	AtspiCollection *collection = atspi_accessible_get_collection_iface(window);
+	if (!collection)
+		return FALSE;
+
+	guint before = element_count;
+	AtspiMatchRule *rule = create_match_rule();
+	GError *error = NULL;
+	round_trips++;
+	GArray *matches = atspi_collection_get_matches(
+	    collection, rule, ATSPI_Collection_SORT_ORDER_CANONICAL,
+	    COLLECTION_ALL_MATCHES, TRUE, &error);
+
+	g_object_unref(rule);
+	g_object_unref(collection);
+
+	if (!matches) {
+		fprintf(stderr, "AT-SPI: Collection query failed (%s), using tree walker\n",
+		        error ? error->message : "unknown error");
+		g_clear_error(&error);
+		return FALSE;
 	}
+
+	collect_matches((AtspiAccessible **)matches->data, matches->len, max_elements);
+
+	for (guint i = 0; i < matches->len; i++)
+		g_object_unref(g_array_index(matches, AtspiAccessible *, i));
+	g_array_free(matches, TRUE);
+
+	/* An empty reply is treated like a missing implementation */
+	return element_count > before;
+}
+
+ElementInfo *element_info_dup(const ElementInfo *element)
+{
+	ElementInfo *copy = g_new0(ElementInfo, 1);
+	*copy = *element;
+	copy->name = g_strdup(element->name);
+	if (copy->node)
+		g_object_ref(copy->node);
+	return copy;
 }
 
-static void free_element(ElementInfo *element)
+void element_info_free(ElementInfo *element)
 {
 	if (!element)
 		return;
 	g_free(element->name);
-	g_free(element->role);
+	if (element->node)
+		g_object_unref(element->node);
 	g_free(element);
 }
 
 static void free_element_list()
 {
-	g_slist_free_full(element_list, (GDestroyNotify)free_element);
+	g_slist_free_full(element_list, (GDestroyNotify)element_info_free);
 	element_list = NULL;
+	element_tail = NULL;
+	element_count = 0;
 }
 
 static AtspiAccessible *get_active_window(void)
@@ -342,11 +1183,29 @@ static AtspiAccessible *get_active_window(void)
 	AtspiAccessible *desktop = NULL;
 	AtspiAccessible *active_window = NULL;
 
+	/* Window reported by window:activate, if it is still the active one */
+	active_window = atspi_cache_ref_active_window();
+	if (active_window) {
+		AtspiStateSet *states = atspi_accessible_get_state_set(active_window);
+		gboolean active = states && atspi_state_set_contains(states, ATSPI_STATE_ACTIVE);
+
+		if (states)
+			g_object_unref(states);
+		if (active)
+			return active_window;
+
+		g_object_unref(active_window);
+		active_window = NULL;
+	}
+
 	desktop = atspi_get_desktop(0);
 	if (!desktop)
 		return NULL;
 
 	for (i = 0; i < atspi_accessible_get_child_count(desktop, NULL); i++) {
+		if (deadline_reached())
+			break;
+
 		AtspiAccessible *app =
 		    atspi_accessible_get_child_at_index(desktop, i, NULL);
 		if (!app)
@@ -417,6 +1276,8 @@ void deduplicate_elements_by_position(GSList **element_list_ptr)
 					GUINT_TO_POINTER(pos_key)) == element) {
 			last_occurrence_map =
 			    g_slist_append(last_occurrence_map, element);
+		} else {
+			element_info_free(element);
 		}
 	}
 
@@ -427,30 +1288,537 @@ void deduplicate_elements_by_position(GSList **element_list_ptr)
 	g_hash_table_destroy(position_map);
 }
 
-void atspi_init_detector(void) { atspi_init(); }
+void atspi_init_detector(void)
+{
+	atspi_init();
+	atspi_cache_init();
+
+	/*
+	 * Bound every synchronous D-Bus call so a single hung application
+	 * cannot stall detection for libatspi's default 25s. The per-call
+	 * timeout never exceeds the overall detection budget.
+	 */
+	gint call_timeout = config_get_int("ui_atspi_call_timeout");
+	gint budget = config_get_int("ui_detection_timeout");
+	if (budget > 0 && (call_timeout <= 0 || call_timeout > budget))
+		call_timeout = budget;
+	if (call_timeout > 0)
+		atspi_set_timeout(call_timeout, call_timeout);
+}
 
 void free_detector_resources(void) 
 { 
 	free_element_list(); 
-	
-	/* Cleanup hash table */
-	if (excluded_roles) {
-		g_hash_table_destroy(excluded_roles);
-		excluded_roles = NULL;
-	}
+}
+
+gint atspi_max_depth_reached(void)
+{
+	return max_depth_reached;
 }
 
 void atspi_cleanup(void)
 {
 	fprintf(stderr, "AT-SPI: Cleaning up resources\n");
 	free_detector_resources();
+	atspi_cache_cleanup();
+	atspi_barren_cleanup();
+	atspi_transport_cleanup();
 }
 
-GSList *detect_elements()
+/**
+ * Bring the cached elements of a window up to date
+ *
+ * Only the subtrees reported dirty by AT-SPI events since the last
+ * activation are walked again. Returns FALSE if the window needs a full
+ * traversal instead.
+ */
+static gboolean revalidate_cache(AtspiWindowCache *cache, AtspiAccessible *window,
+				 gint max_depth, gint max_elements)
 {
-	AtspiAccessible *active_window = get_active_window();
-	if (!active_window) {
-		fprintf(stderr, "Warning: No active window found for smart hint detection\n");
+	GArray *roots = atspi_cache_take_dirty(cache);
+	if (!roots) {
+		atspi_cache_drop(window);
+		return FALSE;
+	}
+
+	fprintf(stderr, "AT-SPI: Reusing cached elements (%u dirty subtrees)\n", roots->len);
+
+	/*
+	 * The re-walked elements are streamed together with the cached ones.
+	 * The scrolling ancestors of a dirty root are not known here, its
+	 * subtree is clipped by the root clip rectangle only.
+	 *
+	 * All re-walks share one budget: together with the cached elements
+	 * they stay within max_elements.
+	 */
+	gint budget = max_elements - (gint)atspi_cache_count(cache);
+	gboolean exhausted = FALSE;
+
+	stream_paused = TRUE;
+	for (guint i = 0; i < roots->len && !exhausted; i++) {
+		AtspiDirtyRoot *root = &g_array_index(roots, AtspiDirtyRoot, i);
+
+		if (budget > 0)
+			dump_node_content(root->node, root->depth, max_depth, budget, window,
+					  root_clip_valid ? &root_clip : NULL);
+		exhausted = budget <= 0 || element_count >= (guint)budget;
+	}
+	atspi_cache_free_dirty(roots);
+
+	/* The cache takes the re-walked elements, the caller gets copies */
+	for (GSList *it = element_list; it; it = it->next)
+		atspi_cache_add(cache, it->data);
+	g_slist_free(element_list);
+	element_list = atspi_cache_copy_elements(cache);
+	element_tail = g_slist_last(element_list);
+	element_count = g_slist_length(element_list);
+
+	stream_paused = FALSE;
+	stream_last = NULL;
+	stream_pending = element_count;
+
+	/* A re-walk cut short by the deadline or the budget leaves the cache incomplete */
+	if (traversal_timed_out || exhausted)
+		atspi_cache_drop(window);
+
+	return TRUE;
+}
+
+/**
+ * Let libatspi keep the properties of app
+ *
+ * Without the cache's event listeners nothing updates them between
+ * detections, so what libatspi kept from the last one is dropped.
+ */
+static void set_prefetch_mask(AtspiAccessible *app)
+{
+	if (!atspi_cache_enabled())
+		atspi_accessible_clear_cache(app);
+	atspi_accessible_set_cache_mask(app, PREFETCH_CACHE_MASK);
+}
+
+/**
+ * Set the prefetch cache mask on the application of a window and query it
+ * over a direct connection where possible
+ */
+static void prefetch_application(AtspiAccessible *window)
+{
+	atspi_transport_attach(window);
+
+	/* Cache role, name and states of the window's application */
+	AtspiAccessible *app = atspi_accessible_get_application(window, NULL);
+	if (app) {
+		set_prefetch_mask(app);
+		g_object_unref(app);
+	}
+}
+
+/**
+ * Describe the per-call latency of the direct connection used for node
+ * (empty if its calls go through the bus daemon)
+ */
+static void describe_transport(AtspiAccessible *node, gchar *buf, gsize size)
+{
+	gdouble bus_ms, direct_ms;
+
+	if (node && atspi_transport_latency(node, &bus_ms, &direct_ms))
+		g_snprintf(buf, size, ", direct: %.3f ms/call vs %.3f ms via bus",
+			   direct_ms, bus_ms);
+	else
+		buf[0] = '\0';
+}
+
+/**
+ * Collect the elements of the active window, returns the engine used
+ */
+static const char *collect_window(AtspiAccessible *active_window, gint max_depth,
+				  gint max_elements)
+{
+	prefetch_application(active_window);
+	dump_window_tree(active_window, max_depth);
+
+	AtspiRect extents = { -1, -1, -1, -1 };
+	get_rect(active_window, &extents.x, &extents.y, &extents.width, &extents.height);
+
+	/* Nothing outside the window or off the hint monitor can get a hint */
+	AtspiRect monitor;
+	gboolean window_known = extents.width > 0 && extents.height > 0;
+	gboolean monitor_known = get_monitor_rect(&monitor);
+	root_clip_valid = window_known || monitor_known;
+	if (window_known && monitor_known) {
+		/* A window entirely on another monitor keeps its own bounds */
+		if (!intersect_rect(&extents, &monitor, &root_clip))
+			root_clip = extents;
+	} else {
+		root_clip = window_known ? extents : monitor;
+	}
+
+	/*
+	 * The cache is keyed by the clip rectangle rather than the window
+	 * extents, elements clipped away for one monitor are missing for
+	 * another.
+	 */
+	const char *engine = "cache";
+	AtspiWindowCache *cache = atspi_cache_lookup(active_window, &root_clip);
+
+	if (!cache || !revalidate_cache(cache, active_window, max_depth, max_elements)) {
+		/* Prefer the bulk Collection query, walk the tree only as a fallback */
+		engine = "collection";
+		if (!collect_with_collection(active_window, max_elements)) {
+			engine = "walker";
+			dump_node_content(active_window, 0, max_depth, max_elements, active_window,
+					  root_clip_valid ? &root_clip : NULL);
+		}
+
+		if (traversal_timed_out)
+			atspi_cache_drop(active_window);
+		else
+			atspi_cache_store(active_window, &root_clip, element_list);
+	}
+
+	return engine;
+}
+
+/* A visible top-level window in desktop scope */
+typedef struct {
+	AtspiAccessible *window; /* Referenced */
+	gchar *app_name;
+	AtspiRect extents;
+	AtspiRect clip;          /* Window extents on the hint monitor */
+	gboolean active;
+	gint layer;              /* Index in the stacking order, -1 if unknown */
+} DesktopWindow;
+
+static void desktop_window_free(gpointer data)
+{
+	DesktopWindow *dw = data;
+
+	g_object_unref(dw->window);
+	g_free(dw->app_name);
+	g_free(dw);
+}
+
+/**
+ * List the visible top-level windows on the hint monitor, the active
+ * window first
+ */
+static GPtrArray *list_desktop_windows(void)
+{
+	GPtrArray *windows = g_ptr_array_new_with_free_func(desktop_window_free);
+	AtspiAccessible *desktop = atspi_get_desktop(0);
+	AtspiRect monitor;
+	gboolean monitor_known = get_monitor_rect(&monitor);
+
+	if (!desktop)
+		return windows;
+
+	round_trips++;
+	gint app_count = atspi_accessible_get_child_count(desktop, NULL);
+	for (gint i = 0; i < app_count && !deadline_reached(); i++) {
+		round_trips++;
+		AtspiAccessible *app = atspi_accessible_get_child_at_index(desktop, i, NULL);
+		if (!app)
+			continue;
+
+		atspi_transport_attach(app);
+		set_prefetch_mask(app);
+
+		round_trips++;
+		gint window_count = atspi_accessible_get_child_count(app, NULL);
+		for (gint j = 0; j < window_count; j++) {
+			round_trips++;
+			AtspiAccessible *window = atspi_accessible_get_child_at_index(app, j, NULL);
+			if (!window)
+				continue;
+
+			AtspiStateSet *states = atspi_accessible_get_state_set(window);
+			gboolean shown = states && check_is_visible(states) &&
+					 !atspi_state_set_contains(states, ATSPI_STATE_ICONIFIED);
+			gboolean active = states && atspi_state_set_contains(states, ATSPI_STATE_ACTIVE);
+			if (states)
+				g_object_unref(states);
+
+			AtspiRect extents = { -1, -1, -1, -1 };
+			AtspiRect clip;
+			if (shown)
+				get_rect(window, &extents.x, &extents.y, &extents.width, &extents.height);
+
+			/* Windows off the hint monitor cannot get hints */
+			if (shown && extents.width > 0 && extents.height > 0 &&
+			    (!monitor_known || intersect_rect(&extents, &monitor, &clip))) {
+				DesktopWindow *dw = g_new0(DesktopWindow, 1);
+				dw->window = g_object_ref(window);
+				dw->app_name = atspi_accessible_get_name(app, NULL);
+				dw->extents = extents;
+				dw->clip = monitor_known ? clip : extents;
+				dw->active = active;
+
+				g_ptr_array_add(windows, dw);
+				if (active && windows->len > 1) {
+					windows->pdata[windows->len - 1] = windows->pdata[0];
+					windows->pdata[0] = dw;
+				}
+			}
+
+			g_object_unref(window);
+		}
+
+		g_object_unref(app);
+	}
+
+	g_object_unref(desktop);
+	return windows;
+}
+
+/* The windows of a desktop scope detection and their stacking order */
+typedef struct {
+	GPtrArray *windows;       /* DesktopWindow */
+	gboolean *queried;        /* Per window, its query came back (warm tree) */
+	gboolean *collected;      /* Per window, its elements collected from the reply */
+	const DesktopWindow *active;
+	struct window_frame frames[ATSPI_HELPER_MAX_WINDOWS];
+	guint frame_count;        /* Bottom first, 0 if unknown */
+	gint max_elements;
+	gint64 start;
+} DesktopPass;
+
+/**
+ * Get the stacking order of the top-level windows, bottom first
+ *
+ * The detector helper has no platform, the daemon tells it the order.
+ */
+static guint get_window_stacking(struct window_frame *frames)
+{
+	if (!platform)
+		return atspi_helper_stacking(frames, ATSPI_HELPER_MAX_WINDOWS);
+	if (!platform->window_stacking)
+		return 0;
+
+	return platform->window_stacking(frames, ATSPI_HELPER_MAX_WINDOWS);
+}
+
+/**
+ * Find the window of the stacking order whose frame overlaps extents the
+ * most, -1 if none covers at least half of the larger of the two
+ */
+static gint find_layer(const AtspiRect *extents, const struct window_frame *frames,
+		       guint count)
+{
+	gint64 best = 0;
+	gint layer = -1;
+
+	for (guint i = 0; i < count; i++) {
+		AtspiRect frame = { frames[i].x, frames[i].y, frames[i].w, frames[i].h };
+		AtspiRect common;
+
+		if (!intersect_rect(extents, &frame, &common))
+			continue;
+
+		gint64 area = (gint64)common.width * common.height;
+		gint64 larger = MAX((gint64)extents->width * extents->height,
+				    (gint64)frame.width * frame.height);
+
+		/* Ties go to the topmost */
+		if (area * 2 >= larger && area >= best) {
+			best = area;
+			layer = i;
+		}
+	}
+
+	return layer;
+}
+
+/**
+ * Prepare the walk of dw: clip to it, and drop what the windows stacked
+ * above it cover. Without a stacking order only the active window is
+ * known to be on top.
+ */
+static void begin_desktop_window(const DesktopPass *pass, const DesktopWindow *dw)
+{
+	root_clip = dw->clip;
+	root_clip_valid = TRUE;
+
+	occluder_count = 0;
+	if (dw->layer >= 0) {
+		for (guint i = dw->layer + 1; i < pass->frame_count; i++) {
+			const struct window_frame *frame = &pass->frames[i];
+			AtspiRect *occluder = &occluders[occluder_count++];
+
+			occluder->x = frame->x;
+			occluder->y = frame->y;
+			occluder->width = frame->w;
+			occluder->height = frame->h;
+		}
+	} else if (pass->active && pass->active != dw) {
+		occluders[occluder_count++] = pass->active->extents;
+	}
+}
+
+static void log_desktop_window(const DesktopWindow *dw, guint collected, gint64 start,
+			       const char *how)
+{
+	gchar transport[96];
+
+	describe_transport(dw->window, transport, sizeof(transport));
+	fprintf(stderr, "AT-SPI: %s: %u elements in %.2f ms (%s)%s%s\n",
+		dw->app_name ? dw->app_name : "unknown", collected,
+		(g_get_monotonic_time() - start) / 1000.0, how, transport,
+		slice_expired ? " (out of time)" : "");
+}
+
+static void collect_desktop_matches(guint index, GPtrArray *matches, gboolean cold,
+				    gpointer data)
+{
+	DesktopPass *pass = data;
+	DesktopWindow *dw = pass->windows->pdata[index];
+	guint before = element_count;
+
+	/*
+	 * A cold tree is asked again through libatspi, which makes the nodes;
+	 * otherwise asking again would get the same answer and the window is
+	 * walked instead
+	 */
+	pass->queried[index] = !cold;
+	if (!matches)
+		return;
+
+	/* An empty reply is treated like a missing implementation */
+	pass->collected[index] = matches->len > 0;
+	if (pass->collected[index]) {
+		begin_desktop_window(pass, dw);
+		collect_matches((AtspiAccessible **)matches->pdata, matches->len,
+				pass->max_elements);
+		log_desktop_window(dw, element_count - before, pass->start, "concurrent query");
+	}
+
+	g_ptr_array_free(matches, TRUE);
+}
+
+/**
+ * Collect the elements of every visible top-level window on the hint
+ * monitor, returns the engine used
+ *
+ * All applications get their Collection query at once and work on them
+ * in parallel; the replies are taken in order, the active window first.
+ * Only replies naming nodes libatspi already holds can be used: on a
+ * cold tree (the first activation) the window is asked again through
+ * atspi_collection_get_matches(), which makes the nodes, so that pass
+ * costs about the sum of the applications. Once the tree is warm it
+ * costs about as much as the slowest application.
+ *
+ * libatspi is not thread-safe, so those windows, and the ones whose query
+ * failed or came back empty, are handled one after the other afterwards,
+ * each with an even share of the remaining budget, which keeps one slow
+ * application from starving the others. Elements mostly covered by windows stacked
+ * above their own are dropped.
+ */
+static const char *collect_desktop(gint max_depth, gint max_elements)
+{
+	DesktopPass pass = { 0 };
+	gboolean cut_short = FALSE;
+
+	pass.windows = list_desktop_windows();
+	pass.queried = g_new0(gboolean, pass.windows->len);
+	pass.collected = g_new0(gboolean, pass.windows->len);
+	pass.frame_count = get_window_stacking(pass.frames);
+	pass.max_elements = max_elements;
+
+	AtspiAccessible **roots = g_new(AtspiAccessible *, pass.windows->len);
+	for (guint i = 0; i < pass.windows->len; i++) {
+		DesktopWindow *dw = pass.windows->pdata[i];
+
+		dw->layer = find_layer(&dw->extents, pass.frames, pass.frame_count);
+		if (dw->active)
+			pass.active = dw;
+		roots[i] = dw->window;
+	}
+
+	pass.start = g_get_monotonic_time();
+	guint calls = atspi_pipeline_get_matches(roots, pass.windows->len, excluded_role_ids,
+						 G_N_ELEMENTS(excluded_role_ids), COLLECTION_ALL_MATCHES,
+						 deadline_reached, collect_desktop_matches, &pass);
+	round_trips += calls;
+	pipelined_calls += calls;
+	g_free(roots);
+
+	guint remaining = 0;
+	for (guint i = 0; i < pass.windows->len; i++)
+		remaining += !pass.collected[i];
+
+	for (guint i = 0; i < pass.windows->len && remaining; i++) {
+		DesktopWindow *dw = pass.windows->pdata[i];
+
+		if (pass.collected[i])
+			continue;
+
+		slice_expired = FALSE;
+		slice_deadline = 0;
+		if (element_count >= (guint)max_elements || deadline_reached())
+			break;
+
+		gint64 start = g_get_monotonic_time();
+		guint before = element_count;
+
+		slice_deadline = traversal_deadline ?
+		    start + (traversal_deadline - start) / remaining : 0;
+		remaining--;
+
+		begin_desktop_window(&pass, dw);
+
+		const char *how = "collection";
+		if (pass.queried[i] || !collect_with_collection(dw->window, max_elements)) {
+			how = "walker";
+			dump_node_content(dw->window, 0, max_depth, max_elements, dw->window, &root_clip);
+		}
+
+		log_desktop_window(dw, element_count - before, start, how);
+		cut_short |= slice_expired;
+	}
+
+	/* Reported as a partial result */
+	slice_deadline = 0;
+	slice_expired = cut_short;
+	occluder_count = 0;
+	g_free(pass.queried);
+	g_free(pass.collected);
+	g_ptr_array_free(pass.windows, TRUE);
+
+	return "desktop";
+}
+
+GSList *detect_elements(gint max_depth, gint max_elements, gboolean *partial,
+			const struct ui_cancel_token *cancel)
+{
+	/* The detection budget covers the window lookup as well */
+	gint timeout_ms = config_get_int("ui_detection_timeout");
+	traversal_deadline = timeout_ms > 0 ?
+	    g_get_monotonic_time() + (gint64)timeout_ms * 1000 : 0;
+	traversal_timed_out = FALSE;
+	traversal_cancel = cancel;
+
+	if (partial)
+		*partial = FALSE;
+
+	/* Apply the changes reported since the last activation */
+	atspi_cache_dispatch_events();
+
+	const char *scope = config_get("smart_hint_scope");
+	gboolean desktop = scope && !strcmp(scope, "desktop");
+
+	AtspiAccessible *active_window = desktop ? NULL : get_active_window();
+	if (!desktop && !active_window) {
+		/* The lookup can run out of time as well; the caller reports a cancel */
+		if (ui_cancel_requested(cancel)) {
+			fprintf(stderr, "AT-SPI: Detection cancelled while looking for the active window\n");
+		} else if (traversal_timed_out) {
+			fprintf(stderr, "AT-SPI: Detection timeout reached while looking for the active window\n");
+			if (partial)
+				*partial = TRUE;
+		} else {
+			fprintf(stderr, "Warning: No active window found for smart hint detection\n");
+		}
+		traversal_deadline = 0;
+		traversal_cancel = NULL;
 		return NULL;
 	}
 
@@ -458,24 +1826,35 @@ GSList *detect_elements()
 	GTimer *timer = g_timer_new();
 	g_timer_start(timer);
 	
-	/* Reset depth tracking */
+	/* Reset depth and streaming tracking */
 	max_depth_reached = 0;
+	stream_last = NULL;
+	stream_pending = 0;
 	
-	/* Get configurable values from config system */
-	gint max_depth;  /* Default value */
-	gint max_elements;  /* Default value */
-	
-	/* Use config system to get actual values */
-	max_depth = config_get_int("ui_max_depth");
-	max_elements = config_get_int("ui_max_elements");
-	
-	dump_node_content(active_window, 0, max_depth, max_elements, active_window);
-	g_object_unref(active_window);
+	round_trips = 0;
+	pipelined_calls = 0;
+	pipeline_depth = config_get_int("ui_atspi_pipeline_depth");
+	pruned_subtrees = 0;
+	skip_barren = config_get_int("ui_atspi_skip_barren");
+	barren_skipped = 0;
+	extents_memo = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					     g_object_unref, g_free);
+	min_visible_area = config_get_int("ui_min_visible_area");
+	lazy_names = config_get_int("smart_hint_lazy_names");
+
+	const char *engine = desktop ? collect_desktop(max_depth, max_elements) :
+				       collect_window(active_window, max_depth, max_elements);
+
+	gchar transport[96];
+	describe_transport(active_window, transport, sizeof(transport));
+	if (active_window)
+		g_object_unref(active_window);
 
 	g_timer_stop(timer);
 	gdouble elapsed = g_timer_elapsed(timer, NULL);
-	fprintf(stderr, "AT-SPI: Collection took %.2f ms (depth: %d/%d, elements: %d, limit: %d)\n", 
-	        elapsed * 1000, max_depth_reached, max_depth, g_slist_length(element_list), max_elements);
+	fprintf(stderr, "AT-SPI: Collection took %.2f ms (engine: %s, depth: %d/%d, elements: %d, limit: %d, round trips: %u (%u pipelined), pruned subtrees: %u, barren subtrees skipped: %u%s)%s\n", 
+	        elapsed * 1000, engine, max_depth_reached, max_depth, element_count, max_elements,
+	        round_trips, pipelined_calls, pruned_subtrees, barren_skipped, transport, traversal_timed_out ? " [STOPPED BY TIMEOUT]" : "");
 	
 	/* Suggest increasing depth if we hit the limit */
 	if (max_depth_reached >= max_depth) {
@@ -483,6 +1862,21 @@ GSList *detect_elements()
 	}
 	g_timer_destroy(timer);
 
+	g_hash_table_destroy(extents_memo);
+	extents_memo = NULL;
+
+	if (partial)
+		*partial = traversal_timed_out || slice_expired;
+	traversal_deadline = 0;
+	slice_deadline = 0;
+	slice_expired = FALSE;
+	occluder_count = 0;
+	traversal_cancel = NULL;
+
+	stream_flush();
+
 	deduplicate_elements_by_position(&element_list);
+	element_tail = g_slist_last(element_list);
+	element_count = g_slist_length(element_list);
 	return element_list;
 }
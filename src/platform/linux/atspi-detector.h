@@ -1,6 +1,7 @@
 #ifndef ATSPI_DETECTOR_H
 #define ATSPI_DETECTOR_H
 
+#include "../../platform.h"
 #include <at-spi-2.0/atspi/atspi.h>
 
 typedef struct ElementInfo {
@@ -9,16 +10,42 @@ typedef struct ElementInfo {
 	int w;
 	int h;
 	char *name;
-	char *role;
+	const char *role; /* Interned with g_intern_string(), never freed */
 	int depth;
+	AtspiAccessible *node; /* Source object (referenced) */
 } ElementInfo;
 
 // extern GSList *element_list;
 
 void atspi_init_detector(void);
-GSList *detect_elements();
+/*
+ * Collects up to max_elements elements at most max_depth levels deep,
+ * stops early (like at the deadline) once cancel is set
+ */
+GSList *detect_elements(gint max_depth, gint max_elements, gboolean *partial,
+			const struct ui_cancel_token *cancel);
+/* Deepest tree level the last detect_elements() walked (0 if it walked none) */
+gint atspi_max_depth_reached(void);
 void free_detector_resources(void);
 void atspi_cleanup(void);
 void print_info(ElementInfo *element);
 
+/*
+ * Look up the name of an element (newly allocated). Elements collected
+ * with smart_hint_lazy_names set have none until this is called.
+ */
+gchar *atspi_element_name(AtspiAccessible *accessible);
+ElementInfo *element_info_dup(const ElementInfo *element);
+void element_info_free(ElementInfo *element);
+
+/*
+ * Receives elements while detect_elements() is still running, in batches.
+ * The list starts at the first new element and runs to the last one found
+ * so far; it stays owned by the detector.
+ */
+typedef void (*AtspiElementSink)(GSList *elements);
+
+/* Set (or clear with NULL) the streaming sink */
+void atspi_set_element_sink(AtspiElementSink sink);
+
 #endif
@@ -0,0 +1,991 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Out-of-process AT-SPI detection (warpd-detectd)
+ *
+ * The daemon and the helper talk over a SOCK_SEQPACKET socket pair, one
+ * request at a time. A reply carries its payload as a memfd:
+ *
+ *   detection: struct ui_detection_result, struct ui_element[count], strings
+ *   names:     uint32_t offset[count] (0 = no name), strings
+ *
+ * A streaming detection is preceded by batch messages, laid out like a
+ * detection, with the elements found so far. A detection request carries
+ * the daemon's options in config file syntax whenever they changed since
+ * the helper last got them; the helper never reads the config itself.
+ * The monitor and the window stacking order, which the helper has no
+ * display connection to query, come with every detection request.
+ *
+ * Pointers in a detection segment hold offsets from its start (0 = NULL)
+ * and are relocated once the daemon has mapped it. The daemon cancels a
+ * request with SIGUSR1 and does not wait for the reply; replies to
+ * requests it gave up on are recognized by their sequence number and
+ * dropped.
+ */
+
+#define _GNU_SOURCE /* memfd_create() */
+
+#include "atspi-helper.h"
+#include "../../common/ui_element_queue.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+/* Import config functions */
+extern int config_get_int(const char *key);
+extern void parse_config_stream(FILE *fh);
+extern void config_write(FILE *fh);
+extern unsigned int config_generation(void);
+
+extern struct platform *platform;
+
+/* Time the helper gets on top of ui_detection_timeout before it is killed (ms) */
+#define HELPER_GRACE 1000
+
+/* How often a wait for the helper checks the caller's token (ms) */
+#define HELPER_POLL_INTERVAL 10
+
+/* Results the helper keeps for name lookups */
+#define HELPER_KEPT_RESULTS 4
+
+enum {
+	REQUEST_DETECT = 1,
+	REQUEST_RESOLVE_NAMES,
+	REPLY_BATCH,
+};
+
+/* Detection request flags */
+#define HELPER_STREAM 0x1    /* Send batches while detecting */
+#define HELPER_CONFIG 0x2    /* The options are attached */
+
+struct helper_message {
+	uint32_t type;
+	uint32_t seq;        /* Request (a reply has the seq of its request) */
+	uint32_t result_seq; /* Detection a name request refers to */
+	int32_t max_depth;   /* Limits to detect within */
+	int32_t max_elements;
+	uint32_t flags;
+	int32_t monitor_x;   /* Monitor hints are shown on, 0 width if unknown */
+	int32_t monitor_y;
+	int32_t monitor_w;
+	int32_t monitor_h;
+	uint32_t window_count; /* Windows in stacking, bottom first */
+	struct window_frame stacking[ATSPI_HELPER_MAX_WINDOWS];
+	uint64_t size;       /* Size of the attached segment, 0 if none */
+};
+
+/* A helper result mapped into the daemon */
+struct mapped_result {
+	struct ui_detection_result *result; /* Start of the segment */
+	size_t size;
+	void *names;                        /* Names segment, NULL until resolved */
+	size_t names_size;
+	uint32_t seq;
+	unsigned int generation;            /* Helper that produced it */
+	struct mapped_result *next;
+};
+
+/* Daemon side, protected by client_lock */
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t helper_pid = 0;
+static int helper_fd = -1;
+static unsigned int generation = 0; /* Bumped on every start */
+static uint32_t last_seq = 0;
+static unsigned int sent_config = 0; /* config_generation() the helper has */
+
+/* Daemon side, protected by mapped_lock */
+static pthread_mutex_t mapped_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mapped_result *mapped = NULL;
+
+/* Helper side */
+static struct ui_cancel_token serve_token;
+static struct helper_message serving;   /* Detection request being served */
+static struct {
+	uint32_t seq;
+	struct ui_detection_result *result;
+} kept[HELPER_KEPT_RESULTS];
+static size_t kept_next = 0;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int send_message(int fd, const struct helper_message *msg, int memfd)
+{
+	struct iovec iov = { (void *)msg, sizeof(*msg) };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr hdr;
+	ssize_t n;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+
+	if (memfd >= 0) {
+		memset(&control, 0, sizeof(control));
+		hdr.msg_control = control.buf;
+		hdr.msg_controllen = sizeof(control.buf);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+	}
+
+	do {
+		n = sendmsg(fd, &hdr, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+
+	return n == (ssize_t)sizeof(*msg);
+}
+
+/**
+ * Receive one message and the descriptor attached to it (-1 if none)
+ *
+ * Returns 0 once the other end is gone, -1 on error.
+ */
+static ssize_t recv_message(int fd, struct helper_message *msg, int *memfd)
+{
+	struct iovec iov = { msg, sizeof(*msg) };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr hdr;
+	ssize_t n;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control.buf;
+	hdr.msg_controllen = sizeof(control.buf);
+
+	do {
+		n = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	*memfd = -1;
+	if (n > 0) {
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+		     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+				memcpy(memfd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	if (n > 0 && n != (ssize_t)sizeof(*msg)) {
+		if (*memfd >= 0)
+			close(*memfd);
+		*memfd = -1;
+		return -1;
+	}
+
+	return n;
+}
+
+static struct ui_detection_result *helper_error_result(int error, const char *msg)
+{
+	struct ui_detection_result *result = calloc(1, sizeof(*result));
+	if (!result)
+		return NULL;
+
+	result->error = error;
+	snprintf(result->error_msg, sizeof(result->error_msg), "%s", msg);
+	return result;
+}
+
+/**
+ * Start the helper (client_lock held)
+ */
+static int helper_start(void)
+{
+	char *argv[] = { "warpd-detectd", "--detectd", NULL };
+	sigset_t cancel_signal;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("AT-SPI: detector helper socketpair");
+		return -1;
+	}
+
+	sigemptyset(&cancel_signal);
+	sigaddset(&cancel_signal, SIGUSR1);
+
+	long max_fd = sysconf(_SC_OPEN_MAX);
+	if (max_fd < 0 || max_fd > 65536)
+		max_fd = 65536;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("AT-SPI: detector helper fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		/*
+		 * Only async-signal-safe calls until exec. No PR_SET_PDEATHSIG:
+		 * it fires when the forking thread exits, and detections run on
+		 * short-lived threads. The helper leaves once the socket closes.
+		 */
+
+		/* Cancellations stay pending until the helper can handle them */
+		sigprocmask(SIG_BLOCK, &cancel_signal, NULL);
+
+		if (fds[1] == ATSPI_HELPER_FD)
+			fcntl(fds[1], F_SETFD, 0);
+		else if (dup2(fds[1], ATSPI_HELPER_FD) < 0)
+			_exit(127);
+
+		/* Nothing of the daemon's (its lock file, X connection...) */
+		for (long fd = ATSPI_HELPER_FD + 1; fd < max_fd; fd++)
+			close((int)fd);
+
+		execv("/proc/self/exe", argv);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	helper_pid = pid;
+	helper_fd = fds[0];
+	generation++;
+	sent_config = 0;
+
+	fprintf(stderr, "AT-SPI: Started detector helper (pid %d)\n", (int)pid);
+	return 0;
+}
+
+/**
+ * Kill the helper (client_lock held), the next request starts a new one
+ */
+static void helper_stop(const char *reason)
+{
+	if (!helper_pid)
+		return;
+
+	fprintf(stderr, "AT-SPI: Detector helper (pid %d) %s, restarting it on next use\n",
+		(int)helper_pid, reason);
+
+	kill(helper_pid, SIGKILL);
+	waitpid(helper_pid, NULL, 0);
+	close(helper_fd);
+
+	helper_pid = 0;
+	helper_fd = -1;
+}
+
+static void *map_segment(int memfd, size_t size)
+{
+	void *base = MAP_FAILED;
+
+	if (memfd >= 0 && size > 0)
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, memfd, 0);
+	if (memfd >= 0)
+		close(memfd);
+
+	return base == MAP_FAILED ? NULL : base;
+}
+
+static char *segment_string(void *base, size_t size, const char *offset)
+{
+	uintptr_t off = (uintptr_t)offset;
+	return off && off < size ? (char *)base + off : NULL;
+}
+
+/**
+ * Queue a batch the helper streamed (daemon side)
+ *
+ * The elements are copied out of the segment, the queue outlives it.
+ */
+static void forward_batch(struct ui_element_queue *queue, const struct helper_message *msg,
+			  int memfd)
+{
+	struct ui_detection_result *header = map_segment(memfd, msg->size);
+	if (!header)
+		return;
+
+	struct ui_element *src = (struct ui_element *)(header + 1);
+	struct ui_element *batch = NULL;
+	size_t count = 0;
+
+	if (msg->size >= sizeof(*header) &&
+	    header->count <= (msg->size - sizeof(*header)) / sizeof(struct ui_element))
+		count = header->count;
+	if (count)
+		batch = calloc(count, sizeof(struct ui_element));
+
+	if (batch) {
+		for (size_t i = 0; i < count; i++) {
+			const char *name = segment_string(header, msg->size, src[i].name);
+			const char *role = segment_string(header, msg->size, src[i].role);
+
+			batch[i].x = src[i].x;
+			batch[i].y = src[i].y;
+			batch[i].w = src[i].w;
+			batch[i].h = src[i].h;
+			batch[i].name = name ? strdup(name) : NULL;
+			batch[i].role = role ? strdup(role) : NULL;
+		}
+
+		if (!ui_element_queue_push(queue, batch, count)) {
+			/* The final result still has these elements */
+			struct ui_element_batch dropped = { batch, count };
+			ui_element_batch_free(&dropped);
+		}
+	}
+
+	munmap(header, msg->size);
+}
+
+/**
+ * Send a request and wait for its reply (client_lock held)
+ *
+ * The request gets the next sequence number; request_fd (-1 if none) is
+ * attached to it and closed. Batches streamed before the reply go to
+ * queue. Returns 1 with the reply in msg and its segment in memfd, 0 if
+ * cancel was set first, -1 if the helper failed and was stopped.
+ */
+static int helper_call(struct helper_message *request, int request_fd,
+		       struct ui_element_queue *queue, const struct ui_cancel_token *cancel,
+		       struct helper_message *msg, int *memfd)
+{
+	int timeout = config_get_int("ui_detection_timeout");
+	int64_t deadline = timeout > 0 ? now_ms() + timeout + HELPER_GRACE : 0;
+
+	request->seq = ++last_seq;
+	int sent = send_message(helper_fd, request, request_fd);
+	if (request_fd >= 0)
+		close(request_fd);
+	if (!sent) {
+		helper_stop("is gone");
+		return -1;
+	}
+
+	while (1) {
+		int wait = HELPER_POLL_INTERVAL;
+
+		if (ui_cancel_requested(cancel)) {
+			kill(helper_pid, SIGUSR1);
+			return 0;
+		}
+
+		if (deadline) {
+			int64_t remaining = deadline - now_ms();
+			if (remaining <= 0) {
+				helper_stop("exceeded its deadline");
+				return -1;
+			}
+			if (remaining < wait)
+				wait = (int)remaining;
+		}
+
+		struct pollfd pfd = { helper_fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, wait);
+		if (ready < 0 && errno != EINTR) {
+			helper_stop("is unreachable");
+			return -1;
+		}
+		if (ready <= 0)
+			continue;
+
+		if (recv_message(helper_fd, msg, memfd) <= 0) {
+			helper_stop("exited");
+			return -1;
+		}
+
+		/* Reply to a request given up on earlier */
+		if (msg->seq != request->seq) {
+			if (*memfd >= 0)
+				close(*memfd);
+			continue;
+		}
+
+		if (msg->type == REPLY_BATCH) {
+			if (queue)
+				forward_batch(queue, msg, *memfd);
+			else if (*memfd >= 0)
+				close(*memfd);
+			continue;
+		}
+
+		return 1;
+	}
+}
+
+/**
+ * Lay the daemon's options out in a new segment (daemon side)
+ */
+static int write_config(void)
+{
+	int fd = memfd_create("warpd-config", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	int copy = dup(fd);
+	FILE *fh = copy >= 0 ? fdopen(copy, "w") : NULL;
+	if (!fh) {
+		if (copy >= 0)
+			close(copy);
+		close(fd);
+		return -1;
+	}
+
+	config_write(fh);
+	fclose(fh);
+
+	/* The helper reads through the same file offset */
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+/**
+ * Fill in the monitor hints are shown on and the window stacking order
+ * (daemon side)
+ */
+static void describe_screen(struct helper_message *request)
+{
+	if (platform && platform->window_stacking)
+		request->window_count = platform->window_stacking(request->stacking,
+								  ATSPI_HELPER_MAX_WINDOWS);
+
+	screen_t scr = NULL;
+
+	if (!platform || !platform->mouse_get_position || !platform->screen_get_dimensions)
+		return;
+
+	platform->mouse_get_position(&scr, NULL, NULL);
+	if (!scr)
+		return;
+
+	int x = 0, y = 0, w = 0, h = 0;
+	if (platform->screen_get_offset)
+		platform->screen_get_offset(scr, &x, &y);
+	platform->screen_get_dimensions(scr, &w, &h);
+
+	request->monitor_x = x;
+	request->monitor_y = y;
+	request->monitor_w = w;
+	request->monitor_h = h;
+}
+
+/**
+ * Turn a mapped detection segment into a result
+ */
+static struct ui_detection_result *relocate_result(struct mapped_result *entry)
+{
+	struct ui_detection_result *result = entry->result;
+	int deferred = 0;
+
+	if (entry->size < sizeof(*result) ||
+	    result->count > (entry->size - sizeof(*result)) / sizeof(struct ui_element))
+		return NULL;
+
+	result->elements = result->count ? (struct ui_element *)(result + 1) : NULL;
+	result->arena = NULL;
+	result->shared_strings = 1;
+
+	for (size_t i = 0; i < result->count; i++) {
+		struct ui_element *element = &result->elements[i];
+
+		element->name = segment_string(entry->result, entry->size, element->name);
+		element->role = segment_string(entry->result, entry->size, element->role);
+
+		/*
+		 * The helper answers name lookups by the original index, the
+		 * array may be compacted by the time they are resolved
+		 */
+		if (element->source) {
+			element->source = (const void *)(uintptr_t)(i + 1);
+			deferred = 1;
+		}
+	}
+
+	result->deferred_names = deferred ? entry : NULL;
+	return result;
+}
+
+struct ui_detection_result *atspi_helper_detect(const struct detector_limits *limits,
+						struct ui_element_queue *queue,
+						const struct ui_cancel_token *cancel)
+{
+	struct ui_detection_result *result = NULL;
+	struct helper_message request = {
+		.type = REQUEST_DETECT,
+		.max_depth = limits->max_depth,
+		.max_elements = limits->max_elements,
+		.flags = queue ? HELPER_STREAM : 0,
+	};
+	struct helper_message reply;
+	int memfd = -1;
+	int config_fd = -1;
+
+	describe_screen(&request);
+
+	pthread_mutex_lock(&client_lock);
+
+	if (!helper_pid && helper_start() < 0) {
+		pthread_mutex_unlock(&client_lock);
+		return NULL;
+	}
+
+	/* A restarted helper or a reloaded config needs the options again */
+	unsigned int config = config_generation();
+	if (sent_config != config && (config_fd = write_config()) >= 0)
+		request.flags |= HELPER_CONFIG;
+
+	int status = helper_call(&request, config_fd, queue, cancel, &reply, &memfd);
+	if (status >= 0 && (request.flags & HELPER_CONFIG))
+		sent_config = config;
+	unsigned int produced_by = generation;
+
+	pthread_mutex_unlock(&client_lock);
+
+	if (status == 0)
+		return ui_cancelled_result();
+	if (status < 0)
+		return helper_error_result(-1, "AT-SPI detector helper hung or crashed");
+
+	struct mapped_result *entry = calloc(1, sizeof(*entry));
+	void *base = map_segment(memfd, reply.size);
+	if (entry && base) {
+		entry->result = base;
+		entry->size = reply.size;
+		entry->seq = reply.seq;
+		entry->generation = produced_by;
+		result = relocate_result(entry);
+	}
+
+	if (!result) {
+		if (base)
+			munmap(base, reply.size);
+		free(entry);
+		return helper_error_result(-3, "AT-SPI detector helper sent no result");
+	}
+
+	pthread_mutex_lock(&mapped_lock);
+	entry->next = mapped;
+	mapped = entry;
+	pthread_mutex_unlock(&mapped_lock);
+
+	return result;
+}
+
+/**
+ * Find the mapping of a helper result (mapped_lock held)
+ */
+static struct mapped_result **find_mapped(const struct ui_detection_result *result)
+{
+	struct mapped_result **link = &mapped;
+
+	while (*link && (*link)->result != result)
+		link = &(*link)->next;
+
+	return *link ? link : NULL;
+}
+
+int atspi_helper_owns(const struct ui_detection_result *result)
+{
+	pthread_mutex_lock(&mapped_lock);
+	int owned = result && find_mapped(result) != NULL;
+	pthread_mutex_unlock(&mapped_lock);
+
+	return owned;
+}
+
+int atspi_helper_resolve_names(struct ui_detection_result *result,
+			       const struct ui_cancel_token *cancel)
+{
+	struct helper_message reply;
+	int memfd = -1;
+	int resolved = 0;
+
+	pthread_mutex_lock(&mapped_lock);
+	struct mapped_result **link = result ? find_mapped(result) : NULL;
+	struct mapped_result *entry = link ? *link : NULL;
+	pthread_mutex_unlock(&mapped_lock);
+
+	if (!entry || entry->names || !result->deferred_names)
+		return 0;
+
+	pthread_mutex_lock(&client_lock);
+
+	/* A restarted helper no longer has the elements */
+	if (!helper_pid || entry->generation != generation) {
+		pthread_mutex_unlock(&client_lock);
+		return 0;
+	}
+
+	struct helper_message request = {
+		.type = REQUEST_RESOLVE_NAMES,
+		.result_seq = entry->seq,
+	};
+	int status = helper_call(&request, -1, NULL, cancel, &reply, &memfd);
+
+	pthread_mutex_unlock(&client_lock);
+
+	if (status <= 0)
+		return 0;
+
+	uint32_t *offsets = map_segment(memfd, reply.size);
+	if (!offsets)
+		return 0;
+
+	size_t indexes = reply.size / sizeof(uint32_t);
+
+	for (size_t i = 0; i < result->count; i++) {
+		struct ui_element *element = &result->elements[i];
+		size_t index = (uintptr_t)element->source;
+
+		if (!index || index > indexes || element->name)
+			continue;
+
+		char *name = segment_string(offsets, reply.size,
+					    (const char *)(uintptr_t)offsets[index - 1]);
+		if (!name)
+			continue;
+
+		element->name = name;
+		element->source = NULL;
+		resolved++;
+	}
+
+	entry->names = offsets;
+	entry->names_size = reply.size;
+
+	return resolved;
+}
+
+int atspi_helper_free(struct ui_detection_result *result)
+{
+	if (!result)
+		return 0;
+
+	pthread_mutex_lock(&mapped_lock);
+	struct mapped_result **link = find_mapped(result);
+	struct mapped_result *entry = link ? *link : NULL;
+	if (entry)
+		*link = entry->next;
+	pthread_mutex_unlock(&mapped_lock);
+
+	if (!entry)
+		return 0;
+
+	if (entry->names)
+		munmap(entry->names, entry->names_size);
+	munmap(entry->result, entry->size);
+	free(entry);
+
+	return 1;
+}
+
+/**
+ * Create a shared memory segment of size bytes (helper side)
+ */
+static int create_segment(size_t size, void **map)
+{
+	int fd = memfd_create("warpd-detectd", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (*map == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static const char *store_string(char *base, size_t *used, const char *str)
+{
+	if (!str)
+		return NULL;
+
+	size_t offset = *used;
+	size_t len = strlen(str) + 1;
+
+	memcpy(base + offset, str, len);
+	*used += len;
+
+	return (const char *)(uintptr_t)offset;
+}
+
+/**
+ * Lay a detection result out in a new segment (helper side)
+ */
+static int write_detection(const struct ui_detection_result *result, uint64_t *size)
+{
+	size_t bytes = sizeof(*result) + result->count * sizeof(struct ui_element);
+	size_t used = bytes;
+	void *map;
+
+	for (size_t i = 0; i < result->count; i++) {
+		if (result->elements[i].name)
+			bytes += strlen(result->elements[i].name) + 1;
+		if (result->elements[i].role)
+			bytes += strlen(result->elements[i].role) + 1;
+	}
+
+	int fd = create_segment(bytes, &map);
+	if (fd < 0)
+		return -1;
+
+	struct ui_detection_result *header = map;
+	struct ui_element *elements = (struct ui_element *)(header + 1);
+
+	*header = *result;
+	header->elements = NULL;
+	header->arena = NULL;
+	header->deferred_names = NULL;
+
+	for (size_t i = 0; i < result->count; i++) {
+		const struct ui_element *src = &result->elements[i];
+
+		elements[i].x = src->x;
+		elements[i].y = src->y;
+		elements[i].w = src->w;
+		elements[i].h = src->h;
+		elements[i].name = (char *)store_string(map, &used, src->name);
+		elements[i].role = (char *)store_string(map, &used, src->role);
+		elements[i].source = src->source ? (const void *)1 : NULL;
+	}
+
+	munmap(map, bytes);
+	*size = bytes;
+	return fd;
+}
+
+static void keep_result(const struct atspi_helper_ops *ops, uint32_t seq,
+			struct ui_detection_result *result)
+{
+	if (kept[kept_next].result)
+		ops->free_result(kept[kept_next].result);
+
+	kept[kept_next].seq = seq;
+	kept[kept_next].result = result;
+	kept_next = (kept_next + 1) % HELPER_KEPT_RESULTS;
+}
+
+int atspi_helper_streaming(void)
+{
+	return serving.type == REQUEST_DETECT && (serving.flags & HELPER_STREAM);
+}
+
+void atspi_helper_send_batch(const struct ui_element *elements, size_t count)
+{
+	struct ui_detection_result batch;
+	struct helper_message msg = {
+		.type = REPLY_BATCH,
+		.seq = serving.seq,
+	};
+
+	if (!atspi_helper_streaming() || count == 0)
+		return;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.elements = (struct ui_element *)elements;
+	batch.count = count;
+
+	int fd = write_detection(&batch, &msg.size);
+	if (fd < 0)
+		return;
+
+	send_message(ATSPI_HELPER_FD, &msg, fd);
+	close(fd);
+}
+
+int atspi_helper_monitor(int *x, int *y, int *w, int *h)
+{
+	if (serving.type != REQUEST_DETECT || serving.monitor_w <= 0 || serving.monitor_h <= 0)
+		return 0;
+
+	*x = serving.monitor_x;
+	*y = serving.monitor_y;
+	*w = serving.monitor_w;
+	*h = serving.monitor_h;
+	return 1;
+}
+
+size_t atspi_helper_stacking(struct window_frame *frames, size_t max)
+{
+	size_t count = serving.type == REQUEST_DETECT ? serving.window_count : 0;
+
+	if (count > ATSPI_HELPER_MAX_WINDOWS)
+		count = ATSPI_HELPER_MAX_WINDOWS;
+
+	/* Keep the topmost */
+	if (count > max) {
+		memcpy(frames, serving.stacking + count - max, max * sizeof(*frames));
+		return max;
+	}
+
+	memcpy(frames, serving.stacking, count * sizeof(*frames));
+	return count;
+}
+
+static int serve_detect(const struct atspi_helper_ops *ops, const struct helper_message *request,
+			uint64_t *size)
+{
+	struct detector_limits limits = { request->max_depth, request->max_elements };
+	struct ui_detection_result *result = ops->detect(&limits, &serve_token);
+	if (!result)
+		return -1;
+
+	int fd = write_detection(result, size);
+
+	if (fd >= 0 && result->error == 0 && result->deferred_names)
+		keep_result(ops, request->seq, result);
+	else
+		ops->free_result(result);
+
+	return fd;
+}
+
+static int serve_names(const struct atspi_helper_ops *ops, uint32_t result_seq, uint64_t *size)
+{
+	struct ui_detection_result *result = NULL;
+	size_t slot;
+	void *map;
+
+	for (slot = 0; slot < HELPER_KEPT_RESULTS; slot++) {
+		if (kept[slot].result && kept[slot].seq == result_seq) {
+			result = kept[slot].result;
+			break;
+		}
+	}
+	if (!result)
+		return -1;
+
+	unsigned char *deferred = calloc(result->count, 1);
+	if (!deferred)
+		return -1;
+
+	for (size_t i = 0; i < result->count; i++)
+		deferred[i] = result->elements[i].source != NULL;
+
+	ops->resolve_names(result, &serve_token);
+
+	size_t bytes = result->count * sizeof(uint32_t);
+	size_t used = bytes;
+	for (size_t i = 0; i < result->count; i++) {
+		if (deferred[i] && result->elements[i].name)
+			bytes += strlen(result->elements[i].name) + 1;
+	}
+
+	int fd = create_segment(bytes, &map);
+	if (fd >= 0) {
+		uint32_t *offsets = map;
+
+		for (size_t i = 0; i < result->count; i++) {
+			const char *name = deferred[i] ? result->elements[i].name : NULL;
+			offsets[i] = (uint32_t)(uintptr_t)store_string(map, &used, name);
+		}
+
+		munmap(map, bytes);
+		*size = bytes;
+	}
+
+	free(deferred);
+
+	/* Every name is known now, the elements are not needed anymore */
+	ops->free_result(result);
+	kept[slot].result = NULL;
+
+	return fd;
+}
+
+static void on_cancel(int sig)
+{
+	serve_token.cancelled = 1;
+}
+
+int atspi_helper_serve(const struct atspi_helper_ops *ops)
+{
+	struct sigaction action;
+	sigset_t cancel_signal;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_cancel;
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &action, NULL);
+
+	sigemptyset(&cancel_signal);
+	sigaddset(&cancel_signal, SIGUSR1);
+	sigprocmask(SIG_UNBLOCK, &cancel_signal, NULL);
+
+	prctl(PR_SET_NAME, "warpd-detectd");
+	fprintf(stderr, "warpd-detectd: Serving AT-SPI detection (pid %d)\n", (int)getpid());
+
+	while (1) {
+		struct helper_message request;
+		int memfd;
+
+		if (recv_message(ATSPI_HELPER_FD, &request, &memfd) <= 0)
+			break;
+
+		/* The options the daemon runs with now */
+		if (memfd >= 0 && request.type == REQUEST_DETECT && (request.flags & HELPER_CONFIG)) {
+			FILE *fh = fdopen(memfd, "r");
+			if (fh)
+				parse_config_stream(fh);
+			else
+				close(memfd);
+		} else if (memfd >= 0) {
+			close(memfd);
+		}
+
+		/* Cancellations of earlier requests do not apply */
+		serve_token.cancelled = 0;
+
+		struct helper_message reply = {
+			.type = request.type,
+			.seq = request.seq,
+			.result_seq = request.result_seq,
+		};
+		int fd = -1;
+
+		serving = request;
+		if (request.type == REQUEST_DETECT)
+			fd = serve_detect(ops, &request, &reply.size);
+		else if (request.type == REQUEST_RESOLVE_NAMES)
+			fd = serve_names(ops, request.result_seq, &reply.size);
+		memset(&serving, 0, sizeof(serving));
+
+		send_message(ATSPI_HELPER_FD, &reply, fd);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	for (size_t i = 0; i < HELPER_KEPT_RESULTS; i++) {
+		if (kept[i].result)
+			ops->free_result(kept[i].result);
+	}
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Out-of-process AT-SPI detection (warpd-detectd)
+ *
+ * AT-SPI detection runs in a helper process, so an application that hangs
+ * or crashes libatspi/GLib takes the helper down instead of the daemon.
+ * The helper is the warpd binary itself, started with --detectd. Results
+ * come back in a memfd holding the ui_detection_result, its elements and
+ * their strings in place; the daemon maps it and only fixes up pointers.
+ */
+
+#ifndef ATSPI_HELPER_H
+#define ATSPI_HELPER_H
+
+#include "../../platform.h"
+#include "../../common/detector_orchestrator.h"
+
+/* Descriptor of the helper's end of the socket */
+#define ATSPI_HELPER_FD 3
+
+/* Windows of the stacking order passed to the helper, the topmost are kept */
+#define ATSPI_HELPER_MAX_WINDOWS 64
+
+/* What the helper runs on behalf of the daemon */
+struct atspi_helper_ops {
+	struct ui_detection_result *(*detect)(const struct detector_limits *limits,
+					      const struct ui_cancel_token *cancel);
+	int (*resolve_names)(struct ui_detection_result *result,
+			     const struct ui_cancel_token *cancel);
+	void (*free_result)(struct ui_detection_result *result);
+};
+
+/**
+ * Detect UI elements in the helper process, starting it if needed
+ *
+ * A helper that exceeds ui_detection_timeout is killed (and started again
+ * on the next call); the detection then fails so that the next strategy
+ * is tried. The helper detects within limits, with the options in effect
+ * in the daemon.
+ *
+ * @param queue Receives the elements while the helper finds them (may be NULL)
+ * @return Detection result, or NULL if the helper could not be started
+ */
+struct ui_detection_result *atspi_helper_detect(const struct detector_limits *limits,
+						struct ui_element_queue *queue,
+						const struct ui_cancel_token *cancel);
+
+/**
+ * Check whether result was produced by atspi_helper_detect()
+ */
+int atspi_helper_owns(const struct ui_detection_result *result);
+
+/**
+ * Have the helper look up the deferred names of one of its results
+ *
+ * @return Number of names filled in
+ */
+int atspi_helper_resolve_names(struct ui_detection_result *result,
+			       const struct ui_cancel_token *cancel);
+
+/**
+ * Free a result of atspi_helper_detect()
+ *
+ * @return 0 if result is not a helper result (and was left alone)
+ */
+int atspi_helper_free(struct ui_detection_result *result);
+
+/**
+ * Serve the daemon on ATSPI_HELPER_FD until it goes away (helper side)
+ */
+int atspi_helper_serve(const struct atspi_helper_ops *ops);
+
+/**
+ * Check whether the daemon streams the detection being served (helper side)
+ */
+int atspi_helper_streaming(void);
+
+/**
+ * Send elements of the detection being served ahead of its result, if
+ * the daemon streams it (helper side)
+ */
+void atspi_helper_send_batch(const struct ui_element *elements, size_t count);
+
+/**
+ * Get the monitor the daemon shows the hints of the detection being
+ * served on (helper side)
+ *
+ * @return 0 if the daemon could not tell
+ */
+int atspi_helper_monitor(int *x, int *y, int *w, int *h);
+
+/**
+ * Get the window stacking order the daemon saw when it sent the detection
+ * being served, bottom first, keeping the topmost max (helper side)
+ *
+ * @return Number of frames filled in, 0 if unknown
+ */
+size_t atspi_helper_stacking(struct window_frame *frames, size_t max);
+
+#endif
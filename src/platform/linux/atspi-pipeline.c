@@ -0,0 +1,335 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Pipelined AT-SPI calls
+ *
+ * libatspi waits for the reply of every call before it returns, so a
+ * traversal pays one full round trip per uncached property. Here the
+ * calls for a batch of nodes are all sent before the first reply is
+ * awaited; the application answers them back to back and the batch costs
+ * about one round trip plus the application's processing time. Queries
+ * sent to several applications this way are answered in parallel.
+ */
+
+#include "atspi-pipeline.h"
+#include <dbus/dbus.h>
+
+/* Import config functions */
+extern int config_get_int(const char *key);
+
+#define ATSPI_COMPONENT_INTERFACE "org.a11y.atspi.Component"
+#define ATSPI_COLLECTION_INTERFACE "org.a11y.atspi.Collection"
+
+/* Words of the state and role bit sets in a match rule */
+#define MATCH_RULE_STATE_WORDS 2
+#define MATCH_RULE_ROLE_WORDS 4
+
+typedef struct {
+	AtspiAccessible *node;
+	DBusPendingCall *pending; /* NULL if the call could not be sent */
+} PipelineCall;
+
+/**
+ * Send message to the application of node, NULL if it could not be sent
+ */
+static DBusPendingCall *send_call(AtspiAccessible *node, DBusMessage *message)
+{
+	AtspiObject *object = (AtspiObject *)node;
+	DBusPendingCall *pending = NULL;
+
+	gint timeout = config_get_int("ui_atspi_call_timeout");
+	if (!dbus_connection_send_with_reply(object->app->bus, message, &pending,
+					     timeout > 0 ? timeout : DBUS_TIMEOUT_USE_DEFAULT))
+		pending = NULL;
+
+	return pending;
+}
+
+/**
+ * Wait for the reply of a call, NULL if it failed
+ */
+static DBusMessage *receive_reply(DBusPendingCall *pending)
+{
+	dbus_pending_call_block(pending);
+	DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+	dbus_pending_call_unref(pending);
+
+	if (reply && dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN) {
+		dbus_message_unref(reply);
+		return NULL;
+	}
+
+	return reply;
+}
+
+/* Replies nobody waits for any more */
+static void cancel_calls(PipelineCall *calls, guint from, guint to)
+{
+	for (guint i = from; i < to; i++) {
+		if (calls[i].pending) {
+			dbus_pending_call_cancel(calls[i].pending);
+			dbus_pending_call_unref(calls[i].pending);
+		}
+	}
+}
+
+static DBusPendingCall *send_get_extents(AtspiAccessible *node)
+{
+	AtspiObject *object = (AtspiObject *)node;
+	dbus_uint32_t coord_type = ATSPI_COORD_TYPE_SCREEN;
+	DBusPendingCall *pending = NULL;
+
+	if (!object->app || !object->app->bus)
+		return NULL;
+
+	DBusMessage *message = dbus_message_new_method_call(
+	    object->app->bus_name, object->path, ATSPI_COMPONENT_INTERFACE,
+	    "GetExtents");
+	if (!message)
+		return NULL;
+
+	if (dbus_message_append_args(message, DBUS_TYPE_UINT32, &coord_type,
+				     DBUS_TYPE_INVALID))
+		pending = send_call(node, message);
+
+	dbus_message_unref(message);
+	return pending;
+}
+
+/**
+ * Wait for the reply of call and parse the (iiii) extents it carries
+ */
+static void receive_extents(PipelineCall *call, AtspiRect *extents)
+{
+	extents->x = extents->y = extents->width = extents->height = -1;
+
+	if (!call->pending)
+		return;
+
+	DBusMessage *reply = receive_reply(call->pending);
+	call->pending = NULL;
+
+	if (!reply)
+		return;
+
+	DBusMessageIter iter, sub;
+	if (dbus_message_iter_init(reply, &iter) &&
+	    dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_STRUCT) {
+		dbus_int32_t values[4];
+		gint n = 0;
+
+		dbus_message_iter_recurse(&iter, &sub);
+		while (n < 4 && dbus_message_iter_get_arg_type(&sub) == DBUS_TYPE_INT32) {
+			dbus_message_iter_get_basic(&sub, &values[n++]);
+			dbus_message_iter_next(&sub);
+		}
+
+		if (n == 4) {
+			extents->x = values[0];
+			extents->y = values[1];
+			extents->width = values[2];
+			extents->height = values[3];
+		}
+	}
+
+	dbus_message_unref(reply);
+}
+
+guint atspi_pipeline_get_extents(AtspiAccessible **nodes, guint count, guint depth,
+				 AtspiPipelineStop stop, AtspiExtentsReady ready,
+				 gpointer data)
+{
+	PipelineCall *calls = g_new0(PipelineCall, count);
+	guint sent = 0;
+	guint received = 0;
+
+	if (depth == 0)
+		depth = 1;
+
+	while (received < count) {
+		/* Keep the pipeline full */
+		while (sent < count && sent - received < depth) {
+			calls[sent].node = nodes[sent];
+			calls[sent].pending = send_get_extents(nodes[sent]);
+			sent++;
+		}
+
+		if (stop && stop())
+			break;
+
+		AtspiRect extents;
+		receive_extents(&calls[received], &extents);
+		ready(calls[received].node, &extents, data);
+		received++;
+	}
+
+	cancel_calls(calls, received, sent);
+
+	g_free(calls);
+	return sent;
+}
+
+static gboolean append_bits(DBusMessageIter *iter, const dbus_int32_t *words, gint count)
+{
+	DBusMessageIter array;
+
+	if (!dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "i", &array))
+		return FALSE;
+	for (gint i = 0; i < count; i++)
+		dbus_message_iter_append_basic(&array, DBUS_TYPE_INT32, &words[i]);
+	return dbus_message_iter_close_container(iter, &array);
+}
+
+/**
+ * Append the (aiia{ss}iaiiasib) match rule: showing and visible, none of
+ * the excluded roles
+ */
+static gboolean append_match_rule(DBusMessageIter *iter, const AtspiRole *excluded,
+				  guint excluded_count)
+{
+	dbus_int32_t states[MATCH_RULE_STATE_WORDS] = { 0 };
+	dbus_int32_t roles[MATCH_RULE_ROLE_WORDS] = { 0 };
+	dbus_int32_t match_all = ATSPI_Collection_MATCH_ALL;
+	dbus_int32_t match_none = ATSPI_Collection_MATCH_NONE;
+	dbus_bool_t invert = FALSE;
+	DBusMessageIter rule, array;
+
+	states[ATSPI_STATE_SHOWING / 32] |= 1u << (ATSPI_STATE_SHOWING % 32);
+	states[ATSPI_STATE_VISIBLE / 32] |= 1u << (ATSPI_STATE_VISIBLE % 32);
+	for (guint i = 0; i < excluded_count; i++) {
+		if (excluded[i] < MATCH_RULE_ROLE_WORDS * 32)
+			roles[excluded[i] / 32] |= 1u << (excluded[i] % 32);
+	}
+
+	return dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL, &rule) &&
+	       append_bits(&rule, states, MATCH_RULE_STATE_WORDS) &&
+	       dbus_message_iter_append_basic(&rule, DBUS_TYPE_INT32, &match_all) &&
+	       dbus_message_iter_open_container(&rule, DBUS_TYPE_ARRAY, "{ss}", &array) &&
+	       dbus_message_iter_close_container(&rule, &array) &&
+	       dbus_message_iter_append_basic(&rule, DBUS_TYPE_INT32, &match_all) &&
+	       append_bits(&rule, roles, MATCH_RULE_ROLE_WORDS) &&
+	       dbus_message_iter_append_basic(&rule, DBUS_TYPE_INT32, &match_none) &&
+	       dbus_message_iter_open_container(&rule, DBUS_TYPE_ARRAY, "s", &array) &&
+	       dbus_message_iter_close_container(&rule, &array) &&
+	       dbus_message_iter_append_basic(&rule, DBUS_TYPE_INT32, &match_all) &&
+	       dbus_message_iter_append_basic(&rule, DBUS_TYPE_BOOLEAN, &invert) &&
+	       dbus_message_iter_close_container(iter, &rule);
+}
+
+static DBusPendingCall *send_get_matches(AtspiAccessible *root, const AtspiRole *excluded,
+					 guint excluded_count, gint max_matches)
+{
+	AtspiObject *object = (AtspiObject *)root;
+	dbus_uint32_t sort_by = ATSPI_Collection_SORT_ORDER_CANONICAL;
+	dbus_int32_t limit = max_matches;
+	dbus_bool_t traverse = TRUE;
+	DBusPendingCall *pending = NULL;
+	DBusMessageIter iter;
+
+	if (!object->app || !object->app->bus)
+		return NULL;
+
+	DBusMessage *message = dbus_message_new_method_call(
+	    object->app->bus_name, object->path, ATSPI_COLLECTION_INTERFACE,
+	    "GetMatches");
+	if (!message)
+		return NULL;
+
+	dbus_message_iter_init_append(message, &iter);
+	if (append_match_rule(&iter, excluded, excluded_count) &&
+	    dbus_message_append_args(message, DBUS_TYPE_UINT32, &sort_by,
+				     DBUS_TYPE_INT32, &limit, DBUS_TYPE_BOOLEAN, &traverse,
+				     DBUS_TYPE_INVALID))
+		pending = send_call(root, message);
+
+	dbus_message_unref(message);
+	return pending;
+}
+
+/**
+ * Wait for the a(so) reply of call and get its nodes, NULL if the call
+ * failed
+ *
+ * libatspi never sees this reply and has no public way to make a node
+ * from a path, so a reply naming nodes it does not hold yet (a cold
+ * tree) is dropped with cold set.
+ */
+static GPtrArray *receive_matches(PipelineCall *call, gboolean *cold)
+{
+	*cold = FALSE;
+
+	if (!call->pending)
+		return NULL;
+
+	DBusMessage *reply = receive_reply(call->pending);
+	call->pending = NULL;
+
+	if (!reply)
+		return NULL;
+
+	/* Nodes are kept by path in the hash of their application */
+	AtspiApplication *app = ((AtspiObject *)call->node)->app;
+	GPtrArray *matches = g_ptr_array_new_with_free_func(g_object_unref);
+	DBusMessageIter iter, array, reference;
+	gboolean complete = dbus_message_iter_init(reply, &iter) &&
+			    dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY;
+
+	if (complete)
+		dbus_message_iter_recurse(&iter, &array);
+	while (complete && dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+		const char *path = NULL;
+
+		dbus_message_iter_recurse(&array, &reference);
+		dbus_message_iter_next(&reference);
+		if (dbus_message_iter_get_arg_type(&reference) == DBUS_TYPE_OBJECT_PATH)
+			dbus_message_iter_get_basic(&reference, &path);
+
+		AtspiAccessible *node = path && app->hash ? g_hash_table_lookup(app->hash, path) : NULL;
+		if (node) {
+			g_ptr_array_add(matches, g_object_ref(node));
+		} else {
+			/* Not known to libatspi yet, or a malformed reply */
+			*cold = path != NULL;
+			complete = FALSE;
+		}
+
+		dbus_message_iter_next(&array);
+	}
+
+	dbus_message_unref(reply);
+
+	if (!complete) {
+		g_ptr_array_free(matches, TRUE);
+		return NULL;
+	}
+
+	return matches;
+}
+
+guint atspi_pipeline_get_matches(AtspiAccessible **roots, guint count,
+				 const AtspiRole *excluded, guint excluded_count,
+				 gint max_matches, AtspiPipelineStop stop,
+				 AtspiMatchesReady ready, gpointer data)
+{
+	PipelineCall *calls = g_new0(PipelineCall, count);
+	guint received = 0;
+
+	/* Every application gets its query before the first reply is awaited */
+	for (guint i = 0; i < count; i++) {
+		calls[i].node = roots[i];
+		calls[i].pending = send_get_matches(roots[i], excluded, excluded_count,
+						    max_matches);
+	}
+
+	while (received < count && !(stop && stop())) {
+		gboolean cold;
+		GPtrArray *matches = receive_matches(&calls[received], &cold);
+		ready(received, matches, cold, data);
+		received++;
+	}
+
+	cancel_calls(calls, received, count);
+
+	g_free(calls);
+	return count;
+}
@@ -0,0 +1,57 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Pipelined AT-SPI calls
+ */
+
+#ifndef ATSPI_PIPELINE_H
+#define ATSPI_PIPELINE_H
+
+#include <at-spi-2.0/atspi/atspi.h>
+#include <glib.h>
+
+/* Receives the extents of one node, all -1 if the call failed */
+typedef void (*AtspiExtentsReady)(AtspiAccessible *node, const AtspiRect *extents,
+				  gpointer data);
+
+/* Returns TRUE once the remaining calls should be abandoned */
+typedef gboolean (*AtspiPipelineStop)(void);
+
+/*
+ * Fetch the screen extents of nodes with up to depth calls in flight at
+ * once. ready is called for every node, in order, as its reply arrives
+ * (not for the nodes left over once stop returns TRUE).
+ *
+ * Returns the number of calls made.
+ */
+guint atspi_pipeline_get_extents(AtspiAccessible **nodes, guint count, guint depth,
+				 AtspiPipelineStop stop, AtspiExtentsReady ready,
+				 gpointer data);
+
+/*
+ * Receives the matches of root number index (referenced, freed by the
+ * callee), NULL if the query failed. cold is set if the reply was dropped
+ * because it named nodes libatspi does not hold yet; those are only
+ * reachable through atspi_collection_get_matches().
+ */
+typedef void (*AtspiMatchesReady)(guint index, GPtrArray *matches, gboolean cold,
+				  gpointer data);
+
+/*
+ * Query the Collection interface of all roots at once for their showing
+ * and visible descendants whose role is not one of excluded (at most
+ * max_matches each, 0 for all). The applications work on their queries
+ * at the same time; ready is called for every root, in order, as its
+ * reply arrives (not for the roots left over once stop returns TRUE).
+ *
+ * Only warm trees are answered here. A cold tree is reported as such and
+ * is left to the caller's own (sequential) Collection query.
+ *
+ * Returns the number of calls made.
+ */
+guint atspi_pipeline_get_matches(AtspiAccessible **roots, guint count,
+				 const AtspiRole *excluded, guint excluded_count,
+				 gint max_matches, AtspiPipelineStop stop,
+				 AtspiMatchesReady ready, gpointer data);
+
+#endif
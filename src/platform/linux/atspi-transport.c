@@ -0,0 +1,273 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Direct (peer-to-peer) D-Bus connections to AT-SPI applications
+ *
+ * Every AT-SPI call normally travels from warpd to the bus daemon and from
+ * there to the application, and back the same way. Applications also
+ * listen on a private address (GetApplicationBusAddress). Once a direct
+ * connection to it is open it replaces the connection libatspi uses for
+ * that application, so the calls of the detector skip the daemon.
+ */
+
+#include "atspi-transport.h"
+#include <dbus/dbus.h>
+#include <stdio.h>
+
+/* Import config functions */
+extern int config_get_int(const char *key);
+
+#define ATSPI_ROOT_PATH "/org/a11y/atspi/accessible/root"
+#define ATSPI_APPLICATION_INTERFACE "org.a11y.atspi.Application"
+
+/* Round trips averaged when comparing the two routes */
+#define PING_SAMPLES 3
+
+typedef struct {
+	AtspiApplication *app;  /* Referenced while direct is open, NULL otherwise */
+	DBusConnection *bus;    /* Connection libatspi had (referenced) */
+	DBusConnection *direct; /* NULL if the calls go through the daemon */
+	gdouble bus_ms;
+	gdouble direct_ms;
+} AtspiPeer;
+
+static GHashTable *peers = NULL; /* Bus name -> AtspiPeer */
+
+/*
+ * Applications without a direct connection are remembered so that they
+ * are not asked again. Their unique names are never reused once they
+ * exit, so past this many the excess is forgotten (an application still
+ * running is then asked once more).
+ */
+#define MAX_BUS_ONLY_PEERS 64
+static guint bus_only_peers = 0;
+
+static gint call_timeout(void)
+{
+	gint timeout = config_get_int("ui_atspi_call_timeout");
+	return timeout > 0 ? timeout : DBUS_TIMEOUT_USE_DEFAULT;
+}
+
+/**
+ * Mean round trip of org.freedesktop.DBus.Peer.Ping in ms, -1 on failure
+ */
+static gdouble ping(DBusConnection *connection, const char *bus_name)
+{
+	gint64 start = g_get_monotonic_time();
+
+	for (gint i = 0; i < PING_SAMPLES; i++) {
+		DBusError error;
+		DBusMessage *message = dbus_message_new_method_call(
+		    bus_name, ATSPI_ROOT_PATH, DBUS_INTERFACE_PEER, "Ping");
+		if (!message)
+			return -1;
+
+		dbus_error_init(&error);
+		DBusMessage *reply = dbus_connection_send_with_reply_and_block(
+		    connection, message, call_timeout(), &error);
+		dbus_message_unref(message);
+
+		if (!reply) {
+			dbus_error_free(&error);
+			return -1;
+		}
+		dbus_message_unref(reply);
+	}
+
+	return (g_get_monotonic_time() - start) / 1000.0 / PING_SAMPLES;
+}
+
+/**
+ * Ask the application for its private address (newly allocated, or NULL)
+ */
+static gchar *get_application_bus_address(DBusConnection *bus, const char *bus_name)
+{
+	DBusError error;
+	const char *address = NULL;
+	gchar *result = NULL;
+
+	DBusMessage *message = dbus_message_new_method_call(
+	    bus_name, ATSPI_ROOT_PATH, ATSPI_APPLICATION_INTERFACE,
+	    "GetApplicationBusAddress");
+	if (!message)
+		return NULL;
+
+	dbus_error_init(&error);
+	DBusMessage *reply = dbus_connection_send_with_reply_and_block(
+	    bus, message, call_timeout(), &error);
+	dbus_message_unref(message);
+
+	if (!reply) {
+		dbus_error_free(&error);
+		return NULL;
+	}
+
+	if (dbus_message_get_args(reply, &error, DBUS_TYPE_STRING, &address,
+				  DBUS_TYPE_INVALID) && address && *address)
+		result = g_strdup(address);
+
+	dbus_error_free(&error);
+	dbus_message_unref(reply);
+	return result;
+}
+
+/**
+ * Hand the application back to the connection libatspi had
+ */
+static void peer_detach(AtspiPeer *peer)
+{
+	if (!peer->direct)
+		return;
+
+	if (peer->app->bus == peer->direct) {
+		peer->app->bus = peer->bus;
+		peer->bus = NULL;
+		dbus_connection_unref(peer->direct); /* The reference libatspi held */
+	}
+
+	dbus_connection_close(peer->direct);
+	dbus_connection_unref(peer->direct);
+	peer->direct = NULL;
+}
+
+static void peer_free(gpointer data)
+{
+	AtspiPeer *peer = data;
+
+	peer_detach(peer);
+	if (peer->bus)
+		dbus_connection_unref(peer->bus);
+	if (peer->app)
+		g_object_unref(peer->app);
+	else
+		bus_only_peers--;
+	g_free(peer);
+}
+
+/**
+ * Open a direct connection to the application, FALSE if it has none
+ */
+static gboolean peer_connect(AtspiPeer *peer)
+{
+	AtspiApplication *app = peer->app;
+	DBusError error;
+
+	/* Connections to the daemon have a unique name, direct ones do not */
+	if (!dbus_bus_get_unique_name(app->bus))
+		return FALSE;
+
+	gchar *address = get_application_bus_address(app->bus, app->bus_name);
+	if (!address)
+		return FALSE;
+
+	dbus_error_init(&error);
+	DBusConnection *direct = dbus_connection_open_private(address, &error);
+	g_free(address);
+
+	if (!direct) {
+		fprintf(stderr, "AT-SPI: Direct connection to %s failed (%s)\n",
+			app->bus_name, error.message);
+		dbus_error_free(&error);
+		return FALSE;
+	}
+
+	dbus_connection_set_exit_on_disconnect(direct, FALSE);
+	/* Signals the application sends this way are dispatched (and dropped) with the rest */
+	atspi_dbus_connection_setup_with_g_main(direct, NULL);
+
+	peer->bus_ms = ping(app->bus, app->bus_name);
+	peer->direct_ms = ping(direct, app->bus_name);
+	if (peer->direct_ms < 0) {
+		dbus_connection_close(direct);
+		dbus_connection_unref(direct);
+		return FALSE;
+	}
+
+	/* libatspi sends every call for the application over app->bus */
+	peer->bus = app->bus;
+	app->bus = dbus_connection_ref(direct);
+	peer->direct = direct;
+
+	fprintf(stderr, "AT-SPI: Direct connection to %s (%.3f ms per call, %.3f ms through the bus)\n",
+		app->bus_name, peer->direct_ms, peer->bus_ms);
+	return TRUE;
+}
+
+static AtspiPeer *lookup_peer(AtspiAccessible *accessible)
+{
+	AtspiApplication *app = accessible ? ((AtspiObject *)accessible)->app : NULL;
+
+	if (!peers || !app || !app->bus_name)
+		return NULL;
+
+	return g_hash_table_lookup(peers, app->bus_name);
+}
+
+static gboolean peer_lost(gpointer key, gpointer value, gpointer data)
+{
+	AtspiPeer *peer = value;
+
+	/* An application that exits closes its end */
+	if (peer->direct && !dbus_connection_get_is_connected(peer->direct)) {
+		fprintf(stderr, "AT-SPI: Direct connection to %s lost\n", (const char *)key);
+		return TRUE;
+	}
+
+	return !peer->direct && bus_only_peers > MAX_BUS_ONLY_PEERS;
+}
+
+void atspi_transport_attach(AtspiAccessible *accessible)
+{
+	AtspiApplication *app = accessible ? ((AtspiObject *)accessible)->app : NULL;
+
+	if (!app || !app->bus_name || !app->bus || !config_get_int("ui_atspi_direct"))
+		return;
+
+	if (!peers)
+		peers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, peer_free);
+
+	AtspiPeer *peer = g_hash_table_lookup(peers, app->bus_name);
+	if (peer && (!peer->direct || dbus_connection_get_is_connected(peer->direct)))
+		return;
+
+	/*
+	 * A new application, or one whose connection dropped: evict the
+	 * peers of applications that have exited (and this one's), so the
+	 * table only holds the applications that are still running
+	 */
+	g_hash_table_foreach_remove(peers, peer_lost, NULL);
+
+	peer = g_new0(AtspiPeer, 1);
+	peer->app = g_object_ref(app);
+	if (!peer_connect(peer)) {
+		/* Not asked again, and kept without holding on to the application */
+		g_object_unref(peer->app);
+		peer->app = NULL;
+		bus_only_peers++;
+	}
+
+	g_hash_table_insert(peers, g_strdup(app->bus_name), peer);
+}
+
+gboolean atspi_transport_latency(AtspiAccessible *accessible, gdouble *bus_ms,
+				 gdouble *direct_ms)
+{
+	AtspiPeer *peer = lookup_peer(accessible);
+
+	if (!peer || !peer->direct)
+		return FALSE;
+
+	if (bus_ms)
+		*bus_ms = peer->bus_ms;
+	if (direct_ms)
+		*direct_ms = peer->direct_ms;
+	return TRUE;
+}
+
+void atspi_transport_cleanup(void)
+{
+	if (peers) {
+		g_hash_table_destroy(peers);
+		peers = NULL;
+	}
+}
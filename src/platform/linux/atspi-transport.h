@@ -0,0 +1,33 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Direct (peer-to-peer) D-Bus connections to AT-SPI applications
+ */
+
+#ifndef ATSPI_TRANSPORT_H
+#define ATSPI_TRANSPORT_H
+
+#include <at-spi-2.0/atspi/atspi.h>
+#include <glib.h>
+
+/*
+ * Route the calls to the application of accessible over a direct
+ * connection, if the application offers one (safe to call repeatedly).
+ * The connection is kept for later detections. Connections that have
+ * dropped (the application exited) are closed when an application is
+ * attached; a still running application then gets a new connection.
+ */
+void atspi_transport_attach(AtspiAccessible *accessible);
+
+/*
+ * Get the round trip times measured when the direct connection of the
+ * application of accessible was opened. Returns FALSE if its calls go
+ * through the bus daemon.
+ */
+gboolean atspi_transport_latency(AtspiAccessible *accessible, gdouble *bus_ms,
+				 gdouble *direct_ms);
+
+/* Close all direct connections */
+void atspi_transport_cleanup(void);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Best-first walk scoring
+ *
+ * The walker expands the highest-scoring node first. The score only
+ * depends on plain numbers so that bench/walk_recall.c can replay
+ * recorded trees with the very weights the detector uses.
+ */
+
+#ifndef ATSPI_WALK_H
+#define ATSPI_WALK_H
+
+#define WALK_ROLE_SCORE 64     /* Per level of role interactivity */
+#define WALK_DEPTH_PENALTY 4   /* Per tree level */
+
+/*
+ * Score a node by role interactivity (0-2), tree depth and the log2 of
+ * its visible area in pixels
+ */
+static inline int atspi_walk_score(int interactivity, int depth, unsigned long area)
+{
+	int area_bits = 0;
+
+	/* Bits needed to hold area (g_bit_storage()) */
+	do {
+		area_bits++;
+		area >>= 1;
+	} while (area);
+
+	return interactivity * WALK_ROLE_SCORE - depth * WALK_DEPTH_PENALTY + area_bits;
+}
+
+#endif
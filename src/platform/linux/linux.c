@@ -4,6 +4,7 @@
 
 void x_init(struct platform *platform);
 void wayland_init(struct platform *platform);
+int linux_run_detector_helper(void);
 
 #ifndef WARPD_X
 void x_init(struct platform *platform)
@@ -23,7 +24,7 @@ void wayland_init(struct platform *platform)
 
 void platform_run(int (*main) (struct platform *platform))
 {
-	struct platform platform;
+	struct platform platform = {0};
 
 	if (getenv("WAYLAND_DISPLAY"))
 		wayland_init(&platform);
@@ -32,3 +33,9 @@ void platform_run(int (*main) (struct platform *platform))
 
 	exit(main(&platform));
 }
+
+int platform_run_detector_helper(void)
+{
+	/* AT-SPI needs no display connection */
+	return linux_run_detector_helper();
+}
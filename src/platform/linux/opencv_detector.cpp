@@ -17,6 +17,8 @@ extern "C" {
 extern const char *config_get(const char *key);
 extern int config_get_int(const char *key);
 
+extern struct platform *platform;
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,56 +28,417 @@ extern int config_get_int(const char *key);
 #include <vector>
 #include <algorithm>
 #include <cstdlib>  // for atof
+#include <cstring>
+
+#include <mutex>
 
 // Forward declarations for platform-specific screen capture
 #ifdef WARPD_X
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 extern "C" Display *dpy; // From X.c
-static cv::Mat capture_screenshot_x11();
+static cv::Mat capture_screenshot_x11(cv::Rect &region, opencv_tile_cache **cache);
 #endif
 
 #ifdef WARPD_WAYLAND
 static cv::Mat capture_screenshot_wayland();
 #endif
 
+/*
+ * The captured image may point into a buffer that is reused by the next
+ * capture, so it is held until detection is done with it.
+ */
+static std::mutex capture_lock;
+
 #ifdef WARPD_X
+/*
+ * Capture state, kept across runs. Detection runs on a worker thread, so
+ * it gets its own connection instead of sharing the UI thread's dpy.
+ */
+static struct {
+    Display *dpy;
+    int shm_available;
+    int shm_error;
+    XShmSegmentInfo shminfo;
+    size_t shm_size; // Size of the attached segment, 0 if none
+
+    /*
+     * Mirror of the root window at the start of the segment, kept up to
+     * date from XDamage. The segment has room for a second copy behind
+     * it, into which the damaged rectangles are fetched.
+     */
+    int damage_available;
+    Damage damage;
+    int mirror_valid;
+    int mirror_w, mirror_h;
+    int mirror_stride;
+    int damage_rects;         // Damaged rectangles fetched by the last capture
+    opencv_tile_cache *tiles; // Contours of the mirror's tiles
+} capture;
+
+// More damaged rectangles than this and the whole region is refreshed
+#define MAX_DAMAGE_RECTS 256
+
+static XErrorHandler previous_error_handler;
+
 /**
- * Capture screenshot using X11 and convert to cv::Mat
+ * Record errors on the capture connection, pass the others on
  */
-static cv::Mat capture_screenshot_x11()
+static int capture_error_handler(Display *d, XErrorEvent *ev)
 {
-    Window root = DefaultRootWindow(dpy);
-    XWindowAttributes attrs;
+    if (d == capture.dpy) {
+        capture.shm_error = 1;
+        return 0;
+    }
 
-    XGetWindowAttributes(dpy, root, &attrs);
+    return previous_error_handler ? previous_error_handler(d, ev) : 0;
+}
 
-    XImage *ximg = XGetImage(dpy, root, 0, 0, attrs.width, attrs.height,
-                              AllPlanes, ZPixmap);
-    if (!ximg) {
+/*
+ * Installed once by x_init() before any thread runs, swapping the
+ * process-wide handler from the detection thread would race with the
+ * UI thread's swaps.
+ */
+extern "C" void x_opencv_capture_init()
+{
+    previous_error_handler = XSetErrorHandler(capture_error_handler);
+}
+
+static int open_capture_display()
+{
+    if (capture.dpy)
+        return 1;
+
+    capture.dpy = XOpenDisplay(DisplayString(dpy));
+    if (!capture.dpy) {
+        fprintf(stderr, "OpenCV: Failed to open capture connection to %s\n", DisplayString(dpy));
+        return 0;
+    }
+
+    capture.shm_available = XShmQueryExtension(capture.dpy);
+
+    int event_base, error_base, major = 0, minor = 0;
+    capture.damage_available =
+        XDamageQueryExtension(capture.dpy, &event_base, &error_base) &&
+        XDamageQueryVersion(capture.dpy, &major, &minor) &&
+        XFixesQueryExtension(capture.dpy, &event_base, &error_base) &&
+        XFixesQueryVersion(capture.dpy, &major, &minor) && major >= 2;
+
+    return 1;
+}
+
+static void release_shm_segment()
+{
+    if (!capture.shm_size)
+        return;
+
+    XShmDetach(capture.dpy, &capture.shminfo);
+    XSync(capture.dpy, False);
+    shmdt(capture.shminfo.shmaddr);
+    capture.shm_size = 0;
+}
+
+/**
+ * Attach a segment of size bytes shared with the server
+ */
+static int attach_shm_segment(size_t size)
+{
+    capture.shminfo.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (capture.shminfo.shmid < 0)
+        return 0;
+
+    capture.shminfo.shmaddr = (char *)shmat(capture.shminfo.shmid, NULL, 0);
+    if (capture.shminfo.shmaddr == (char *)-1) {
+        shmctl(capture.shminfo.shmid, IPC_RMID, NULL);
+        return 0;
+    }
+    capture.shminfo.readOnly = False;
+
+    // Attaching fails asynchronously, e.g. on a remote display
+    capture.shm_error = 0;
+    XShmAttach(capture.dpy, &capture.shminfo);
+    XSync(capture.dpy, False);
+
+    // Freed by the kernel once both sides have detached
+    shmctl(capture.shminfo.shmid, IPC_RMID, NULL);
+
+    if (capture.shm_error) {
+        shmdt(capture.shminfo.shmaddr);
+        return 0;
+    }
+
+    capture.shm_size = size;
+    return 1;
+}
+
+/**
+ * Capture region through MIT-SHM
+ *
+ * The segment is sized for the whole root window, so that any region
+ * fits without reattaching; only the XImage header (no server round
+ * trip) is made for each capture. Returns an empty cv::Mat if MIT-SHM
+ * cannot be used.
+ */
+static cv::Mat capture_shm_x11(Window root, const cv::Rect &region, int root_w, int root_h)
+{
+    int screen = DefaultScreen(capture.dpy);
+    XImage *ximg = XShmCreateImage(capture.dpy, DefaultVisual(capture.dpy, screen),
+                                   DefaultDepth(capture.dpy, screen), ZPixmap, NULL,
+                                   &capture.shminfo, region.width, region.height);
+    if (!ximg)
+        return cv::Mat();
+
+    // Wrapped as CV_8UC4 as is, other layouts take the copying path
+    if (ximg->bits_per_pixel != 32) {
+        XDestroyImage(ximg);
         return cv::Mat();
     }
 
-    // Create cv::Mat from XImage
-    cv::Mat img(attrs.height, attrs.width, CV_8UC4);
+    // bytes_per_line of the full width bounds that of any region
+    size_t needed = (size_t)ximg->bytes_per_line * region.height;
+    size_t full = (size_t)root_w * root_h * 4;
+    if (capture.shm_size < needed) {
+        release_shm_segment();
+        if (!attach_shm_segment(std::max(needed, full))) {
+            XDestroyImage(ximg);
+            return cv::Mat();
+        }
+    }
+    ximg->data = capture.shminfo.shmaddr;
+
+    cv::Mat img;
+    if (XShmGetImage(capture.dpy, root, ximg, region.x, region.y, AllPlanes))
+        img = cv::Mat(region.height, region.width, CV_8UC4, capture.shminfo.shmaddr,
+                      ximg->bytes_per_line);
+
+    XDestroyImage(ximg); // Frees the header only
+    return img;
+}
+
+/**
+ * Fetch a rectangle of the root window into the mirror
+ */
+static int update_mirror(Window root, int x, int y, int width, int height)
+{
+    int screen = DefaultScreen(capture.dpy);
+    XImage *ximg = XShmCreateImage(capture.dpy, DefaultVisual(capture.dpy, screen),
+                                   DefaultDepth(capture.dpy, screen), ZPixmap, NULL,
+                                   &capture.shminfo, width, height);
+    if (!ximg)
+        return 0;
+
+    // The server packs the rows, they are spread out to the mirror's stride
+    char *mirror = capture.shminfo.shmaddr;
+    char *scratch = mirror + (size_t)capture.mirror_stride * capture.mirror_h;
+    ximg->data = scratch;
+
+    int ok = XShmGetImage(capture.dpy, root, ximg, x, y, AllPlanes);
+    if (ok) {
+        for (int row = 0; row < height; row++) {
+            memcpy(mirror + (size_t)(y + row) * capture.mirror_stride + (size_t)x * 4,
+                   scratch + (size_t)row * ximg->bytes_per_line, (size_t)width * 4);
+        }
+    }
+
+    XDestroyImage(ximg);
+    return ok;
+}
+
+/**
+ * Capture region from the mirror
+ *
+ * The first capture (and one after the screen size changed) fetches the
+ * whole root window, later ones only what XDamage reported changed inside
+ * region since; damage elsewhere stays with the server until a capture
+ * covers it. The damaged rectangles are dropped from the tile cache, so
+ * detection only redoes the tiles that changed. Returns an empty cv::Mat
+ * if the mirror cannot be used.
+ */
+static cv::Mat capture_mirror_x11(Window root, const cv::Rect &region, int root_w, int root_h)
+{
+    if (!capture.tiles)
+        capture.tiles = opencv_tile_cache_new();
+
+    if (!capture.damage)
+        capture.damage = XDamageCreate(capture.dpy, root, XDamageReportNonEmpty);
+
+    if (!capture.mirror_valid || capture.mirror_w != root_w || capture.mirror_h != root_h) {
+        int screen = DefaultScreen(capture.dpy);
+        XImage *ximg = XShmCreateImage(capture.dpy, DefaultVisual(capture.dpy, screen),
+                                       DefaultDepth(capture.dpy, screen), ZPixmap, NULL,
+                                       &capture.shminfo, root_w, root_h);
+        if (!ximg)
+            return cv::Mat();
+
+        int stride = ximg->bytes_per_line;
+        int bpp = ximg->bits_per_pixel;
+        XDestroyImage(ximg);
+        if (bpp != 32)
+            return cv::Mat();
+
+        // Mirror and scratch copy
+        size_t needed = (size_t)stride * root_h * 2;
+        if (capture.shm_size < needed) {
+            release_shm_segment();
+            if (!attach_shm_segment(needed))
+                return cv::Mat();
+        }
+
+        capture.mirror_w = root_w;
+        capture.mirror_h = root_h;
+        capture.mirror_stride = stride;
+        opencv_tile_cache_clear(capture.tiles);
+
+        // Damage from before the full fetch is moot
+        XDamageSubtract(capture.dpy, capture.damage, None, None);
+        capture.mirror_valid = update_mirror(root, 0, 0, root_w, root_h);
+        capture.damage_rects = 0;
+        if (!capture.mirror_valid)
+            return cv::Mat();
+    } else {
+        // Take the damage inside region, leave the rest for later captures
+        XRectangle area = { (short)region.x, (short)region.y,
+                            (unsigned short)region.width, (unsigned short)region.height };
+        XserverRegion repair = XFixesCreateRegion(capture.dpy, &area, 1);
+        XserverRegion parts = XFixesCreateRegion(capture.dpy, NULL, 0);
+        XDamageSubtract(capture.dpy, capture.damage, repair, parts);
+
+        int n = 0;
+        XRectangle *rects = XFixesFetchRegion(capture.dpy, parts, &n);
+        XFixesDestroyRegion(capture.dpy, parts);
+        XFixesDestroyRegion(capture.dpy, repair);
+
+        if (n > MAX_DAMAGE_RECTS) {
+            opencv_tile_cache_invalidate(capture.tiles, region);
+            capture.mirror_valid = update_mirror(root, region.x, region.y,
+                                                 region.width, region.height);
+        } else {
+            for (int i = 0; i < n && capture.mirror_valid; i++) {
+                cv::Rect damage = cv::Rect(rects[i].x, rects[i].y, rects[i].width,
+                                           rects[i].height) & region;
+                if (damage.area() <= 0)
+                    continue;
+
+                opencv_tile_cache_invalidate(capture.tiles, damage);
+                capture.mirror_valid = update_mirror(root, damage.x, damage.y,
+                                                     damage.width, damage.height);
+            }
+        }
+
+        if (rects)
+            XFree(rects);
+
+        capture.damage_rects = n;
+        if (!capture.mirror_valid)
+            return cv::Mat();
+    }
+
+    // The notifications only say that there is damage, it was fetched above
+    while (XPending(capture.dpy)) {
+        XEvent ev;
+        XNextEvent(capture.dpy, &ev);
+    }
 
-    for (int y = 0; y < attrs.height; y++) {
-        for (int x = 0; x < attrs.width; x++) {
-            unsigned long pixel = XGetPixel(ximg, x, y);
+    cv::Mat mirror(root_h, root_w, CV_8UC4, capture.shminfo.shmaddr, capture.mirror_stride);
+    return mirror(region);
+}
 
-            // Extract RGBA
-            unsigned char b = (pixel & 0xFF);
-            unsigned char g = (pixel >> 8) & 0xFF;
-            unsigned char r = (pixel >> 16) & 0xFF;
+/**
+ * Capture region through XGetImage into a freshly allocated cv::Mat
+ */
+static cv::Mat capture_copy_x11(Window root, const cv::Rect &region)
+{
+    XImage *ximg = XGetImage(capture.dpy, root, region.x, region.y, region.width,
+                             region.height, AllPlanes, ZPixmap);
+    if (!ximg) {
+        return cv::Mat();
+    }
 
-            // Set BGRA
-            img.at<cv::Vec4b>(y, x) = cv::Vec4b(b, g, r, 255);
+    cv::Mat img;
+    if (ximg->bits_per_pixel == 32) {
+        img = cv::Mat(region.height, region.width, CV_8UC4, ximg->data,
+                      ximg->bytes_per_line).clone();
+    } else {
+        img.create(region.height, region.width, CV_8UC4);
+
+        for (int y = 0; y < region.height; y++) {
+            for (int x = 0; x < region.width; x++) {
+                unsigned long pixel = XGetPixel(ximg, x, y);
+
+                // Extract RGBA
+                unsigned char b = (pixel & 0xFF);
+                unsigned char g = (pixel >> 8) & 0xFF;
+                unsigned char r = (pixel >> 16) & 0xFF;
+
+                // Set BGRA
+                img.at<cv::Vec4b>(y, x) = cv::Vec4b(b, g, r, 255);
+            }
         }
     }
 
     XDestroyImage(ximg);
     return img;
 }
+
+/**
+ * Capture a region of the screen using X11 and convert to cv::Mat
+ *
+ * region is clipped to the root window (an empty region captures all of
+ * it) and updated to what was captured. With MIT-SHM the server writes
+ * straight into a segment that is reused across runs and the returned
+ * cv::Mat is only a header over it, valid until the next capture. With
+ * XDamage the segment mirrors the screen and *cache is set to the tile
+ * cache that goes with it. Must be called with capture_lock held.
+ */
+static cv::Mat capture_screenshot_x11(cv::Rect &region, opencv_tile_cache **cache)
+{
+    if (!open_capture_display())
+        return cv::Mat();
+
+    Window root = DefaultRootWindow(capture.dpy);
+    XWindowAttributes attrs;
+
+    if (!XGetWindowAttributes(capture.dpy, root, &attrs))
+        return cv::Mat();
+
+    cv::Rect bounds(0, 0, attrs.width, attrs.height);
+    region = region.area() > 0 ? (region & bounds) : bounds;
+    if (region.area() <= 0)
+        return cv::Mat();
+
+    if (capture.shm_available && capture.damage_available &&
+        config_get_int("opencv_incremental")) {
+        cv::Mat img = capture_mirror_x11(root, region, attrs.width, attrs.height);
+        if (!img.empty()) {
+            *cache = capture.tiles;
+            return img;
+        }
+
+        fprintf(stderr, "OpenCV: Screen mirror unavailable, capturing in full\n");
+        capture.damage_available = 0;
+        capture.mirror_valid = 0;
+    }
+
+    if (capture.shm_available) {
+        // Overwrites the mirror
+        capture.mirror_valid = 0;
+
+        cv::Mat img = capture_shm_x11(root, region, attrs.width, attrs.height);
+        if (!img.empty())
+            return img;
+
+        fprintf(stderr, "OpenCV: MIT-SHM capture unavailable, using XGetImage\n");
+        release_shm_segment();
+        capture.shm_available = 0;
+    }
+
+    return capture_copy_x11(root, region);
+}
 #endif
 
 #ifdef WARPD_WAYLAND
@@ -97,17 +460,24 @@ static cv::Mat capture_screenshot_wayland()
 
 /**
  * Capture screenshot using the appropriate method for the current session
+ *
+ * region is the area to capture (empty for the whole screen), updated to
+ * the area actually captured. *cache is set to a tile cache that is kept
+ * in step with the screen contents, if the platform can provide one.
  */
-static cv::Mat capture_screenshot_linux()
+static cv::Mat capture_screenshot_linux(cv::Rect &region, opencv_tile_cache **cache)
 {
+    *cache = NULL;
+
 #ifdef WARPD_X
     if (dpy) {
-        return capture_screenshot_x11();
+        return capture_screenshot_x11(region, cache);
     }
 #endif
 
 #ifdef WARPD_WAYLAND
     // TODO: Add runtime Wayland detection
+    region = cv::Rect();
     return capture_screenshot_wayland();
 #endif
 
@@ -118,6 +488,21 @@ static cv::Mat capture_screenshot_linux()
 // C interface functions
 extern "C" {
 
+/**
+ * Get the area to detect in, empty for the whole screen
+ */
+static cv::Rect target_region()
+{
+    int x, y, w, h;
+
+    if (!config_get_int("opencv_active_window_only") ||
+        !platform || !platform->active_window_region ||
+        !platform->active_window_region(&x, &y, &w, &h))
+        return cv::Rect();
+
+    return cv::Rect(x, y, w, h);
+}
+
 /**
  * Check if OpenCV is available
  */
@@ -142,7 +527,7 @@ int opencv_is_available(void)
  * Detect UI elements using OpenCV on Linux
  * Supports configurable detection modes: strict, relaxed, auto
  */
-struct ui_detection_result *opencv_detect_ui_elements(void)
+struct ui_detection_result *opencv_detect_ui_elements(const struct ui_cancel_token *cancel)
 {
     struct ui_detection_result *result =
         (struct ui_detection_result *)calloc(1, sizeof(struct ui_detection_result));
@@ -163,22 +548,50 @@ struct ui_detection_result *opencv_detect_ui_elements(void)
         fprintf(stderr, "  OpenCV UI Detection Debug Output (%s)\n", backend);
         fprintf(stderr, "========================================\n");
 
-        // Capture screenshot
-        cv::Mat screenshot = capture_screenshot_linux();
-        if (screenshot.empty()) {
-            result->error = -1;
-            snprintf(result->error_msg, sizeof(result->error_msg),
-                     "Failed to capture %s screenshot", backend);
-            return result;
+        std::vector<cv::Rect> rects;
+        cv::Rect region = target_region();
+        uint64_t window = platform && platform->active_window_id ? platform->active_window_id() : 0;
+        {
+            std::lock_guard<std::mutex> lock(capture_lock);
+
+            // Capture screenshot
+            opencv_tile_cache *cache;
+            cv::Mat screenshot = capture_screenshot_linux(region, &cache);
+            if (screenshot.empty()) {
+                result->error = -1;
+                snprintf(result->error_msg, sizeof(result->error_msg),
+                         "Failed to capture %s screenshot", backend);
+                return result;
+            }
+
+            char detail[64] = "";
+#ifdef WARPD_X
+            if (cache)
+                snprintf(detail, sizeof(detail), ", %d damaged rectangles refetched",
+                         capture.damage_rects);
+#endif
+            fprintf(stderr, "\nStep 0: Captured %s screenshot (%dx%d at %d,%d%s)\n", backend,
+                    screenshot.cols, screenshot.rows, region.x, region.y, detail);
+
+            // Windows switched back to are often unchanged
+            uint64_t hash = opencv_image_hash(screenshot);
+            if (!opencv_result_cache_lookup(window, hash, rects)) {
+                // Detect rectangles using OpenCV
+                rects = detect_rectangles(screenshot, cancel, cache, cv::Point(region.x, region.y));
+                if (!ui_cancel_requested(cancel))
+                    opencv_result_cache_store(window, hash, rects);
+            }
         }
 
-        fprintf(stderr, "\nStep 0: Captured %s screenshot (%dx%d)\n", backend, screenshot.cols, screenshot.rows);
-
-        // Detect rectangles using OpenCV
-        std::vector<cv::Rect> rects = detect_rectangles(screenshot);
-
         fprintf(stderr, "\n");
 
+        if (ui_cancel_requested(cancel)) {
+            result->error = UI_DETECTION_CANCELLED;
+            snprintf(result->error_msg, sizeof(result->error_msg),
+                     "Detection cancelled");
+            return result;
+        }
+
         if (rects.empty()) {
             result->error = -2;
             snprintf(result->error_msg, sizeof(result->error_msg),
@@ -209,10 +622,10 @@ struct ui_detection_result *opencv_detect_ui_elements(void)
             return result;
         }
 
-        // Copy rectangles to result
+        // Copy rectangles to result, in screen coordinates
         for (size_t i = 0; i < rects.size(); i++) {
-            result->elements[i].x = rects[i].x;
-            result->elements[i].y = rects[i].y;
+            result->elements[i].x = rects[i].x + region.x;
+            result->elements[i].y = rects[i].y + region.y;
             result->elements[i].w = rects[i].width;
             result->elements[i].h = rects[i].height;
             result->elements[i].name = strdup("UI Element");
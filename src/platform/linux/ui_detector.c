@@ -6,84 +6,232 @@
 
 #include "../../platform.h"
 #include "../../common/detector_orchestrator.h"
+#include "../../common/ui_arena.h"
+#include "../../common/ui_element_queue.h"
 #include "atspi-detector.h"
+#include "atspi-helper.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <at-spi-2.0/atspi/atspi.h>
 #include <glib-2.0/glib.h>
 
 /* Forward declarations for OpenCV fallback (implemented separately) */
 #include "../../common/opencv_detector.h"
 
+/* Import config functions */
+extern int config_get_int(const char *key);
+
+extern struct platform *platform;
+
 /**
  * Convert AT-SPI ElementInfo to platform ui_element
+ *
+ * Strings are interned in arena, or copied with strdup() if arena is NULL.
  */
-static void convert_atspi_element(ElementInfo *src, struct ui_element *dest)
+static void convert_atspi_element(ElementInfo *src, struct ui_element *dest,
+				  struct ui_arena *arena)
 {
 	dest->x = src->x;
 	dest->y = src->y;
 	dest->w = src->w;
 	dest->h = src->h;
-	dest->name = src->name ? strdup(src->name) : NULL;
-	dest->role = src->role ? strdup(src->role) : NULL;
+
+	if (arena) {
+		dest->name = ui_arena_intern(arena, src->name);
+		dest->role = ui_arena_intern(arena, src->role);
+	} else {
+		dest->name = src->name ? strdup(src->name) : NULL;
+		dest->role = src->role ? strdup(src->role) : NULL;
+	}
+}
+
+/* The detectors keep global state, detections from different threads take turns */
+static pthread_mutex_t detect_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Queue of the streaming detection in progress (protected by detect_lock) */
+static struct ui_element_queue *stream_queue = NULL;
+
+/*
+ * Deferred name tables of freed results. Results are freed from any
+ * thread, but the AT-SPI objects may only be released while detect_lock
+ * is held.
+ */
+static pthread_mutex_t released_lock = PTHREAD_MUTEX_INITIALIZER;
+static GSList *released_names = NULL; /* GPtrArray of AtspiAccessible */
+
+/**
+ * Hand the deferred name table of result over for release
+ */
+static void release_deferred_names(struct ui_detection_result *result)
+{
+	if (!result || !result->deferred_names)
+		return;
+
+	pthread_mutex_lock(&released_lock);
+	released_names = g_slist_prepend(released_names, result->deferred_names);
+	pthread_mutex_unlock(&released_lock);
+
+	result->deferred_names = NULL;
 }
 
 /**
- * Detect UI elements using AT-SPI
+ * Release the deferred name tables handed over so far (detect_lock held)
+ */
+static void drain_released_names(void)
+{
+	pthread_mutex_lock(&released_lock);
+	GSList *tables = released_names;
+	released_names = NULL;
+	pthread_mutex_unlock(&released_lock);
+
+	g_slist_free_full(tables, (GDestroyNotify)g_ptr_array_unref);
+}
+
+/**
+ * Publish a batch of AT-SPI elements to the stream queue
  */
-static struct ui_detection_result *atspi_detect_ui_elements(void)
+static void stream_atspi_elements(GSList *elements)
+{
+	size_t count = g_slist_length(elements);
+	struct ui_element *batch = calloc(count, sizeof(struct ui_element));
+	if (!batch)
+		return;
+
+	GSList *iter = elements;
+	for (size_t i = 0; i < count; i++, iter = iter->next)
+		convert_atspi_element(iter->data, &batch[i], NULL);
+
+	if (!ui_element_queue_push(stream_queue, batch, count)) {
+		/* The final result still has these elements */
+		struct ui_element_batch dropped = { batch, count };
+		ui_element_batch_free(&dropped);
+	}
+}
+
+static struct ui_detection_result *atspi_error_result(int error, const char *msg)
 {
 	struct ui_detection_result *result = calloc(1, sizeof(*result));
 	if (!result)
 		return NULL;
 
+	result->error = error;
+	snprintf(result->error_msg, sizeof(result->error_msg), "%s", msg);
+	return result;
+}
+
+/**
+ * Copy AT-SPI elements into an arena-backed result
+ *
+ * The result, its element array and the interned strings share one arena,
+ * sized up front so that it usually is a single allocation.
+ */
+static struct ui_detection_result *build_arena_result(GSList *element_list, size_t count)
+{
+	size_t bytes = sizeof(struct ui_detection_result) + count * sizeof(struct ui_element);
+	/* One result plus one element array, then one strdup() per string */
+	size_t legacy_allocations = 2;
+
+	for (GSList *iter = element_list; iter; iter = iter->next) {
+		ElementInfo *elem = iter->data;
+		if (elem->name) {
+			bytes += strlen(elem->name) + 1;
+			legacy_allocations++;
+		}
+		if (elem->role) {
+			bytes += strlen(elem->role) + 1;
+			legacy_allocations++;
+		}
+	}
+
+	/* Intern tables (grown by doubling, at most two strings per element) */
+	bytes += 8 * count * sizeof(char *);
+
+	struct ui_arena *arena = ui_arena_create(bytes);
+	if (!arena)
+		return NULL;
+
+	struct ui_detection_result *result = ui_arena_alloc(arena, sizeof(*result));
+	if (result)
+		result->elements = ui_arena_alloc(arena, count * sizeof(struct ui_element));
+	if (!result || !result->elements) {
+		ui_arena_destroy(arena);
+		return NULL;
+	}
+
+	result->arena = arena;
+	result->shared_strings = 1;
+
+	GSList *iter = element_list;
+	GPtrArray *deferred = NULL;
+	for (size_t i = 0; i < count && iter; i++, iter = iter->next) {
+		ElementInfo *elem = iter->data;
+
+		convert_atspi_element(elem, &result->elements[i], arena);
+
+		/* Unnamed elements keep their node until the name is looked up */
+		if (!elem->name && elem->node) {
+			if (!deferred)
+				deferred = g_ptr_array_new_with_free_func(g_object_unref);
+			g_ptr_array_add(deferred, g_object_ref(elem->node));
+			result->elements[i].source = elem->node;
+		}
+	}
+	result->count = count;
+	result->deferred_names = deferred;
+
+	struct ui_arena_stats stats;
+	ui_arena_get_stats(arena, &stats);
+	fprintf(stderr, "AT-SPI: Allocations: %zu before, %zu after (%zu strings, %zu unique, %zu bytes)\n",
+	        legacy_allocations, stats.blocks, stats.strings,
+	        stats.unique_strings, stats.bytes);
+
+	return result;
+}
+
+/**
+ * Detect UI elements using AT-SPI
+ */
+static struct ui_detection_result *atspi_detect_ui_elements(const struct detector_limits *limits,
+							    const struct ui_cancel_token *cancel)
+{
 	/* Initialize AT-SPI */
 	atspi_init_detector();
 
-	/* Detect elements using AT-SPI */
-	GSList *element_list = detect_elements();
+	/* Detect elements using AT-SPI (bounded by ui_detection_timeout) */
+	gboolean partial = FALSE;
+	GSList *element_list = detect_elements(limits->max_depth, limits->max_elements,
+					       &partial, cancel);
+	if (ui_cancel_requested(cancel)) {
+		free_detector_resources();
+		return ui_cancelled_result();
+	}
 	if (!element_list) {
-		snprintf(result->error_msg, sizeof(result->error_msg),
-		         "No active window or AT-SPI not available");
-		result->error = -1;
-		return result;
+		if (partial)
+			return atspi_error_result(-1, "AT-SPI detection timed out");
+		return atspi_error_result(-1, "No active window or AT-SPI not available");
 	}
 
 	/* Convert GSList to array */
 	size_t count = g_slist_length(element_list);
 	if (count == 0) {
-		result->error = -2;
-		snprintf(result->error_msg, sizeof(result->error_msg),
-		         "No interactive elements detected");
 		free_detector_resources();
-		return result;
-	}
-
-	result->elements = calloc(count, sizeof(struct ui_element));
-	if (!result->elements) {
-		result->error = -3;
-		snprintf(result->error_msg, sizeof(result->error_msg),
-		         "Memory allocation failed");
-		free_detector_resources();
-		return result;
-	}
-
-	/* Copy elements */
-	GSList *iter = element_list;
-	for (size_t i = 0; i < count && iter; i++, iter = iter->next) {
-		ElementInfo *elem = (ElementInfo *)iter->data;
-		if (elem) {
-			convert_atspi_element(elem, &result->elements[i]);
-		}
+		return atspi_error_result(-2, "No interactive elements detected");
 	}
 
-	result->count = count;
-	result->error = 0;
+	struct ui_detection_result *result = build_arena_result(element_list, count);
 
 	/* Cleanup AT-SPI resources */
 	free_detector_resources();
 
+	if (!result)
+		return atspi_error_result(-3, "Memory allocation failed");
+
+	result->partial = partial;
+	result->max_depth_reached = atspi_max_depth_reached();
+	result->error = 0;
+
 	return result;
 }
 
@@ -100,47 +248,154 @@ static int atspi_is_available(void)
  */
 static void atspi_free_ui_elements(struct ui_detection_result *result)
 {
-	if (!result)
+	if (atspi_helper_free(result))
 		return;
 
-	if (result->elements) {
-		for (size_t i = 0; i < result->count; i++) {
-			if (result->elements[i].name)
-				free(result->elements[i].name);
-			if (result->elements[i].role)
-				free(result->elements[i].role);
-		}
-		free(result->elements);
+	/* AT-SPI results are arena-backed */
+	release_deferred_names(result);
+	free_detection_result(result);
+}
+
+/**
+ * Detect UI elements with AT-SPI in the warpd-detectd helper
+ *
+ * Falls back to detecting in-process if the helper cannot be started.
+ */
+static struct ui_detection_result *atspi_detect_in_helper(const struct detector_limits *limits,
+							  const struct ui_cancel_token *cancel)
+{
+	struct ui_detection_result *result = atspi_helper_detect(limits, stream_queue, cancel);
+	if (result)
+		return result;
+
+	fprintf(stderr, "AT-SPI: Detector helper unavailable, detecting in-process\n");
+	return atspi_detect_ui_elements(limits, cancel);
+}
+
+/**
+ * Detect UI elements using OpenCV (which has no tree to limit)
+ */
+static struct ui_detection_result *opencv_detect(const struct detector_limits *limits,
+						 const struct ui_cancel_token *cancel)
+{
+	(void)limits;
+	return opencv_detect_ui_elements(cancel);
+}
+
+/**
+ * Look up the names detection deferred, in the elements' original order
+ *
+ * Must be called with detect_lock held unless the helper owns result.
+ */
+static int resolve_deferred_names(struct ui_detection_result *result,
+				  const struct ui_cancel_token *cancel)
+{
+	int resolved = 0;
+
+	if (atspi_helper_owns(result))
+		return atspi_helper_resolve_names(result, cancel);
+
+	for (size_t i = 0; result && result->deferred_names && i < result->count; i++) {
+		struct ui_element *element = &result->elements[i];
+
+		if (ui_cancel_requested(cancel))
+			break;
+		if (!element->source || element->name)
+			continue;
+
+		gchar *name = atspi_element_name((AtspiAccessible *)element->source);
+		if (result->arena)
+			element->name = ui_arena_intern(result->arena, name);
+		else
+			element->name = strdup(name);
+		g_free(name);
+
+		element->source = NULL;
+		resolved++;
 	}
 
-	free(result);
+	return resolved;
 }
 
 /**
  * Detect UI elements with AT-SPI primary, OpenCV fallback
  */
-struct ui_detection_result *linux_detect_ui_elements(void)
+static struct ui_detection_result *run_strategies(const struct ui_cancel_token *cancel)
 {
 	/* Define detection strategies in order of preference */
 	detector_strategy_t strategies[] = {
 		{
 			.name = "AT-SPI",
 			.is_available = atspi_is_available,
-			.detect = atspi_detect_ui_elements,
+			.detect = config_get_int("ui_detector_helper") ?
+				  atspi_detect_in_helper : atspi_detect_ui_elements,
 			.free_result = atspi_free_ui_elements,
+			.resolve_names = resolve_deferred_names,
 			.min_elements = 0,  /* Accept any number of elements from AT-SPI */
 		},
 		{
 			.name = "OpenCV",
 			.is_available = opencv_is_available,
-			.detect = opencv_detect_ui_elements,
+			.detect = opencv_detect,
 			.free_result = opencv_free_ui_elements,
 			.min_elements = 0,  /* Accept any number of elements from OpenCV */
 		},
 	};
 
+	/* Detection profiles are kept per window class */
+	char app[64];
+	int have_app = platform && platform->active_window_class &&
+		       platform->active_window_class(app, sizeof(app));
+
 	/* Run detection through strategy chain */
-	return detector_orchestrator_run(strategies, 2, "Linux");
+	return detector_orchestrator_run(strategies, 2, "Linux", have_app ? app : NULL, cancel);
+}
+
+struct ui_detection_result *linux_detect_ui_elements(const struct ui_cancel_token *cancel)
+{
+	pthread_mutex_lock(&detect_lock);
+	drain_released_names();
+	struct ui_detection_result *result = run_strategies(cancel);
+	pthread_mutex_unlock(&detect_lock);
+
+	return result;
+}
+
+/**
+ * Detect UI elements, streaming AT-SPI elements to queue as they are found
+ *
+ * The OpenCV fallback finds everything at once, so its elements only
+ * arrive with the returned result.
+ */
+struct ui_detection_result *linux_detect_ui_elements_streaming(struct ui_element_queue *queue,
+							       const struct ui_cancel_token *cancel)
+{
+	pthread_mutex_lock(&detect_lock);
+	drain_released_names();
+	stream_queue = queue;
+	atspi_set_element_sink(stream_atspi_elements);
+
+	struct ui_detection_result *result = run_strategies(cancel);
+
+	atspi_set_element_sink(NULL);
+	stream_queue = NULL;
+	pthread_mutex_unlock(&detect_lock);
+
+	return result;
+}
+
+int linux_resolve_ui_element_names(struct ui_detection_result *result,
+				   const struct ui_cancel_token *cancel)
+{
+	if (atspi_helper_owns(result))
+		return atspi_helper_resolve_names(result, cancel);
+
+	pthread_mutex_lock(&detect_lock);
+	drain_released_names();
+	int resolved = resolve_deferred_names(result, cancel);
+	pthread_mutex_unlock(&detect_lock);
+
+	return resolved;
 }
 
 /**
@@ -148,18 +403,62 @@ struct ui_detection_result *linux_detect_ui_elements(void)
  */
 void linux_free_ui_elements(struct ui_detection_result *result)
 {
-	if (!result)
+	if (atspi_helper_free(result))
 		return;
 
-	if (result->elements) {
-		for (size_t i = 0; i < result->count; i++) {
-			if (result->elements[i].name)
-				free(result->elements[i].name);
-			if (result->elements[i].role)
-				free(result->elements[i].role);
-		}
-		free(result->elements);
-	}
+	release_deferred_names(result);
+	free_detection_result(result);
+}
+
+/**
+ * Send a batch of AT-SPI elements on to the daemon (helper side)
+ */
+static void forward_atspi_elements(GSList *elements)
+{
+	size_t count = g_slist_length(elements);
+	struct ui_element *batch = calloc(count, sizeof(struct ui_element));
+	if (!batch)
+		return;
+
+	GSList *iter = elements;
+	for (size_t i = 0; i < count; i++, iter = iter->next)
+		convert_atspi_element(iter->data, &batch[i], NULL);
+
+	atspi_helper_send_batch(batch, count);
+
+	struct ui_element_batch sent = { batch, count };
+	ui_element_batch_free(&sent);
+}
+
+/**
+ * AT-SPI detection on behalf of the daemon (helper side)
+ */
+static struct ui_detection_result *helper_detect(const struct detector_limits *limits,
+						 const struct ui_cancel_token *cancel)
+{
+	pthread_mutex_lock(&detect_lock);
+	drain_released_names();
+	if (atspi_helper_streaming())
+		atspi_set_element_sink(forward_atspi_elements);
+
+	struct ui_detection_result *result = atspi_detect_ui_elements(limits, cancel);
+
+	atspi_set_element_sink(NULL);
+	pthread_mutex_unlock(&detect_lock);
+
+	return result;
+}
+
+/**
+ * Serve AT-SPI detection to the daemon (warpd --detectd)
+ */
+int linux_run_detector_helper(void)
+{
+	static const struct atspi_helper_ops ops = {
+		.detect = helper_detect,
+		.resolve_names = linux_resolve_ui_element_names,
+		.free_result = atspi_free_ui_elements,
+	};
 
-	free(result);
+	return atspi_helper_serve(&ops);
 }
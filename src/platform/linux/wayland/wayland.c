@@ -7,8 +7,12 @@
 #include "wayland.h"
 
 /* UI element detector functions (implemented in ui_detector.c) */
-extern struct ui_detection_result *linux_detect_ui_elements(void);
+extern struct ui_detection_result *linux_detect_ui_elements(const struct ui_cancel_token *cancel);
+extern struct ui_detection_result *linux_detect_ui_elements_streaming(struct ui_element_queue *queue,
+								      const struct ui_cancel_token *cancel);
 extern void linux_free_ui_elements(struct ui_detection_result *result);
+extern int linux_resolve_ui_element_names(struct ui_detection_result *result,
+					  const struct ui_cancel_token *cancel);
 
 static void wayland_send_paste(void);
 
@@ -318,7 +322,9 @@ void wayland_init(struct platform *platform)
 
 	/* UI element detection for smart hint mode */
 	platform->detect_ui_elements = linux_detect_ui_elements;
+	platform->detect_ui_elements_streaming = linux_detect_ui_elements_streaming;
 	platform->free_ui_elements = linux_free_ui_elements;
+	platform->resolve_ui_element_names = linux_resolve_ui_element_names;
 	
 	/* Insert text mode */
 	platform->insert_text_mode = wayland_insert_text_mode;
@@ -601,16 +601,21 @@ static void accessibility_free_ui_elements(struct ui_detection_result *result)
 /**
  * Detect UI elements with Accessibility API primary, OpenCV fallback
  */
-struct ui_detection_result *macos_detect_ui_elements(void)
+struct ui_detection_result *macos_detect_ui_elements(const struct ui_cancel_token *cancel)
 {
     /* Try Accessibility API first */
     struct ui_detection_result *result = accessibility_detect_ui_elements();
 
+    if (ui_cancel_requested(cancel)) {
+        accessibility_free_ui_elements(result);
+        return ui_cancelled_result();
+    }
+
     /* If Accessibility API failed and OpenCV is available, try OpenCV fallback */
     if (result && result->error != 0 && opencv_is_available()) {
         fprintf(stderr, "Accessibility API failed (%s), falling back to OpenCV\n", result->error_msg);
         accessibility_free_ui_elements(result);
-        return opencv_detect_ui_elements();
+        return opencv_detect_ui_elements(cancel);
     }
 
     return result;
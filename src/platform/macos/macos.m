@@ -10,9 +10,9 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-	struct ui_detection_result *opencv_detect_ui_elements(void);
+	struct ui_detection_result *opencv_detect_ui_elements(const struct ui_cancel_token *cancel);
 	void opencv_free_ui_elements(struct ui_detection_result *result);
-	struct ui_detection_result *macos_detect_ui_elements(void);
+	struct ui_detection_result *macos_detect_ui_elements(const struct ui_cancel_token *cancel);
 	void macos_free_ui_elements(struct ui_detection_result *result);
 #ifdef __cplusplus
 }
@@ -328,3 +328,9 @@ void platform_run(int (*main)(struct platform *platform))
 
 	[NSApp run];
 }
+
+int platform_run_detector_helper(void)
+{
+	fprintf(stderr, "Detector helper not supported on this platform\n");
+	return -1;
+}
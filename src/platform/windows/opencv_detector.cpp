@@ -110,7 +110,7 @@ int opencv_is_available(void)
 /**
  * Detect UI elements using OpenCV on Windows
  */
-struct ui_detection_result *opencv_detect_ui_elements(void)
+struct ui_detection_result *opencv_detect_ui_elements(const struct ui_cancel_token *cancel)
 {
     try {
         // Capture screenshot
@@ -127,7 +127,9 @@ struct ui_detection_result *opencv_detect_ui_elements(void)
         }
 
         // Detect rectangles using OpenCV
-        std::vector<cv::Rect> rectangles = detect_rectangles(screenshot);
+        std::vector<cv::Rect> rectangles = detect_rectangles(screenshot, cancel);
+        if (ui_cancel_requested(cancel))
+            return ui_cancelled_result();
 
         // Convert to ui_elements
         return rectangles_to_ui_elements(rectangles, "Windows OpenCV");
@@ -14,7 +14,8 @@
 #include <stdbool.h>
 
 /* Forward declarations for UI Automation functions (implemented in C++) */
-extern struct ui_detection_result *uiautomation_detect_ui_elements(void);
+extern struct ui_detection_result *uiautomation_detect_ui_elements(const struct detector_limits *limits,
+								   const struct ui_cancel_token *cancel);
 extern void uiautomation_free_ui_elements(struct ui_detection_result *result);
 extern int uiautomation_is_available(void);
 extern void uiautomation_cleanup(void);
@@ -22,10 +23,20 @@ extern void uiautomation_cleanup(void);
 /* Forward declarations for OpenCV functions (implemented in C++) */
 #include "../../common/opencv_detector.h"
 
+/**
+ * Detect UI elements using OpenCV (which has no tree to limit)
+ */
+static struct ui_detection_result *opencv_detect(const struct detector_limits *limits,
+						 const struct ui_cancel_token *cancel)
+{
+	(void)limits;
+	return opencv_detect_ui_elements(cancel);
+}
+
 /**
  * Detect UI elements using Windows UI Automation with OpenCV fallback
  */
-struct ui_detection_result *windows_detect_ui_elements(void)
+struct ui_detection_result *windows_detect_ui_elements(const struct ui_cancel_token *cancel)
 {
 	/* Define detection strategies in order of preference */
 	detector_strategy_t strategies[] = {
@@ -39,14 +50,14 @@ struct ui_detection_result *windows_detect_ui_elements(void)
 		{
 			.name = "OpenCV",
 			.is_available = opencv_is_available,
-			.detect = opencv_detect_ui_elements,
+			.detect = opencv_detect,
 			.free_result = opencv_free_ui_elements,
 			.min_elements = 0,  /* Accept any number of elements from OpenCV */
 		},
 	};
 
 	/* Run detection through strategy chain */
-	return detector_orchestrator_run(strategies, 2, "Windows");
+	return detector_orchestrator_run(strategies, 2, "Windows", NULL, cancel);
 }
 
 /**
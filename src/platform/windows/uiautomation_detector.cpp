@@ -10,6 +10,7 @@ extern "C" {
 #endif
 
 #include "../../platform.h"
+#include "../../common/detector_orchestrator.h"
 
 // Import config functions from C
 extern const char *config_get(const char *key);
@@ -386,6 +387,7 @@ static DWORD g_last_progress_time = 0;
 static DWORD g_traversal_start_time = 0;
 static int g_max_traversal_time_ms = 5000;  // 5 second timeout
 static bool g_timeout_triggered = false;  // Flag to stop all recursion
+static const struct ui_cancel_token *g_cancel = nullptr;  // Stops traversal like the timeout
 
 /**
  * Dump UI tree to file for debugging
@@ -531,6 +533,12 @@ static void collect_elements_bfs(IUIAutomationElement* rootElement, std::vector<
                 break;
             }
         }
+
+        if (ui_cancel_requested(g_cancel)) {
+            g_timeout_triggered = true;
+            element->Release();
+            break;
+        }
         
         // Early stop if we have enough elements
         if (elements.size() >= (size_t)target_elements) {
@@ -657,6 +665,11 @@ static void collect_elements(IUIAutomationElement* element, std::vector<struct u
             return;
         }
     }
+
+    if (ui_cancel_requested(g_cancel)) {
+        g_timeout_triggered = true;
+        return;
+    }
     
     // Track maximum depth actually reached
     if (current_depth > max_depth_reached) {
@@ -737,7 +750,8 @@ int uiautomation_is_available(void)
 /**
  * Detect UI elements using Windows UI Automation
  */
-struct ui_detection_result *uiautomation_detect_ui_elements(void)
+struct ui_detection_result *uiautomation_detect_ui_elements(const struct detector_limits *limits,
+                                                            const struct ui_cancel_token *cancel)
 {
     struct ui_detection_result *result = 
         (struct ui_detection_result *)calloc(1, sizeof(struct ui_detection_result));
@@ -782,13 +796,12 @@ struct ui_detection_result *uiautomation_detect_ui_elements(void)
 
         // Read config values ONCE before traversal (not in the loop!)
         log_with_time("UI Automation: Reading config values...\n");
-        int max_depth = 10;
+        int max_depth = limits->max_depth;
         int min_width = 10;
         int min_height = 10;
         int min_area = 100;
         int timeout_ms = 5000;
         try {
-            max_depth = config_get_int("ui_max_depth");
             min_width = config_get_int("ui_min_width");
             min_height = config_get_int("ui_min_height");
             min_area = config_get_int("ui_min_area");
@@ -808,6 +821,7 @@ struct ui_detection_result *uiautomation_detect_ui_elements(void)
         max_depth_reached = 0;
         g_nodes_visited = 0;
         g_timeout_triggered = false;  // Reset timeout flag
+        g_cancel = cancel;
         DWORD startTime = GetTickCount();
         g_traversal_start_time = startTime;
         g_last_progress_time = startTime;
@@ -834,6 +848,18 @@ struct ui_detection_result *uiautomation_detect_ui_elements(void)
         
         DWORD endTime = GetTickCount();
         rootElement->Release();
+        g_cancel = nullptr;
+
+        if (ui_cancel_requested(cancel)) {
+            for (auto &elem : elements) {
+                free(elem.name);
+                free(elem.role);
+            }
+            result->error = UI_DETECTION_CANCELLED;
+            snprintf(result->error_msg, sizeof(result->error_msg),
+                     "Detection cancelled");
+            return result;
+        }
 
         log_with_time("UI Automation: Collection took %lu ms (visited %d nodes, depth: %d/%d, elements: %zu, limit: %d)%s\n", 
                 endTime - startTime, g_nodes_visited, max_depth_reached, max_depth, elements.size(), MAX_UI_ELEMENTS,
@@ -866,6 +892,7 @@ struct ui_detection_result *uiautomation_detect_ui_elements(void)
         }
 
         result->count = elements.size();
+        result->partial = g_timeout_triggered ? 1 : 0;
         result->error = 0;
 
         DWORD totalTime = GetTickCount() - t0;
@@ -577,7 +577,7 @@ static void commit()
 }
 
 /* UI element detector functions (implemented in ui_detector.c) */
-extern struct ui_detection_result *windows_detect_ui_elements(void);
+extern struct ui_detection_result *windows_detect_ui_elements(const struct ui_cancel_token *cancel);
 extern void windows_free_ui_elements(struct ui_detection_result *result);
 
 /* UI Automation cleanup function */
@@ -7,6 +7,10 @@
 #include "smart_hint/hint_renderer.h"
 #include "smart_hint/hint_input_handler.h"
 #include "smart_hint/detector_thread.h"
+#include "smart_hint/predetector.h"
+#include "smart_hint/name_resolver.h"
+#include "common/ui_element_queue.h"
+#include "common/detector_orchestrator.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -22,6 +26,100 @@
 /* Last selected hint (for external use) */
 char s_last_selected_hint[32] = {0};
 
+/* Keys typed while detection runs, replayed once the hints exist */
+#define TYPEAHEAD_MAX 32
+
+struct typeahead {
+	struct input_event events[TYPEAHEAD_MAX];
+	size_t count;
+	size_t next;    /* Next event to replay */
+};
+
+/**
+ * Take the next buffered key, if any
+ */
+static struct input_event *typeahead_next(struct typeahead *ta)
+{
+	if (!ta || ta->next >= ta->count)
+		return NULL;
+
+	return &ta->events[ta->next++];
+}
+
+/*
+ * Element names still being looked up while the hints are shown
+ *
+ * Hints start out with the role as their name. Once the resolver has
+ * finished they are pointed at the real names: by original_index into
+ * result, or, for streamed hints (which own copies of their names), by
+ * position.
+ */
+struct pending_names {
+	name_resolver_t *resolver;           /* NULL once every name is known */
+	struct ui_detection_result *result;
+	int by_position;
+	int screen_x, screen_y;
+};
+
+static const struct ui_element *pending_names_find(struct pending_names *names,
+                                                   const struct hint *h)
+{
+	struct ui_detection_result *result = names->result;
+
+	if (!names->by_position)
+		return (size_t)h->original_index < result->count ?
+		       &result->elements[h->original_index] : NULL;
+
+	for (size_t i = 0; i < result->count; i++) {
+		if (result->elements[i].x - names->screen_x == h->x &&
+		    result->elements[i].y - names->screen_y == h->y)
+			return &result->elements[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Wait for the names that are still unresolved and give them to the hints
+ */
+static void pending_names_wait(struct pending_names *names, hint_state_t *state)
+{
+	if (!names || !names->resolver)
+		return;
+
+	fprintf(stderr, "DEBUG: Text filter waits for element names\n");
+	name_resolver_finish(names->resolver);
+	names->resolver = NULL;
+
+	for (size_t i = 0; i < state->nr_hints; i++) {
+		struct hint *h = &state->hints[i];
+		const struct ui_element *element = pending_names_find(names, h);
+
+		if (!element || !element->name)
+			continue;
+
+		if (names->by_position) {
+			char *name = strdup(element->name);
+			if (!name)
+				continue;
+			free(h->element_name);
+			h->element_name = name;
+		} else {
+			h->element_name = element->name;
+		}
+	}
+
+	/* Matched hints are copies, they may point to the replaced names */
+	for (size_t i = 0; i < state->nr_matched; i++) {
+		for (size_t j = 0; j < state->nr_hints; j++) {
+			if (state->hints[j].original_index == state->matched[i].original_index) {
+				state->matched[i].element_name = state->hints[j].element_name;
+				break;
+			}
+		}
+	}
+}
+
 /**
  * Get hint size based on screen dimensions
  */
@@ -49,6 +147,8 @@ static void get_hint_size(screen_t scr, int *w, int *h)
  * screen-relative coordinates for proper rendering and mouse movement.
  * The screen_x and screen_y parameters are the screen's origin in
  * virtual screen space.
+ *
+ * Hint names point into result, which must outlive the hints.
  */
 static struct hint *convert_elements_to_hints(struct ui_detection_result *result,
                                                 int hint_w, int hint_h,
@@ -73,10 +173,10 @@ static struct hint *convert_elements_to_hints(struct ui_detection_result *result
 	const char *mode = config_get("smart_hint_mode");
 	int is_numeric_mode = strcmp(mode, "numeric") == 0;
 
-	/* Check if this is an OpenCV result (all elements have no names) */
+	/* Check if this is an OpenCV result (all elements have no names, not even deferred ones) */
 	int all_no_names = 1;
 	for (size_t i = 0; i < result->count; i++) {
-		if (result->elements[i].name != NULL) {
+		if (result->elements[i].name != NULL || result->elements[i].source != NULL) {
 			all_no_names = 0;
 			break;
 		}
@@ -106,9 +206,9 @@ static struct hint *convert_elements_to_hints(struct ui_detection_result *result
 		hints[valid_count].highlighted = 0;
 
 		if (element->name) {
-			hints[valid_count].element_name = strdup(element->name);
+			hints[valid_count].element_name = element->name;
 		} else if (element->role) {
-			hints[valid_count].element_name = strdup(element->role);
+			hints[valid_count].element_name = element->role;
 		} else {
 			hints[valid_count].element_name = NULL;
 		}
@@ -160,7 +260,8 @@ static void navigate_to_hint(struct hint *h, screen_t scr)
 /**
  * Interactive hint selection loop
  */
-static int hint_selection_loop(screen_t scr, struct hint *hints, size_t nr_hints)
+static int hint_selection_loop(screen_t scr, struct hint *hints, size_t nr_hints,
+                               struct typeahead *typeahead, struct pending_names *names)
 {
 	if (nr_hints == 0) {
 		fprintf(stderr, "No hints available\n");
@@ -209,9 +310,15 @@ static int hint_selection_loop(screen_t scr, struct hint *hints, size_t nr_hints
 
 	size_t prev_matched = state->nr_matched;
 
-	/* Main input loop */
+	if (typeahead && typeahead->count)
+		fprintf(stderr, "DEBUG: Replaying %zu keys typed during detection\n",
+		        typeahead->count);
+
+	/* Main input loop (keys typed during detection go first) */
 	while (1) {
-		struct input_event *ev = platform->input_next_event(0);
+		struct input_event *ev = typeahead_next(typeahead);
+		if (!ev)
+			ev = platform->input_next_event(0);
 
 		if (!ev->pressed)
 			continue;
@@ -221,6 +328,10 @@ static int hint_selection_loop(screen_t scr, struct hint *hints, size_t nr_hints
 
 		/* Handle special case: filter character input */
 		if (cmd.type == HINT_CMD_FILTER_CHAR) {
+			/* Text filtering needs the element names */
+			if (cmd.is_letter && hint_mode == HINT_MODE_NUMERIC)
+				pending_names_wait(names, state);
+
 			/* Apply filter character */
 			int append_success = hint_state_append_filter(state, cmd.filter_char, cmd.is_letter);
 			if (!append_success) {
@@ -326,6 +437,369 @@ static int hint_selection_loop(screen_t scr, struct hint *hints, size_t nr_hints
 	return rc;
 }
 
+/**
+ * Show "No elements found" for a moment
+ */
+static void show_no_elements(screen_t scr, int hint_h)
+{
+	fprintf(stderr, "No interactive elements found\n");
+	show_message(scr, "No elements found", hint_h);
+
+	/* Wait a moment so user can see the message */
+	#ifdef _WIN32
+		Sleep(1000);
+	#else
+		usleep(1000000);
+	#endif
+
+	platform->screen_clear(scr);
+	platform->commit();
+}
+
+/**
+ * Wait up to one frame (~16ms) for a key while detection runs
+ *
+ * Doubles as the frame delay of the "Detecting..." loops, so a key press
+ * is handled as soon as it arrives. Keys other than exit are kept in
+ * typeahead for the selection loop.
+ *
+ * @return 1 if the user asked to abandon the detection
+ */
+static int detection_poll_input(struct typeahead *typeahead)
+{
+	struct input_event *ev = platform->input_next_event(16);
+
+	if (!ev || !ev->pressed)
+		return 0;
+
+	if (config_input_match(ev, "exit"))
+		return 1;
+
+	if (typeahead->count < TYPEAHEAD_MAX)
+		typeahead->events[typeahead->count++] = *ev;
+
+	return 0;
+}
+
+static void detection_input_setup(void)
+{
+	const char *keys[] = {
+		"exit",
+	};
+
+	config_input_whitelist(keys, sizeof keys / sizeof keys[0]);
+}
+
+/*
+ * Hints shown while detection is still running
+ *
+ * Every hint is labeled once, when it arrives, from a label space sized
+ * for the largest possible result. Later arrivals take the next free
+ * labels, so hints that are already on screen are never relabeled.
+ */
+struct hint_stream {
+	struct hint *hints;   /* capacity + 1 (room for the status message) */
+	size_t count;
+	size_t capacity;
+	size_t next_label;    /* Labels are never reused, even for dropped hints */
+	int numeric;
+
+	screen_t scr;
+	int hint_w, hint_h;
+	int screen_x, screen_y;
+	int screen_w, screen_h;
+};
+
+static int hint_stream_find(struct hint_stream *stream, int x, int y)
+{
+	for (size_t i = 0; i < stream->count; i++) {
+		if (stream->hints[i].x == x && stream->hints[i].y == y)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+/**
+ * Label and add the elements of one batch, closest to the center first
+ */
+static void hint_stream_add(struct hint_stream *stream,
+                            const struct ui_element *elements, size_t count)
+{
+	size_t first = stream->count;
+
+	for (size_t i = 0; i < count; i++) {
+		const struct ui_element *element = &elements[i];
+		int rel_x = element->x - stream->screen_x;
+		int rel_y = element->y - stream->screen_y;
+
+		if (stream->next_label + (stream->count - first) >= stream->capacity)
+			break;
+
+		/* Skip elements that are outside the current screen bounds */
+		if (rel_x < 0 || rel_y < 0 ||
+		    rel_x >= stream->screen_w || rel_y >= stream->screen_h)
+			continue;
+
+		if (hint_stream_find(stream, rel_x, rel_y) != -1)
+			continue;
+
+		struct hint *h = &stream->hints[stream->count++];
+		memset(h, 0, sizeof(*h));
+		h->x = rel_x;
+		h->y = rel_y;
+		h->w = stream->hint_w;
+		h->h = stream->hint_h;
+
+		if (element->name)
+			h->element_name = strdup(element->name);
+		else if (element->role)
+			h->element_name = strdup(element->role);
+	}
+
+	hint_sorter_sort_by_center(&stream->hints[first], stream->count - first, stream->scr);
+
+	for (size_t i = first; i < stream->count; i++) {
+		struct hint *h = &stream->hints[i];
+
+		h->original_index = (int)stream->next_label;
+		if (stream->numeric)
+			hint_label_assign_numeric(h, stream->next_label, stream->capacity);
+		else
+			hint_label_assign_alphabetic(h, stream->next_label, stream->capacity);
+		stream->next_label++;
+	}
+}
+
+/**
+ * Make the streamed hints match the final result
+ *
+ * Streamed hints that post-processing (deduplication, overlap removal)
+ * dropped are removed, elements that were never streamed are added.
+ * Hints present in both keep their labels.
+ */
+static void hint_stream_reconcile(struct hint_stream *stream,
+                                  struct ui_detection_result *result)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < stream->count; i++) {
+		struct hint *h = &stream->hints[i];
+		int found = 0;
+
+		for (size_t j = 0; result && result->error == 0 && j < result->count; j++) {
+			if (result->elements[j].x - stream->screen_x == h->x &&
+			    result->elements[j].y - stream->screen_y == h->y) {
+				found = 1;
+				break;
+			}
+		}
+
+		if (found)
+			stream->hints[kept++] = *h;
+		else
+			free(h->element_name);
+	}
+	stream->count = kept;
+
+	if (result && result->error == 0)
+		hint_stream_add(stream, result->elements, result->count);
+}
+
+static void hint_stream_draw(struct hint_stream *stream)
+{
+	struct hint *msg = &stream->hints[stream->count];
+	int mx, my;
+
+	/* The status message is drawn with the hints (hint_draw replaces the hint layer) */
+	memset(msg, 0, sizeof(*msg));
+	msg->x = (stream->screen_w - 250) / 2;
+	msg->y = 50;
+	msg->w = 250;
+	msg->h = stream->hint_h;
+	snprintf(msg->label, sizeof(msg->label), "Detecting...");
+
+	platform->screen_clear(stream->scr);
+	platform->hint_draw(stream->scr, stream->hints, stream->count + 1);
+
+	platform->mouse_get_position(&stream->scr, &mx, &my);
+	draw_loading_cursor(stream->scr, mx, my);
+	platform->commit();
+}
+
+/**
+ * Get the number of elements the detection may stream
+ *
+ * The profile of the active application may allow more elements than
+ * ui_max_elements.
+ */
+static size_t stream_capacity(void)
+{
+	struct detector_limits limits;
+	char app[64];
+	int have_app = platform->active_window_class &&
+		       platform->active_window_class(app, sizeof(app));
+
+	detector_orchestrator_limits(have_app ? app : NULL, &limits);
+	if (limits.max_elements <= 0 || limits.max_elements > MAX_HINTS)
+		return MAX_HINTS;
+
+	return (size_t)limits.max_elements;
+}
+
+/**
+ * Smart hint mode with hints drawn as soon as the detector finds them
+ */
+static int streaming_hint_mode(screen_t scr, int hint_w, int hint_h)
+{
+	struct hint_stream stream = {0};
+	struct typeahead typeahead = {0};
+	int rc = -1;
+
+	stream.capacity = stream_capacity();
+	stream.numeric = strcmp(config_get("smart_hint_mode"), "numeric") == 0;
+	stream.scr = scr;
+	stream.hint_w = hint_w;
+	stream.hint_h = hint_h;
+	if (platform->screen_get_offset)
+		platform->screen_get_offset(scr, &stream.screen_x, &stream.screen_y);
+	platform->screen_get_dimensions(scr, &stream.screen_w, &stream.screen_h);
+
+	stream.hints = calloc(stream.capacity + 1, sizeof(struct hint));
+	struct ui_element_queue *queue = ui_element_queue_create();
+	detector_thread_t *thread = detector_thread_create();
+
+	if (!stream.hints || !queue || !thread) {
+		fprintf(stderr, "Failed to set up streaming detection\n");
+		goto out;
+	}
+
+	hint_stream_draw(&stream);
+
+	/* Lock keyboard during detection */
+	platform->input_grab_keyboard();
+	detection_input_setup();
+
+	if (detector_thread_start_streaming(thread, queue) != 0) {
+		fprintf(stderr, "Failed to start detection thread\n");
+		platform->input_ungrab_keyboard();
+		goto out;
+	}
+
+	/* Draw hints batch by batch while detection runs */
+	while (!detector_thread_is_done(thread)) {
+		struct ui_element_batch batch;
+
+		while (ui_element_queue_pop(queue, &batch)) {
+			hint_stream_add(&stream, batch.elements, batch.count);
+			ui_element_batch_free(&batch);
+		}
+
+		hint_stream_draw(&stream);
+
+		/* Waiting for input also limits the redraw rate (~60 FPS) */
+		if (detection_poll_input(&typeahead)) {
+			fprintf(stderr, "Detection cancelled\n");
+
+			/* The thread frees the queue when the detector returns */
+			detector_thread_cancel(thread);
+			thread = NULL;
+			queue = NULL;
+
+			platform->input_ungrab_keyboard();
+			platform->screen_clear(scr);
+			platform->commit();
+			goto out;
+		}
+	}
+
+	struct ui_detection_result *result = detector_thread_join(thread);
+	thread = NULL;
+
+	platform->input_ungrab_keyboard();
+
+	/* Batches published right before the thread finished */
+	struct ui_element_batch batch;
+	while (ui_element_queue_pop(queue, &batch)) {
+		hint_stream_add(&stream, batch.elements, batch.count);
+		ui_element_batch_free(&batch);
+	}
+
+	if (result && result->error != 0)
+		fprintf(stderr, "Detection error: %s\n", result->error_msg);
+
+	hint_stream_reconcile(&stream, result);
+
+	/* Names are looked up while the user reads the hints */
+	struct pending_names names = { NULL, result, 1, stream.screen_x, stream.screen_y };
+	if (result && result->error == 0 && stream.count > 0)
+		names.resolver = name_resolver_start(result);
+
+	platform->screen_clear(scr);
+	platform->commit();
+	platform->mouse_show();
+
+	fprintf(stderr, "DEBUG: Streamed %zu hints (%zu labels used, capacity %zu)\n",
+	        stream.count, stream.next_label, stream.capacity);
+
+	if (stream.count == 0)
+		show_no_elements(scr, hint_h);
+	else
+		rc = hint_selection_loop(scr, stream.hints, stream.count, &typeahead, &names);
+
+	name_resolver_cancel(names.resolver);
+	platform->free_ui_elements(result);
+
+out:
+	if (thread)
+		detector_thread_destroy(thread);
+	ui_element_queue_destroy(queue);
+	for (size_t i = 0; i < stream.count; i++)
+		free(stream.hints[i].element_name);
+	free(stream.hints);
+	platform->mouse_show();
+
+	return rc;
+}
+
+/**
+ * Wait for the pre-detection of the focused window to finish
+ *
+ * Runs the same "Detecting..." loop as a detection of our own, so exit
+ * still abandons it right away (the pre-detector keeps the result for
+ * the next activation).
+ *
+ * @return PREDETECT_HIT or PREDETECT_MISS, or -1 if the user cancelled
+ */
+static int wait_predetection(screen_t scr, int hint_h, struct typeahead *typeahead,
+                             struct ui_detection_result **result)
+{
+	int status;
+	int mx, my;
+
+	platform->input_grab_keyboard();
+	detection_input_setup();
+
+	while ((status = predetector_take(0, result)) == PREDETECT_PENDING) {
+		platform->mouse_get_position(&scr, &mx, &my);
+		show_message(scr, "Detecting...", hint_h);
+		draw_loading_cursor(scr, mx, my);
+		platform->commit();
+
+		if (detection_poll_input(typeahead)) {
+			fprintf(stderr, "Detection cancelled\n");
+			status = -1;
+			break;
+		}
+	}
+
+	platform->input_ungrab_keyboard();
+	platform->screen_clear(scr);
+	platform->commit();
+
+	return status;
+}
+
 /**
  * Main smart hint mode entry point
  */
@@ -346,6 +820,23 @@ int smart_hint_mode(void)
 
 	platform->mouse_hide();
 
+	struct typeahead typeahead = {0};
+
+	/* Use the result of a speculative detection if one is ready */
+	struct ui_detection_result *result;
+	int predetected = predetector_take(16, &result);
+	if (predetected == PREDETECT_PENDING)
+		predetected = wait_predetection(scr, hint_h, &typeahead, &result);
+	if (predetected == -1) {
+		platform->mouse_show();
+		return -1;
+	}
+	if (result)
+		goto detected;
+
+	if (config_get_int("smart_hint_streaming") && platform->detect_ui_elements_streaming)
+		return streaming_hint_mode(scr, hint_w, hint_h);
+
 	show_message(scr, "Detecting...", hint_h);
 
 	int mx, my;
@@ -355,6 +846,7 @@ int smart_hint_mode(void)
 
 	/* Lock keyboard during detection */
 	platform->input_grab_keyboard();
+	detection_input_setup();
 
 	/* Start detection in background thread */
 	detector_thread_t *thread = detector_thread_create();
@@ -381,16 +873,21 @@ int smart_hint_mode(void)
 		draw_loading_cursor(scr, mx, my);
 		platform->commit();
 
-		/* Sleep to avoid excessive CPU usage (~60 FPS) */
-#ifdef _WIN32
-		Sleep(16);
-#else
-		usleep(16000);
-#endif
+		/* Waiting for input also limits the redraw rate (~60 FPS) */
+		if (detection_poll_input(&typeahead)) {
+			fprintf(stderr, "Detection cancelled\n");
+			detector_thread_cancel(thread);
+
+			platform->input_ungrab_keyboard();
+			platform->screen_clear(scr);
+			platform->commit();
+			platform->mouse_show();
+			return -1;
+		}
 	}
 
 	/* Wait for thread and get result */
-	struct ui_detection_result *result = detector_thread_join(thread);
+	result = detector_thread_join(thread);
 
 	/* Unlock keyboard */
 	platform->input_ungrab_keyboard();
@@ -398,6 +895,7 @@ int smart_hint_mode(void)
 	platform->screen_clear(scr);
 	platform->commit();
 
+detected:
 	platform->mouse_show();
 
 	if (!result) {
@@ -428,37 +926,25 @@ int smart_hint_mode(void)
 	                                                      screen_w, screen_h,
 	                                                      &hint_count, &is_opencv);
 
-	/* Free detection result (we've copied what we need) */
-	platform->free_ui_elements(result);
-
 	if (!hint_array || hint_count == 0) {
-		fprintf(stderr, "No interactive elements found\n");
-		show_message(scr, "No elements found", hint_h);
-
-		/* Wait a moment so user can see the message */
-		#ifdef _WIN32
-			Sleep(1000);
-		#else
-			usleep(1000000);
-		#endif
-
-		platform->screen_clear(scr);
-		platform->commit();
+		show_no_elements(scr, hint_h);
 
 		if (hint_array)
 			free(hint_array);
+		platform->free_ui_elements(result);
 		return -1;
 	}
 
+	/* Names are looked up while the user reads the hints */
+	struct pending_names names = { name_resolver_start(result), result, 0, screen_x, screen_y };
+
 	/* Run hint selection */
-	int rc = hint_selection_loop(scr, hint_array, hint_count);
+	int rc = hint_selection_loop(scr, hint_array, hint_count, &typeahead, &names);
 
-	/* Cleanup */
-	for (size_t i = 0; i < hint_count; i++) {
-		if (hint_array[i].element_name)
-			free(hint_array[i].element_name);
-	}
+	/* Cleanup (hint names belong to the result) */
+	name_resolver_cancel(names.resolver);
 	free(hint_array);
+	platform->free_ui_elements(result);
 
 	return rc;
 }
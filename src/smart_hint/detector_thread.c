@@ -7,6 +7,7 @@
  */
 
 #include "detector_thread.h"
+#include "../common/ui_element_queue.h"
 #include <stdlib.h>
 
 #ifdef _WIN32
@@ -20,7 +21,10 @@ extern struct platform *platform;
 /* Internal thread context structure */
 struct detector_thread {
 	volatile int done;
+	int abandoned;                  /* Cancelled before done, worker cleans up */
+	struct ui_cancel_token cancel;
 	struct ui_detection_result *result;
+	struct ui_element_queue *queue; /* Streaming target, or NULL */
 
 #ifdef _WIN32
 	HANDLE thread;
@@ -31,6 +35,24 @@ struct detector_thread {
 #endif
 };
 
+/**
+ * Free the handle, its result and its queue (after the worker has finished)
+ */
+static void release_abandoned(detector_thread_t *ctx)
+{
+	if (ctx->result)
+		platform->free_ui_elements(ctx->result);
+	ui_element_queue_destroy(ctx->queue);
+
+#ifdef _WIN32
+	DeleteCriticalSection(&ctx->lock);
+#else
+	pthread_mutex_destroy(&ctx->lock);
+#endif
+
+	free(ctx);
+}
+
 /**
  * Thread entry point - runs UI detection
  */
@@ -42,20 +64,31 @@ static void *detection_worker(void *param)
 {
 	detector_thread_t *ctx = (detector_thread_t *)param;
 
+	int abandoned;
+
 	/* Run platform-specific detection */
-	ctx->result = platform->detect_ui_elements();
+	if (ctx->queue && platform->detect_ui_elements_streaming)
+		ctx->result = platform->detect_ui_elements_streaming(ctx->queue, &ctx->cancel);
+	else
+		ctx->result = platform->detect_ui_elements(&ctx->cancel);
 
 	/* Mark as done (thread-safe) */
 #ifdef _WIN32
 	EnterCriticalSection(&ctx->lock);
 	ctx->done = 1;
+	abandoned = ctx->abandoned;
 	LeaveCriticalSection(&ctx->lock);
 #else
 	pthread_mutex_lock(&ctx->lock);
 	ctx->done = 1;
+	abandoned = ctx->abandoned;
 	pthread_mutex_unlock(&ctx->lock);
 #endif
 
+	/* Nobody will join, the handle is ours to free */
+	if (abandoned)
+		release_abandoned(ctx);
+
 	return 0;
 }
 
@@ -101,6 +134,17 @@ int detector_thread_start(detector_thread_t *thread)
 	return 0;
 }
 
+int detector_thread_start_streaming(detector_thread_t *thread,
+                                    struct ui_element_queue *queue)
+{
+	if (!thread) {
+		return -1;
+	}
+
+	thread->queue = queue;
+	return detector_thread_start(thread);
+}
+
 int detector_thread_is_done(detector_thread_t *thread)
 {
 	if (!thread) {
@@ -151,14 +195,62 @@ struct ui_detection_result* detector_thread_join(detector_thread_t *thread)
 	return result;
 }
 
+void detector_thread_cancel(detector_thread_t *thread)
+{
+	if (!thread) {
+		return;
+	}
+
+	int done;
+
+#ifdef _WIN32
+	HANDLE handle = thread->thread;
+
+	EnterCriticalSection(&thread->lock);
+	thread->cancel.cancelled = 1;
+	done = thread->done;
+	thread->abandoned = !done;
+	LeaveCriticalSection(&thread->lock);
+
+	if (done) {
+		WaitForSingleObject(handle, INFINITE);
+		CloseHandle(handle);
+		release_abandoned(thread);
+	} else {
+		/* The worker frees everything once the detector returns */
+		CloseHandle(handle);
+	}
+#else
+	pthread_t handle = thread->thread;
+
+	pthread_mutex_lock(&thread->lock);
+	thread->cancel.cancelled = 1;
+	done = thread->done;
+	thread->abandoned = !done;
+	pthread_mutex_unlock(&thread->lock);
+
+	if (done) {
+		pthread_join(handle, NULL);
+		release_abandoned(thread);
+	} else {
+		/* The worker frees everything once the detector returns */
+		pthread_detach(handle);
+	}
+#endif
+}
+
 void detector_thread_destroy(detector_thread_t *thread)
 {
 	if (!thread) {
 		return;
 	}
 
-	/* Note: This doesn't actually stop the thread, just cleans up */
-	/* Only call this if you haven't called detector_thread_join */
+	/*
+	 * Only for a handle whose thread was never started (or failed to
+	 * start). A running detection is stopped with detector_thread_cancel(),
+	 * which leaves its cleanup to the worker, or collected with
+	 * detector_thread_join().
+	 */
 
 #ifdef _WIN32
 	if (thread->thread) {
@@ -30,6 +30,20 @@ detector_thread_t* detector_thread_create(void);
  */
 int detector_thread_start(detector_thread_t *thread);
 
+/**
+ * Start UI detection in background thread, streaming elements as found
+ *
+ * Batches are published to queue while detection runs; the joined result
+ * is still complete. Falls back to detector_thread_start() behavior on
+ * platforms without streaming support.
+ *
+ * @param thread Thread handle
+ * @param queue Queue to publish to (must outlive the thread)
+ * @return 0 on success, -1 on failure
+ */
+int detector_thread_start_streaming(detector_thread_t *thread,
+                                    struct ui_element_queue *queue);
+
 /**
  * Check if detection is complete
  *
@@ -51,9 +65,22 @@ int detector_thread_is_done(detector_thread_t *thread);
 struct ui_detection_result* detector_thread_join(detector_thread_t *thread);
 
 /**
- * Destroy detector thread without waiting
+ * Cancel the detection and release the thread without waiting for it
+ *
+ * The detectors stop at their next cancellation check. The result and
+ * the queue given to detector_thread_start_streaming() are freed by the
+ * worker once the detector returns, so neither may be used afterwards.
+ * The thread handle is invalid after this call.
+ *
+ * @param thread Running thread handle (will be freed)
+ */
+void detector_thread_cancel(detector_thread_t *thread);
+
+/**
+ * Destroy a detector thread handle that was never started
  *
- * Only call if you haven't called detector_thread_join yet.
+ * Use detector_thread_cancel() to abandon a running detection and
+ * detector_thread_join() to collect its result.
  *
  * @param thread Thread handle to destroy
  */
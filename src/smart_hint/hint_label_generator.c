@@ -8,59 +8,81 @@
 #include <stdio.h>
 #include <string.h>
 
-void hint_label_generate_alphabetic(struct hint *hints, size_t count)
+/**
+ * Label length needed to give every index below capacity a distinct label
+ */
+static int alphabetic_label_len(size_t capacity)
 {
-	if (!hints || count == 0) {
-		return;
-	}
-
-	/* Calculate label length needed */
 	int label_len = 1;
 	size_t max_elements = 26;
 
-	while (max_elements < count) {
+	while (max_elements < capacity) {
 		label_len++;
 		max_elements *= 26;
 	}
 
-	/* Generate labels */
-	for (size_t i = 0; i < count; i++) {
-		int remaining = i;
-		char label[16] = {0};
-
-		/* Initialize all positions to 'A' */
-		for (int j = 0; j < label_len; j++) {
-			label[j] = 'A';
-		}
-
-		/* Convert index to base-26 representation */
-		for (int pos = 0; pos < label_len && remaining > 0; pos++) {
-			int val = remaining % 26;
-			label[pos] = 'A' + val;
-			remaining /= 26;
-		}
-
-		strncpy(hints[i].label, label, sizeof(hints[i].label) - 1);
+	return label_len;
+}
+
+static int numeric_label_len(size_t capacity)
+{
+	int label_len = 1;
+	size_t max_with_len = 9;
+
+	while (max_with_len < capacity) {
+		label_len++;
+		max_with_len = max_with_len * 10 + 9;
 	}
+
+	return label_len;
 }
 
-void hint_label_generate_numeric(struct hint *hints, size_t count)
+void hint_label_assign_alphabetic(struct hint *hint, size_t index, size_t capacity)
+{
+	int label_len = alphabetic_label_len(capacity);
+	size_t remaining = index;
+	char label[16] = {0};
+
+	/* Initialize all positions to 'A' */
+	for (int j = 0; j < label_len; j++) {
+		label[j] = 'A';
+	}
+
+	/* Convert index to base-26 representation */
+	for (int pos = 0; pos < label_len && remaining > 0; pos++) {
+		int val = remaining % 26;
+		label[pos] = 'A' + val;
+		remaining /= 26;
+	}
+
+	strncpy(hint->label, label, sizeof(hint->label) - 1);
+}
+
+void hint_label_assign_numeric(struct hint *hint, size_t index, size_t capacity)
+{
+	snprintf(hint->label, sizeof(hint->label), "%0*zu",
+	         numeric_label_len(capacity), index + 1);
+}
+
+void hint_label_generate_alphabetic(struct hint *hints, size_t count)
 {
 	if (!hints || count == 0) {
 		return;
 	}
 
-	/* Calculate label length needed (zero-padded) */
-	int label_len = 1;
-	size_t max_with_len = 9;
+	for (size_t i = 0; i < count; i++) {
+		hint_label_assign_alphabetic(&hints[i], i, count);
+	}
+}
 
-	while (max_with_len < count) {
-		label_len++;
-		max_with_len = max_with_len * 10 + 9;
+void hint_label_generate_numeric(struct hint *hints, size_t count)
+{
+	if (!hints || count == 0) {
+		return;
 	}
 
-	/* Generate labels starting from 1 */
+	/* Generate labels starting from 1, zero-padded to equal length */
 	for (size_t i = 0; i < count; i++) {
-		snprintf(hints[i].label, sizeof(hints[i].label), "%0*zu", label_len, i + 1);
+		hint_label_assign_numeric(&hints[i], i, count);
 	}
 }
@@ -35,4 +35,18 @@ void hint_label_generate_alphabetic(struct hint *hints, size_t count);
  */
 void hint_label_generate_numeric(struct hint *hints, size_t count);
 
+/**
+ * Assign the label of a single hint, independently of the other hints
+ *
+ * The label length only depends on capacity, so hints labeled one batch
+ * at a time keep their labels as more hints are added (as long as the
+ * total stays within capacity).
+ *
+ * @param hint Hint to label
+ * @param index Position of the hint (0-based)
+ * @param capacity Maximum number of hints that will be labeled
+ */
+void hint_label_assign_alphabetic(struct hint *hint, size_t index, size_t capacity);
+void hint_label_assign_numeric(struct hint *hint, size_t index, size_t capacity);
+
 #endif /* HINT_LABEL_GENERATOR_H */
@@ -0,0 +1,99 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Smart Hint - Background Element Name Resolver Implementation
+ */
+
+#include "name_resolver.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+extern struct platform *platform;
+
+struct name_resolver {
+	struct ui_detection_result *result;
+	struct ui_cancel_token cancel;
+	int resolved;
+
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+#ifdef _WIN32
+static DWORD WINAPI resolve_worker(LPVOID param)
+#else
+static void *resolve_worker(void *param)
+#endif
+{
+	name_resolver_t *resolver = param;
+
+	resolver->resolved = platform->resolve_ui_element_names(resolver->result,
+	                                                        &resolver->cancel);
+	return 0;
+}
+
+name_resolver_t *name_resolver_start(struct ui_detection_result *result)
+{
+	if (!result || !result->deferred_names || !platform->resolve_ui_element_names)
+		return NULL;
+
+	name_resolver_t *resolver = calloc(1, sizeof(*resolver));
+	if (!resolver)
+		return NULL;
+
+	resolver->result = result;
+
+#ifdef _WIN32
+	resolver->thread = CreateThread(NULL, 0, resolve_worker, resolver, 0, NULL);
+	if (!resolver->thread) {
+		free(resolver);
+		return NULL;
+	}
+#else
+	if (pthread_create(&resolver->thread, NULL, resolve_worker, resolver) != 0) {
+		free(resolver);
+		return NULL;
+	}
+#endif
+
+	return resolver;
+}
+
+static void resolver_join(name_resolver_t *resolver)
+{
+#ifdef _WIN32
+	WaitForSingleObject(resolver->thread, INFINITE);
+	CloseHandle(resolver->thread);
+#else
+	pthread_join(resolver->thread, NULL);
+#endif
+}
+
+void name_resolver_finish(name_resolver_t *resolver)
+{
+	if (!resolver)
+		return;
+
+	resolver_join(resolver);
+	fprintf(stderr, "Resolved %d element names\n", resolver->resolved);
+	free(resolver);
+}
+
+void name_resolver_cancel(name_resolver_t *resolver)
+{
+	if (!resolver)
+		return;
+
+	resolver->cancel.cancelled = 1;
+	resolver_join(resolver);
+	free(resolver);
+}
@@ -0,0 +1,45 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Smart Hint - Background Element Name Resolver
+ *
+ * Detectors may leave element names out so that hints can be drawn as
+ * soon as the geometry is known. The resolver looks the names up in a
+ * background thread while the user reads the hints.
+ */
+
+#ifndef NAME_RESOLVER_H
+#define NAME_RESOLVER_H
+
+#include "../platform.h"
+
+/* Opaque resolver handle */
+typedef struct name_resolver name_resolver_t;
+
+/**
+ * Start resolving the deferred names of result
+ *
+ * result must stay alive until name_resolver_finish() or
+ * name_resolver_cancel() returns, and its element names must not be read
+ * before then.
+ *
+ * @return Resolver handle, or NULL if result has no deferred names (or
+ *         the platform cannot resolve them, or the thread failed)
+ */
+name_resolver_t *name_resolver_start(struct ui_detection_result *result);
+
+/**
+ * Wait until every name is resolved
+ *
+ * @param resolver Resolver handle (will be freed)
+ */
+void name_resolver_finish(name_resolver_t *resolver);
+
+/**
+ * Stop resolving and wait for the thread to return
+ *
+ * @param resolver Resolver handle (will be freed)
+ */
+void name_resolver_cancel(name_resolver_t *resolver);
+
+#endif /* NAME_RESOLVER_H */
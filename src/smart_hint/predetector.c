@@ -0,0 +1,277 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Smart Hint - Speculative Pre-detector Implementation
+ *
+ * A single background thread waits for focus changes and keeps the
+ * detection result of the focused window around. smart_hint_mode() takes
+ * that result instead of starting a detection of its own when it is still
+ * fresh and belongs to the window that is focused at activation time.
+ * A detection of that window that is still under way is reported as
+ * pending, so the caller can wait for it without blocking its UI.
+ */
+
+#include "predetector.h"
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+extern struct platform *platform;
+
+/* How often the thread checks whether it should stop (ms) */
+#define PREDETECT_WAIT_INTERVAL 250
+
+/* Focus must stay on a window this long before it is detected (ms) */
+#define PREDETECT_SETTLE_TIME 100
+
+static volatile int running = 0;
+static volatile int stopping = 0;
+static int max_age_ms = 0;
+
+/* Protected by lock */
+static struct ui_detection_result *cached = NULL;
+static uint64_t cached_window = 0;
+static int64_t cached_time = 0;
+static uint64_t detecting_window = 0;     /* Window being detected, 0 if none */
+static struct ui_cancel_token detect_token; /* Cuts the running detection short */
+static unsigned int hits = 0;
+static unsigned int misses = 0;
+
+#ifdef _WIN32
+static HANDLE thread;
+static CRITICAL_SECTION lock;
+static CONDITION_VARIABLE stored;         /* Signaled when a result is stored */
+static int lock_initialized = 0;
+
+static void lock_acquire(void)
+{
+	if (!lock_initialized) {
+		InitializeCriticalSection(&lock);
+		InitializeConditionVariable(&stored);
+		lock_initialized = 1;
+	}
+	EnterCriticalSection(&lock);
+}
+static void lock_release(void) { LeaveCriticalSection(&lock); }
+static void wait_stored(int timeout_ms) { SleepConditionVariableCS(&stored, &lock, timeout_ms); }
+static void signal_stored(void) { WakeAllConditionVariable(&stored); }
+
+static int64_t now_ms(void)
+{
+	return (int64_t)GetTickCount64();
+}
+#else
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stored = PTHREAD_COND_INITIALIZER; /* Signaled when a result is stored */
+
+static void lock_acquire(void) { pthread_mutex_lock(&lock); }
+static void lock_release(void) { pthread_mutex_unlock(&lock); }
+static void wait_stored(int timeout_ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_cond_timedwait(&stored, &lock, &ts);
+}
+static void signal_stored(void) { pthread_cond_broadcast(&stored); }
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+/**
+ * Note that detection of window has started
+ */
+static void start_detection(uint64_t window)
+{
+	lock_acquire();
+	detecting_window = window;
+	detect_token.cancelled = stopping;
+	lock_release();
+}
+
+/**
+ * Replace the cached result (takes ownership of result)
+ *
+ * Also ends the detection in progress, if any.
+ */
+static void store_result(uint64_t window, struct ui_detection_result *result)
+{
+	struct ui_detection_result *old;
+
+	lock_acquire();
+	old = cached;
+	cached = result;
+	cached_window = window;
+	cached_time = now_ms();
+	detecting_window = 0;
+	signal_stored();
+	lock_release();
+
+	if (old)
+		platform->free_ui_elements(old);
+}
+
+/**
+ * Thread entry point - detect the focused window after each focus change
+ */
+#ifdef _WIN32
+static DWORD WINAPI predetect_worker(LPVOID param)
+#else
+static void *predetect_worker(void *param)
+#endif
+{
+	uint64_t detected_window = 0;
+
+	(void)param;
+
+	while (!stopping) {
+		int changed = platform->wait_active_window_change(PREDETECT_WAIT_INTERVAL);
+
+		/* Let focus settle so quick Alt-Tab cycling is not detected */
+		while (changed && !stopping)
+			changed = platform->wait_active_window_change(PREDETECT_SETTLE_TIME);
+
+		if (stopping)
+			break;
+
+		uint64_t window = platform->active_window_id();
+		if (!window || window == detected_window)
+			continue;
+
+		detected_window = window;
+		start_detection(window);
+
+		struct ui_detection_result *result = platform->detect_ui_elements(&detect_token);
+
+		/* Detect the window again when it regains focus */
+		if (detect_token.cancelled)
+			detected_window = 0;
+
+		if (result && result->error != 0) {
+			platform->free_ui_elements(result);
+			result = NULL;
+		}
+
+		if (result)
+			fprintf(stderr, "Pre-detected %zu elements for window 0x%llx\n",
+			        result->count, (unsigned long long)window);
+
+		store_result(window, result);
+	}
+
+	return 0;
+}
+
+int predetector_start(int max_age)
+{
+	max_age_ms = max_age;
+
+	if (running)
+		return 0;
+
+	if (!platform->detect_ui_elements || !platform->active_window_id ||
+	    !platform->wait_active_window_change) {
+		fprintf(stderr, "Pre-detection not supported on this platform\n");
+		return -1;
+	}
+
+	stopping = 0;
+
+#ifdef _WIN32
+	thread = CreateThread(NULL, 0, predetect_worker, NULL, 0, NULL);
+	if (!thread) {
+		return -1;
+	}
+#else
+	if (pthread_create(&thread, NULL, predetect_worker, NULL) != 0) {
+		return -1;
+	}
+#endif
+
+	running = 1;
+	return 0;
+}
+
+void predetector_stop(void)
+{
+	if (!running)
+		return;
+
+	lock_acquire();
+	stopping = 1;
+	detect_token.cancelled = 1;
+	lock_release();
+
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+
+	running = 0;
+	store_result(0, NULL);
+}
+
+int predetector_take(int wait_ms, struct ui_detection_result **result)
+{
+	int status = PREDETECT_MISS;
+
+	*result = NULL;
+
+	if (!running)
+		return PREDETECT_MISS;
+
+	uint64_t window = platform->active_window_id();
+
+	lock_acquire();
+
+	/*
+	 * A detection of this window that is under way finishes sooner than
+	 * a new one, which would have to wait for it anyway
+	 */
+	if (window && detecting_window == window && wait_ms > 0)
+		wait_stored(wait_ms);
+
+	if (window && detecting_window == window) {
+		status = PREDETECT_PENDING;
+	} else if (cached && window && cached_window == window &&
+		   now_ms() - cached_time <= max_age_ms) {
+		*result = cached;
+		cached = NULL;
+		status = PREDETECT_HIT;
+		hits++;
+	} else {
+		/* Don't make the caller's detection queue behind another window */
+		if (detecting_window)
+			detect_token.cancelled = 1;
+		misses++;
+	}
+
+	if (status != PREDETECT_PENDING)
+		fprintf(stderr, "Pre-detection %s (hits: %u, misses: %u)\n",
+		        status == PREDETECT_HIT ? "hit" : "miss", hits, misses);
+
+	lock_release();
+
+	return status;
+}
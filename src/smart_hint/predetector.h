@@ -0,0 +1,55 @@
+/*
+ * warpd - A modal keyboard-driven pointing system.
+ *
+ * Smart Hint - Speculative Pre-detector
+ *
+ * Runs UI detection in the background whenever the focused window changes,
+ * so that smart hint mode usually finds the result ready when it starts.
+ * Requires the platform's active window tracking hooks.
+ */
+
+#ifndef PREDETECTOR_H
+#define PREDETECTOR_H
+
+#include "../platform.h"
+
+/**
+ * Start the background pre-detector (no-op if it is already running)
+ *
+ * @param max_age Maximum age in milliseconds of a usable result
+ * @return 0 on success, -1 if unsupported or the thread failed to start
+ */
+int predetector_start(int max_age);
+
+/**
+ * Stop the pre-detector and discard any pending result
+ *
+ * Blocks until an in-flight detection has finished.
+ */
+void predetector_stop(void);
+
+/* predetector_take() outcomes */
+enum {
+	PREDETECT_MISS,
+	PREDETECT_HIT,
+	PREDETECT_PENDING,    /* The focused window is still being pre-detected */
+};
+
+/**
+ * Take the pre-detected result for the focused window
+ *
+ * Counts a hit if a fresh result for the currently focused window exists,
+ * a miss otherwise. A miss cancels the pre-detection of another window
+ * so that it does not hold up the caller's own detection. Ownership of
+ * the result is transferred to the caller (free with
+ * platform->free_ui_elements).
+ *
+ * @param wait_ms How long to wait for a pre-detection of the focused
+ *                window that is under way
+ * @param result Set to the detection result on a hit, NULL otherwise
+ * @return PREDETECT_HIT, PREDETECT_MISS, or PREDETECT_PENDING if the
+ *         pre-detection of the focused window has not finished yet
+ */
+int predetector_take(int wait_ms, struct ui_detection_result **result);
+
+#endif /* PREDETECTOR_H */
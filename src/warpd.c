@@ -5,6 +5,7 @@
  */
 
 #include "warpd.h"
+#include "common/detector_profile.h"
 
 struct platform *platform = NULL;
 
@@ -113,6 +114,7 @@ static void print_usage()
 		"  -c, --config <config file>  Use the supplied config file.\n"
 		"  -l, --list-keys             Print all valid keys.\n"
 		"  --list-options              Print all available config options.\n"
+		"  --detector-stats            Print the detection profiles learned for each application.\n"
 
 		"  --hint                      Start warpd in hint mode and exit after the end of the session.\n"
 		"  --hint2                     Start warpd in two pass hint mode and exit after the end of the session.\n"
@@ -161,6 +163,7 @@ int oneshot_main(struct platform *_platform)
 			platform->mouse_down(config_get_int("drag_button"));
 
 		ret = mode_loop(mode, oneshot_flag, record_flag);
+		detector_profile_save();
 
 		if (drag_flag)
 			platform->mouse_up(config_get_int("drag_button"));
@@ -188,6 +191,18 @@ int daemon_main(struct platform *_platform)
 	return 0;
 }
 
+/*
+ * Detector helper started by the daemon (--detectd), not meant to be run
+ * by hand.
+ */
+static int detectd_main(void)
+{
+	/* The daemon sends its options with the requests */
+	parse_config_stream(NULL);
+
+	return platform_run_detector_helper();
+}
+
 int print_keys_main(struct platform *platform)
 {
 	size_t i;
@@ -209,6 +224,7 @@ int main(int argc, char *argv[])
 {
 	int c;
 	int foreground = 0;
+	int detectd = 0;
 	config_path = get_config_path("config");
 
 	struct option opts[] = {
@@ -232,6 +248,8 @@ int main(int argc, char *argv[])
 		{"record", no_argument, NULL, 266},
 		{"drag", no_argument, NULL, 267},
 		{"screen", no_argument, NULL, 268},
+		{"detectd", no_argument, NULL, 270},
+		{"detector-stats", no_argument, NULL, 271},
 		{0}
 	};
 
@@ -297,6 +315,12 @@ int main(int argc, char *argv[])
 			case 267:
 				drag_flag = 1;
 				break;
+			case 270:
+				detectd = 1;
+				break;
+			case 271:
+				detector_profile_dump(stdout);
+				return 0;
 			case 260:
 				config_print_options();
 				return 0;
@@ -305,7 +329,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (mode || oneshot_flag) {
+	if (detectd) {
+		return detectd_main();
+	} else if (mode || oneshot_flag) {
 		platform_run(oneshot_main);
 	} else {
 		lock();
@@ -139,6 +139,9 @@ void init_mouse();
 const char *get_config_path(const char *file);
 const char *get_data_path(const char *file);
 void parse_config(const char *path);
+void parse_config_stream(FILE *fh);
+void config_write(FILE *fh);
+unsigned int config_generation(void);
 const char *config_get(const char *key);
 int config_get_int(const char *key);
 void config_print_options();